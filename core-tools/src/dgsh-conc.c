@@ -29,7 +29,7 @@
 #include <limits.h>
 #include <string.h>
 #include <unistd.h>		/* getpid(), alarm() */
-#include <sys/select.h>
+#include <poll.h>		/* poll() */
 #include <signal.h>		/* sig_atomic_t */
 
 #include "negotiate.h"		/* read/write_message_block(),
@@ -240,8 +240,6 @@ print_state(int i, int var, int pcase)
 	}
 }
 
-#define max(a, b) ((a) > (b) ? (a) : (b))
-
 /*
  * Pass around the message blocks so that they reach all processes
  * connected through the concentrator.
@@ -249,8 +247,8 @@ print_state(int i, int var, int pcase)
 STATIC int
 pass_message_blocks(void)
 {
-	fd_set readfds, writefds;
-	int nfds = 0;
+	struct pollfd *pfd;	/* poll(2) entries, one per port */
+	int nfds;
 	int i;
 	int oi = -1;		/* scatter/gather block's origin index */
 	int ofd = -1;		/* ... origin fd direction */
@@ -270,22 +268,31 @@ pass_message_blocks(void)
 		pi[STDOUT_FILENO].to_write = chosen_mb;
 	}
 
+	/*
+	 * Use poll(2) rather than select(2), because a concentrator's
+	 * ports can exceed FD_SETSIZE.
+	 */
+	pfd = (struct pollfd *)calloc(nfd, sizeof(struct pollfd));
+	if (pfd == NULL)
+		err(1, "calloc");
+
 	for (;;) {
-		// Create select(2) masks
-		FD_ZERO(&readfds);
-		FD_ZERO(&writefds);
+		// Create poll(2) entries; negative fds are ignored
 		for (i = 0; i < nfd; i++) {
+			pfd[i].fd = -1;
+			pfd[i].events = 0;
+			pfd[i].revents = 0;
 			if (noinput && i == STDIN_FILENO)
 				continue;
 			if (i == STDERR_FILENO)
 				continue;
 			if (!pi[i].seen) {
-				FD_SET(i, &readfds);
-				nfds = max(i + 1, nfds);
+				pfd[i].fd = i;
+				pfd[i].events |= POLLIN;
 			}
 			if (pi[i].to_write && !pi[i].written) {
-				FD_SET(i, &writefds);
-				nfds = max(i + 1, nfds);
+				pfd[i].fd = i;
+				pfd[i].events |= POLLOUT;
 				pi[i].to_write->is_origin_conc = true;
 				pi[i].to_write->conc_pid = pid;
 				DPRINTF(4, "Actual origin: conc with pid %d", pid);
@@ -293,16 +300,25 @@ pass_message_blocks(void)
 		}
 
 	again:
-		if (select(nfds, &readfds, &writefds, NULL, NULL) < 0) {
+		if (poll(pfd, nfd, -1) < 0) {
 			if (errno == EINTR)
 				goto again;
 			/* All other cases are internal errors. */
-			err(1, "select");
+			err(1, "poll");
 		}
 
-		// Read/write what we can
+		/*
+		 * Read/write what we can.  As with select(2), a hung up
+		 * or failed port is handled by the operation waiting on it,
+		 * which reports the error.
+		 */
 		for (i = 0; i < nfd; i++) {
-			if (FD_ISSET(i, &writefds)) {
+			if (pfd[i].revents & POLLNVAL) {
+				errno = EBADF;
+				err(1, "poll");
+			}
+			if ((pfd[i].events & POLLOUT) && (pfd[i].revents &
+					(POLLOUT | POLLERR | POLLHUP))) {
 				iswrite = true;
 				assert(pi[i].to_write);
 				chosen_mb = pi[i].to_write;
@@ -323,7 +339,8 @@ pass_message_blocks(void)
 				}
 				pi[i].to_write = NULL;
 			}
-			if (FD_ISSET(i, &readfds)) {
+			if ((pfd[i].events & POLLIN) && (pfd[i].revents &
+					(POLLIN | POLLERR | POLLHUP))) {
 				struct dgsh_negotiation *rb;
 				ro = false;
 				int next = next_fd(i, &ro);
@@ -436,6 +453,7 @@ pass_message_blocks(void)
 		    (nfds == nfd || (noinput && nfds == nfd - 1))) {
 			assert(chosen_mb != NULL);
 			DPRINTF(4, "%s(): conc leaves negotiation", __func__);
+			free(pfd);
 			return chosen_mb->state;
 		} else if (chosen_mb != NULL &&	iswrite) { // Free if we have written
 			DPRINTF(4, "chosen_mb: %lx, i: %d, next: %d, pi[next].to_write: %lx\n",
@@ -605,6 +623,7 @@ main(int argc, char *argv[])
 		fflush(stderr);
 
 	}
+	print_negotiation_statistics();
 #endif
 	set_negotiation_complete();
 	alarm(0);			// Cancel alarm
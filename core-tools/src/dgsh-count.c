@@ -0,0 +1,824 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Count the occurrences of each distinct input line through a hash
+ * table, and output the lines ranked by their number of occurrences
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dgsh.h"
+#include "dgsh-debug.h"
+#include "merge.h"
+
+/* Maximum size of the blocks from which key storage is allocated */
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+
+/* Number of runs that are merged into one to limit the open files */
+#define MAX_RUNS 64
+
+/* Initial number of hash table slots; always a power of two */
+#define INITIAL_TABLE_SIZE 1024
+
+/* A distinct key and its number of occurrences */
+struct entry {
+	uint64_t hash;
+	uintmax_t count;
+	const char *key;	/* NULL for an empty slot */
+	size_t len;
+};
+
+/* Order in which the counted keys are output */
+enum order {
+	ORDER_NONE,		/* Hash table order */
+	ORDER_KEY,		/* Increasing key */
+	ORDER_RANK,		/* Decreasing count */
+};
+
+/* A block of key storage */
+struct arena_block {
+	struct arena_block *next;
+	char data[];
+};
+
+/* Open addressing hash table with linear probing */
+static struct entry *table;
+static size_t table_size, nentries;
+
+/* Key storage */
+static struct arena_block *arena;
+static char *arena_free;
+static size_t arena_left;
+static size_t arena_block_size = ARENA_BLOCK_SIZE;
+
+/* Memory occupied by the table and its keys */
+static size_t mem_used;
+
+/* When exceeded, the table is written out as a sorted run */
+static unsigned long max_mem = 256 * 1024 * 1024;
+static char *opt_tmp_dir = NULL;
+
+/* Sorted runs of counted keys written to temporary files */
+static int *runs;
+static int nruns;
+
+/* Runs of the merged counts, ordered by rank */
+static int *rank_runs;
+static int nrank_runs;
+
+/* Output only the top ranked keys */
+static unsigned long top_k;
+
+/* Processes counting subsets of the inputs */
+static pid_t *children;
+static int nchildren;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-cs] [-j jobs] [-k n] [-m size] "
+			"[-T directory] [file ...]\n"
+			"-c\t\tInput records are counts followed by keys\n"
+			"-j jobs\t\tCount the inputs through up to jobs processes\n"
+			"-k n\t\tOutput only the n most frequent keys\n"
+			"-m size\t\tWrite counts to temporary files above size memory\n"
+			"-s\t\tOutput the keys in sorted order, rather than ranked\n"
+			"-T directory\tCreate temporary files in directory\n", name);
+	exit(1);
+}
+
+/* Parse the specified option as a size with a suffix and return its value. */
+static unsigned long
+parse_size(const char *progname, const char *opt)
+{
+	char size;
+	unsigned long n;
+
+	size = 'b';
+	if (sscanf(opt, "%lu%c", &n, &size) < 1)
+		usage(progname);
+	switch (size) {
+	case 'B' : case 'b':
+		return n;
+	case 'K' : case 'k':
+		return n * 1024;
+	case 'M' : case 'm':
+		return n * 1024 * 1024;
+	case 'G' : case 'g':
+		return n * 1024 * 1024 * 1024;
+	default:
+		fprintf(stderr, "Unknown size suffix: %c\n", size);
+		usage(progname);
+	}
+	/* NOTREACHED */
+	return 0;
+}
+
+static inline bool
+is_space(int c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+/* Parse the current record's count and key */
+static void
+parse_count_key(struct merge_input *in)
+{
+	const char *p = in->line;
+	const char *eol = in->line + in->linelen;
+
+	while (p < eol && is_space(*p))
+		p++;
+	if (p == eol || *p < '0' || *p > '9')
+		errx(1, "%s(%lu): Record does not start with a number",
+				in->name, in->lineno);
+	in->value = 0;
+	while (p < eol && *p >= '0' && *p <= '9')
+		in->value = in->value * 10 + (*p++ - '0');
+	if (p < eol && !is_space(*p))
+		errx(1, "%s(%lu): Missing separator after the number",
+				in->name, in->lineno);
+	if (p < eol)
+		p++;
+	in->key = p;
+	in->keylen = eol - p;
+}
+
+/* Return a 64-bit hash of the specified bytes */
+static uint64_t
+hash(const char *p, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--)
+		h = (h ^ (unsigned char)*p++) * 0x100000001b3ULL;
+	return h ^ (h >> 32);
+}
+
+/* Return a copy of the specified key allocated from the arena */
+static const char *
+arena_copy(const char *key, size_t len)
+{
+	struct arena_block *b;
+	size_t size;
+	char *p;
+
+	if (len > arena_left) {
+		size = len > arena_block_size ? len : arena_block_size;
+		if ((b = malloc(sizeof(*b) + size)) == NULL)
+			err(1, NULL);
+		b->next = arena;
+		arena = b;
+		arena_free = b->data;
+		arena_left = size;
+		mem_used += sizeof(*b) + size;
+	}
+	p = arena_free;
+	memcpy(p, key, len);
+	arena_free += len;
+	arena_left -= len;
+	return p;
+}
+
+/* Double the size of the hash table */
+static void
+table_grow(void)
+{
+	struct entry *old = table, *e;
+	size_t old_size = table_size, i;
+
+	table_size = old_size ? old_size * 2 : INITIAL_TABLE_SIZE;
+	if ((table = calloc(table_size, sizeof(*table))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < old_size; i++) {
+		if (old[i].key == NULL)
+			continue;
+		for (e = &table[old[i].hash & (table_size - 1)]; e->key;
+				e = e == table + table_size - 1 ? table : e + 1)
+			;
+		*e = old[i];
+	}
+	free(old);
+	mem_used += (table_size - old_size) * sizeof(*table);
+}
+
+/* Remove all keys from the hash table, releasing their storage */
+static void
+table_clear(void)
+{
+	struct arena_block *b;
+
+	while ((b = arena) != NULL) {
+		arena = b->next;
+		free(b);
+	}
+	arena_free = NULL;
+	arena_left = 0;
+	/* Start again from a small table, so as not to exceed the limit */
+	free(table);
+	table = NULL;
+	table_size = nentries = 0;
+	mem_used = 0;
+	table_grow();
+}
+
+/* Add count occurrences of the specified key to the hash table */
+static void
+table_add(const char *key, size_t len, uintmax_t count)
+{
+	uint64_t h = hash(key, len);
+	struct entry *e;
+
+	/* Keep the load factor below 3/4 */
+	if (4 * (nentries + 1) > 3 * table_size)
+		table_grow();
+	for (e = &table[h & (table_size - 1)]; e->key;
+			e = e == table + table_size - 1 ? table : e + 1)
+		if (e->hash == h && e->len == len &&
+				memcmp(e->key, key, len) == 0) {
+			e->count += count;
+			return;
+		}
+	/* The empty key also needs a non-NULL address */
+	e->key = len ? arena_copy(key, len) : "";
+	e->len = len;
+	e->hash = h;
+	e->count = count;
+	nentries++;
+}
+
+/* Return <0, 0, >0 comparing the keys of the two entries */
+static int
+key_cmp(const void *a, const void *b)
+{
+	const struct entry *ea = a, *eb = b;
+
+	return merge_keycmp(ea->key, ea->len, eb->key, eb->len);
+}
+
+/*
+ * Return <0, 0, >0 if a is ranked before, equal, or after b.
+ * Entries with equal counts are ordered by decreasing key,
+ * as sort -rn orders the output of uniq -c.
+ */
+static int
+rank_cmp(const void *a, const void *b)
+{
+	const struct entry *ea = a, *eb = b;
+
+	if (ea->count != eb->count)
+		return ea->count > eb->count ? -1 : 1;
+	return -key_cmp(a, b);
+}
+
+/* Move the table's entries to its beginning and sort them */
+static size_t
+table_compact(int (*cmp)(const void *, const void *))
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < table_size; i++)
+		if (table[i].key)
+			table[n++] = table[i];
+	if (cmp)
+		qsort(table, n, sizeof(*table), cmp);
+	return n;
+}
+
+/* Output the specified count and key */
+static void
+output_record(FILE *f, uintmax_t count, const char *key, size_t len,
+		bool pad)
+{
+	fprintf(f, pad ? "%7ju " : "%ju ", count);
+	fwrite(key, 1, len, f);
+	putc('\n', f);
+}
+
+/* Create a temporary file for a run, returning its descriptor in *fd */
+static FILE *
+run_create(int *fd)
+{
+	FILE *f;
+
+	*fd = merge_temp_file(opt_tmp_dir);
+	if ((f = fdopen(dup(*fd), "w")) == NULL)
+		err(1, "fdopen");
+	setvbuf(f, NULL, _IOFBF, 256 * 1024);
+	return f;
+}
+
+/* Complete the writing of the specified run and rewind it for reading */
+static void
+run_close(int fd, FILE *f)
+{
+	if (fclose(f) != 0)
+		err(1, "Write to temporary file failed");
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		err(1, "lseek");
+}
+
+static void merge_runs(void);
+
+/* Complete the writing of the specified run and add it to the runs */
+static void
+run_add(int fd, FILE *f)
+{
+	run_close(fd, f);
+	if ((runs = realloc(runs, (nruns + 1) * sizeof(*runs))) == NULL)
+		err(1, NULL);
+	runs[nruns++] = fd;
+	if (nruns == MAX_RUNS)
+		merge_runs();
+}
+
+/* Write the hash table's contents as a sorted run and clear it */
+static void
+spill(void)
+{
+	size_t i, n;
+	FILE *f;
+	int fd;
+
+	n = table_compact(key_cmp);
+	DPRINTF(2, "Writing run %d of %zu keys", nruns, n);
+	f = run_create(&fd);
+	for (i = 0; i < n; i++)
+		output_record(f, table[i].count, table[i].key, table[i].len,
+				false);
+	run_add(fd, f);
+	table_clear();
+}
+
+/* Count the records of the specified inputs */
+static void
+count_inputs(struct merge_input *inputs, int ninputs, bool counted)
+{
+	struct merge_input *in;
+
+	for (in = inputs; in < inputs + ninputs; in++) {
+		while (merge_read_record(in, counted ? parse_count_key : NULL)) {
+			table_add(in->key, in->keylen, counted ? in->value : 1);
+			/* Spilling a nearly empty table would not save memory */
+			if (max_mem && mem_used > max_mem &&
+					nentries > INITIAL_TABLE_SIZE / 2)
+				spill();
+		}
+		close(in->fd);
+		free(in->buf);
+	}
+}
+
+/* Restore the bounded heap property starting from i */
+static void
+sift_down(struct entry *heap, size_t n, size_t i)
+{
+	struct entry t = heap[i];
+	size_t child;
+
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n && rank_cmp(&heap[child + 1], &heap[child]) > 0)
+			child++;
+		if (rank_cmp(&heap[child], &t) <= 0)
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = t;
+}
+
+/*
+ * A heap of the top_k best ranked entries seen so far, with the
+ * worst ranked one at its root.
+ */
+static struct entry *top;
+static size_t ntop;
+
+/*
+ * Offer the specified entry for inclusion among the top ranked ones.
+ * Return the entry that is no longer needed, if any: either the
+ * offered one or the one it displaced.
+ */
+static const struct entry *
+top_offer(const struct entry *e)
+{
+	static struct entry displaced;
+	size_t i;
+
+	if (ntop < top_k) {
+		top[ntop++] = *e;
+		if (ntop == top_k)
+			for (i = ntop / 2; i-- > 0; )
+				sift_down(top, ntop, i);
+		return NULL;
+	}
+	if (rank_cmp(e, &top[0]) >= 0)
+		return e;
+	displaced = top[0];
+	top[0] = *e;
+	sift_down(top, ntop, 0);
+	return &displaced;
+}
+
+/* Output the top ranked entries */
+static void
+top_output(void)
+{
+	size_t i;
+
+	qsort(top, ntop, sizeof(*top), rank_cmp);
+	for (i = 0; i < ntop; i++)
+		output_record(stdout, top[i].count, top[i].key, top[i].len,
+				true);
+}
+
+/* Output the counts held in the hash table in the specified order */
+static void
+output_table(enum order order, bool pad)
+{
+	size_t i, n;
+
+	if (order == ORDER_RANK && top_k) {
+		if ((top = malloc(top_k * sizeof(*top))) == NULL)
+			err(1, NULL);
+		for (i = 0; i < table_size; i++)
+			if (table[i].key)
+				top_offer(&table[i]);
+		top_output();
+		return;
+	}
+	n = table_compact(order == ORDER_KEY ? key_cmp :
+			order == ORDER_RANK ? rank_cmp : NULL);
+	for (i = 0; i < n; i++)
+		output_record(stdout, table[i].count, table[i].key,
+				table[i].len, pad);
+}
+
+/* Return <0, 0, >0 if the record of a is ranked before, equal, or after b's */
+static int
+input_rank_cmp(const struct merge_input *a, const struct merge_input *b)
+{
+	if (a->value != b->value)
+		return a->value > b->value ? -1 : 1;
+	return -merge_keycmp(a->key, a->keylen, b->key, b->keylen);
+}
+
+/* Merge the runs of ranked counts and output them in rank order */
+static void
+output_rank_runs(FILE *out, bool pad)
+{
+	struct merge_input *inputs, *in;
+	struct merge_heap h;
+	bool more;
+	int i;
+	char name[32];
+
+	if ((inputs = malloc(nrank_runs * sizeof(*inputs))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < nrank_runs; i++) {
+		snprintf(name, sizeof(name), "ranked run %d", i);
+		merge_input_init(&inputs[i], rank_runs[i], strdup(name));
+	}
+	merge_heap_init_cmp(&h, inputs, nrank_runs, parse_count_key,
+			input_rank_cmp);
+	more = h.n > 0;
+	while (more) {
+		in = h.heap[0];
+		output_record(out, in->value, in->key, in->keylen, pad);
+		more = merge_heap_advance(&h);
+	}
+	merge_heap_free(&h);
+	for (i = 0; i < nrank_runs; i++) {
+		close(inputs[i].fd);
+		free(inputs[i].buf);
+	}
+	free(inputs);
+	nrank_runs = 0;
+}
+
+/*
+ * Sort the n specified entries by rank and write them as a run,
+ * releasing their keys.
+ */
+static void
+rank_spill(struct entry *ranked, size_t n)
+{
+	size_t i;
+	FILE *f;
+	int fd;
+
+	DPRINTF(2, "Writing ranked run %d of %zu keys", nrank_runs, n);
+	qsort(ranked, n, sizeof(*ranked), rank_cmp);
+	f = run_create(&fd);
+	for (i = 0; i < n; i++) {
+		output_record(f, ranked[i].count, ranked[i].key,
+				ranked[i].len, false);
+		free((char *)ranked[i].key);
+	}
+	run_close(fd, f);
+	if ((rank_runs = realloc(rank_runs, (nrank_runs + 1) *
+					sizeof(*rank_runs))) == NULL)
+		err(1, NULL);
+	rank_runs[nrank_runs++] = fd;
+
+	/* Limit the open files by merging the runs into one */
+	if (nrank_runs == MAX_RUNS) {
+		DPRINTF(2, "Merging %d ranked runs", nrank_runs);
+		f = run_create(&fd);
+		output_rank_runs(f, false);
+		run_close(fd, f);
+		rank_runs[nrank_runs++] = fd;
+	}
+}
+
+/*
+ * Merge the sorted runs, summing the counts of equal keys,
+ * and output the result in the specified order.
+ * Ranking the merged counts uses memory up to the specified limit,
+ * above which the ranked counts are written to runs and merged.
+ */
+static void
+output_runs(FILE *out, enum order order, bool pad)
+{
+	struct merge_input *inputs, *in;
+	struct merge_heap h;
+	struct entry e, *ranked = NULL;
+	const struct entry *unneeded;
+	size_t nranked = 0, ranked_size = 0, key_mem = 0, j;
+	bool more;
+	int i;
+	char name[32];
+
+	if ((inputs = malloc(nruns * sizeof(*inputs))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < nruns; i++) {
+		snprintf(name, sizeof(name), "run %d", i);
+		merge_input_init(&inputs[i], runs[i], strdup(name));
+	}
+	if (order == ORDER_RANK && top_k &&
+			(top = malloc(top_k * sizeof(*top))) == NULL)
+		err(1, NULL);
+
+	merge_heap_init(&h, inputs, nruns, parse_count_key);
+	more = h.n > 0;
+	while (more) {
+		e.count = h.heap[0]->value;
+		more = merge_heap_advance(&h);
+		while (more && (in = h.heap[0]) &&
+				merge_keycmp(in->key, in->keylen,
+					h.prev, h.prevlen) == 0) {
+			e.count += in->value;
+			more = merge_heap_advance(&h);
+		}
+		if (order != ORDER_RANK) {
+			/* Runs are merged in key order */
+			output_record(out, e.count, h.prev, h.prevlen, pad);
+			continue;
+		}
+		e.len = h.prevlen;
+		if ((e.key = malloc(e.len + 1)) == NULL)
+			err(1, NULL);
+		memcpy((char *)e.key, h.prev, e.len);
+		if (top_k) {
+			if ((unneeded = top_offer(&e)) != NULL)
+				free((char *)unneeded->key);
+			continue;
+		}
+		/* Keep the keys, without the hash table's overhead */
+		if (nranked == ranked_size) {
+			ranked_size = ranked_size ? ranked_size * 2 : 1024;
+			if ((ranked = realloc(ranked, ranked_size *
+							sizeof(*ranked))) == NULL)
+				err(1, NULL);
+		}
+		ranked[nranked++] = e;
+		key_mem += e.len + 1;
+		if (max_mem && nranked * sizeof(*ranked) + key_mem >
+				max_mem && nranked > 1) {
+			rank_spill(ranked, nranked);
+			nranked = key_mem = 0;
+		}
+	}
+	merge_heap_free(&h);
+	for (i = 0; i < nruns; i++) {
+		close(inputs[i].fd);
+		free(inputs[i].buf);
+	}
+	free(inputs);
+	nruns = 0;
+	if (order != ORDER_RANK)
+		return;
+	if (top_k) {
+		top_output();
+		return;
+	}
+	if (nrank_runs) {
+		if (nranked)
+			rank_spill(ranked, nranked);
+		free(ranked);
+		output_rank_runs(out, pad);
+		return;
+	}
+	qsort(ranked, nranked, sizeof(*ranked), rank_cmp);
+	for (j = 0; j < nranked; j++)
+		output_record(out, ranked[j].count, ranked[j].key,
+				ranked[j].len, pad);
+}
+
+/* Merge the sorted runs into a single one */
+static void
+merge_runs(void)
+{
+	FILE *f;
+	int fd;
+
+	DPRINTF(2, "Merging %d runs", nruns);
+	f = run_create(&fd);
+	output_runs(f, ORDER_KEY, false);
+	run_add(fd, f);
+}
+
+/*
+ * Distribute the counting of the inputs among jobs child processes.
+ * Each child counts a subset of the inputs and writes its counts
+ * to a pipe; the inputs are replaced by the pipes' read ends.
+ */
+static void
+count_parallel(struct merge_input **inputs, int *ninputs, int jobs)
+{
+	struct merge_input *in = *inputs, *partial;
+	int n = *ninputs;
+	int g, i, lo, hi;
+	char name[64];
+
+	if ((partial = malloc(jobs * sizeof(*partial))) == NULL)
+		err(1, NULL);
+	if ((children = malloc(jobs * sizeof(*children))) == NULL)
+		err(1, NULL);
+	fflush(stdout);
+
+	for (g = 0; g < jobs; g++) {
+		int p[2];
+		pid_t pid;
+
+		lo = g * n / jobs;
+		hi = (g + 1) * n / jobs;
+		if (pipe(p) == -1)
+			err(1, "pipe");
+		switch (pid = fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			/* Keep only this child's inputs open */
+			close(p[0]);
+			for (i = 0; i < g; i++)
+				close(partial[i].fd);
+			for (i = 0; i < n; i++)
+				if ((i < lo || i >= hi) && in[i].fd != -1)
+					close(in[i].fd);
+			if (dup2(p[1], STDOUT_FILENO) == -1)
+				err(1, "dup2");
+			close(p[1]);
+
+			count_inputs(in + lo, hi - lo, false);
+			if (nruns) {
+				spill();
+				output_runs(stdout, ORDER_KEY, false);
+			} else
+				output_table(ORDER_NONE, false);
+			if (fflush(stdout) != 0)
+				err(3, "Error writing to stdout");
+			exit(0);
+		default:
+			DPRINTF(2, "Process %d counts inputs %d-%d",
+					(int)pid, lo, hi - 1);
+			children[nchildren++] = pid;
+			close(p[1]);
+			for (i = lo; i < hi; i++) {
+				close(in[i].fd);
+				in[i].fd = -1;
+				free(in[i].buf);
+			}
+			snprintf(name, sizeof(name), "counts of inputs %d-%d",
+					lo, hi - 1);
+			merge_input_init(&partial[g], p[0], strdup(name));
+		}
+	}
+	free(in);
+	*inputs = partial;
+	*ninputs = jobs;
+}
+
+/*
+ * Wait for the counting child processes to terminate.
+ * Return 0 if all terminated successfully, 1 otherwise.
+ */
+static int
+wait_children(void)
+{
+	int i, status, ret = 0;
+
+	for (i = 0; i < nchildren; i++) {
+		while (waitpid(children[i], &status, 0) == -1)
+			if (errno != EINTR)
+				err(1, "waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			ret = 1;
+	}
+	return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct merge_input *inputs;
+	int ninputs, jobs = 0;
+	bool counted = false, sorted = false;
+	int ch;
+	long ncpu;
+
+	while ((ch = getopt(argc, argv, "cj:k:m:sT:")) != -1) {
+		switch (ch) {
+		case 'c':
+			counted = true;
+			break;
+		case 'j':
+			if ((jobs = atoi(optarg)) < 1)
+				usage(argv[0]);
+			break;
+		case 'k':
+			if ((top_k = strtoul(optarg, NULL, 10)) == 0)
+				usage(argv[0]);
+			break;
+		case 'm':
+			max_mem = parse_size(argv[0], optarg);
+			break;
+		case 's':
+			sorted = true;
+			break;
+		case 'T':
+			opt_tmp_dir = optarg;
+			break;
+		case '?':
+		default:
+			usage(argv[0]);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (sorted && top_k)
+		errx(1, "Sorted output (-s) cannot be combined with -k");
+
+	/* Allow the table to use a reasonable part of a small memory limit */
+	if (max_mem && max_mem / 16 < arena_block_size)
+		arena_block_size = max_mem / 16 + 1;
+
+	inputs = merge_open_inputs("dgsh-count", argc, argv, &ninputs);
+	table_grow();
+
+	/* By default count each input in parallel, up to the number of CPUs */
+	if (jobs == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = ncpu > 0 && ncpu < ninputs ? (int)ncpu : ninputs;
+	}
+	if (jobs > ninputs)
+		jobs = ninputs;
+	if (jobs > 1 && !counted) {
+		count_parallel(&inputs, &ninputs, jobs);
+		counted = true;
+	}
+
+	setvbuf(stdout, NULL, _IOFBF, 256 * 1024);
+	count_inputs(inputs, ninputs, counted);
+	if (nruns) {
+		spill();
+		output_runs(stdout, sorted ? ORDER_KEY : ORDER_RANK, true);
+	} else
+		output_table(sorted ? ORDER_KEY : ORDER_RANK, true);
+	if (fflush(stdout) != 0)
+		err(3, "Error writing to stdout");
+	return wait_children();
+}
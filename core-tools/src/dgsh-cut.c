@@ -0,0 +1,456 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Split each input record into fields once, and write the selected
+ * fields to a separate output channel for each field list
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dgsh.h"
+#include "dgsh-debug.h"
+
+#define INPUT_BUFFER_SIZE (256 * 1024)
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+/* Field number denoting the record's last field (awk's NF) */
+#define LAST_FIELD (-1)
+
+/*
+ * An element of a field list: fields from through to.
+ * A from value of 0 denotes the whole record; a to value of
+ * LAST_FIELD extends the range to the end of the record.
+ */
+struct range {
+	int from, to;
+};
+
+/* A field list and the output to which its fields are written */
+struct projection {
+	const char *spec;
+	struct range *ranges;
+	int nranges;
+	int fd;
+	const char *name;
+	char *buf;
+	size_t len;
+	bool closed;		/* True if its reader has exited */
+};
+
+/* A field's location within a record */
+struct field {
+	const char *s;
+	size_t len;
+};
+
+static struct projection *projs;
+static int nprojs;
+static int open_outputs;
+
+/* Field separator character; 0 for runs of blanks */
+static char separator;
+
+/* Output field separator */
+static char oseparator = ' ';
+
+/* Number of leading fields that must be located in each record */
+static int max_field;
+
+/* True if the record's last field must be located */
+static bool need_last;
+
+static struct field *fields;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-d char] [-o file] ... "
+			"-f list ... [file ...]\n"
+			"-d char\tUse char as the field separator\n"
+			"-f list\tWrite the listed fields to the next output\n"
+			"\tThe list elements are separated by commas and can be\n"
+			"\tn, n-m, n-, NF (the last field), or 0 (the whole record)\n"
+			"-o file\tWrite the next output to file\n", name);
+	exit(1);
+}
+
+/* Parse a field number or NF, advancing *s past it */
+static int
+parse_field(const char **s, const char *spec)
+{
+	char *end;
+	long n;
+
+	if (strncmp(*s, "NF", 2) == 0) {
+		*s += 2;
+		return LAST_FIELD;
+	}
+	n = strtol(*s, &end, 10);
+	if (end == *s || n < 0 || n > INT_MAX)
+		errx(1, "Invalid field list %s", spec);
+	*s = end;
+	return (int)n;
+}
+
+/* Add a projection for the specified field list */
+static void
+add_projection(const char *spec)
+{
+	struct projection *pr;
+	struct range *r;
+	const char *s = spec;
+
+	if ((projs = realloc(projs, (nprojs + 1) * sizeof(*projs))) == NULL)
+		err(1, NULL);
+	pr = &projs[nprojs++];
+	memset(pr, 0, sizeof(*pr));
+	pr->spec = spec;
+
+	for (;;) {
+		if ((pr->ranges = realloc(pr->ranges, (pr->nranges + 1) *
+						sizeof(*pr->ranges))) == NULL)
+			err(1, NULL);
+		r = &pr->ranges[pr->nranges++];
+		r->from = r->to = parse_field(&s, spec);
+		if (*s == '-') {
+			if (r->from == LAST_FIELD)
+				errx(1, "Invalid field list %s", spec);
+			s++;
+			if (*s == ',' || *s == '\0')
+				r->to = LAST_FIELD;
+			else if ((r->to = parse_field(&s, spec)) == LAST_FIELD)
+				errx(1, "Invalid field list %s", spec);
+		}
+		if (r->from == 0 && r->to != 0)
+			errx(1, "Field 0 cannot be part of a range in %s", spec);
+		if (r->to != LAST_FIELD && r->to < r->from)
+			errx(1, "Decreasing field range in %s", spec);
+
+		if (r->from != LAST_FIELD && r->from > max_field)
+			max_field = r->from;
+		if (r->to != LAST_FIELD && r->to > max_field)
+			max_field = r->to;
+		if (r->to == LAST_FIELD)
+			need_last = true;
+
+		if (*s == '\0')
+			break;
+		if (*s++ != ',')
+			errx(1, "Invalid field list %s", spec);
+	}
+}
+
+static inline bool
+is_blank(int c)
+{
+	return c == ' ' || c == '\t';
+}
+
+/*
+ * Locate up to n fields of the specified line, storing them in f.
+ * Return the number of fields located.
+ */
+static int
+split_fields(const char *line, size_t len, int n, struct field *f)
+{
+	const char *p = line, *end = line + len, *q;
+	int i;
+
+	if (len == 0)
+		return 0;
+	for (i = 0; i < n; i++) {
+		if (separator) {
+			if (p > end)
+				break;
+			/* memchr(3) typically examines many bytes at a time */
+			if ((q = memchr(p, separator, end - p)) == NULL)
+				q = end;
+			f[i].s = p;
+			f[i].len = q - p;
+			p = q + 1;
+		} else {
+			while (p < end && is_blank(*p))
+				p++;
+			if (p == end)
+				break;
+			for (q = p; q < end && !is_blank(*q); q++)
+				;
+			f[i].s = p;
+			f[i].len = q - p;
+			p = q;
+		}
+	}
+	return i;
+}
+
+/*
+ * Locate the last field of the specified line by scanning it backwards,
+ * so that the fields before it need not be split.
+ * Return false if the line has no fields.
+ */
+static bool
+last_field(const char *line, size_t len, struct field *f)
+{
+	const char *end = line + len, *p;
+
+	if (len == 0)
+		return false;
+	if (separator) {
+		for (p = end; p > line && p[-1] != separator; p--)
+			;
+		f->s = p;
+		f->len = end - p;
+		return true;
+	}
+	while (end > line && is_blank(end[-1]))
+		end--;
+	if (end == line)
+		return false;
+	for (p = end; p > line && !is_blank(p[-1]); p--)
+		;
+	f->s = p;
+	f->len = end - p;
+	return true;
+}
+
+/* Write the specified data directly to the projection's file descriptor */
+static void
+output_write_fd(struct projection *pr, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0 && !pr->closed) {
+		if ((n = write(pr->fd, data, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EPIPE)
+				err(2, "Error writing to %s", pr->name);
+			/* The reader terminated early; stop serving it. */
+			pr->closed = true;
+			if (--open_outputs == 0)
+				exit(0);
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+/* Write out the data pending for the projection */
+static void
+output_flush(struct projection *pr)
+{
+	output_write_fd(pr, pr->buf, pr->len);
+	pr->len = 0;
+}
+
+/* Buffer the specified data for writing to the projection's output */
+static void
+output_write(struct projection *pr, const char *data, size_t len)
+{
+	if (pr->len + len > OUTPUT_BUFFER_SIZE)
+		output_flush(pr);
+	if (len > OUTPUT_BUFFER_SIZE)
+		output_write_fd(pr, data, len);
+	else {
+		memcpy(pr->buf + pr->len, data, len);
+		pr->len += len;
+	}
+}
+
+/* Write the fields of the specified line to each projection's output */
+static void
+project_line(const char *line, size_t len)
+{
+	struct projection *pr;
+	struct range *r;
+	struct field last = {NULL, 0};
+	bool have_last = false;
+	int nf, j, f;
+
+	nf = split_fields(line, len, max_field, fields);
+	if (need_last)
+		have_last = last_field(line, len, &last);
+
+	for (pr = projs; pr < projs + nprojs; pr++) {
+		if (pr->closed)
+			continue;
+		for (r = pr->ranges; r < pr->ranges + pr->nranges; r++) {
+			if (r > pr->ranges)
+				output_write(pr, &oseparator, 1);
+			if (r->from == 0)
+				output_write(pr, line, len);
+			else if (r->from == LAST_FIELD) {
+				if (have_last)
+					output_write(pr, last.s, last.len);
+			} else if (r->to == LAST_FIELD) {
+				/* Output the rest of the record verbatim */
+				if (r->from <= nf && have_last) {
+					f = r->from - 1;
+					output_write(pr, fields[f].s,
+						last.s + last.len - fields[f].s);
+				}
+			} else {
+				for (j = r->from; j <= r->to && j <= nf; j++) {
+					if (j > r->from)
+						output_write(pr, &oseparator, 1);
+					output_write(pr, fields[j - 1].s,
+							fields[j - 1].len);
+				}
+			}
+		}
+		output_write(pr, "\n", 1);
+	}
+}
+
+/* Project the lines read from the specified file descriptor */
+static void
+project_fd(int fd, const char *name)
+{
+	static char *buf;
+	static size_t size;
+	size_t begin = 0, end = 0;
+	char *nl;
+	ssize_t n;
+
+	if (buf == NULL) {
+		size = INPUT_BUFFER_SIZE;
+		if ((buf = malloc(size)) == NULL)
+			err(1, NULL);
+	}
+	for (;;) {
+		/* Make space for reading more data */
+		if (begin > 0) {
+			memmove(buf, buf + begin, end - begin);
+			end -= begin;
+			begin = 0;
+		}
+		if (end == size) {
+			size *= 2;
+			if ((buf = realloc(buf, size)) == NULL)
+				err(1, NULL);
+		}
+		n = read(fd, buf + end, size - end);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			err(2, "Error reading from %s", name);
+		}
+		if (n == 0)
+			break;
+		end += n;
+		while ((nl = memchr(buf + begin, '\n', end - begin)) != NULL) {
+			project_line(buf + begin, nl - (buf + begin));
+			begin = nl - buf + 1;
+		}
+	}
+	/* Handle a final line lacking a newline */
+	if (begin < end)
+		project_line(buf + begin, end - begin);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n_input_fds, n_output_fds;
+	int *output_fds = NULL;
+	const char **ofiles = NULL;
+	int nofiles = 0;
+	int ch, i, fd;
+	const char *progname = argv[0];
+
+	while ((ch = getopt(argc, argv, "d:f:o:")) != -1) {
+		switch (ch) {
+		case 'd':
+			if (strlen(optarg) != 1)
+				usage(progname);
+			separator = oseparator = *optarg;
+			break;
+		case 'f':
+			add_projection(optarg);
+			break;
+		case 'o':
+			if ((ofiles = realloc(ofiles, (nofiles + 1) *
+							sizeof(*ofiles))) == NULL)
+				err(1, NULL);
+			ofiles[nofiles++] = optarg;
+			break;
+		case '?':
+		default:
+			usage(progname);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (nprojs == 0)
+		usage(progname);
+	if (nofiles && nofiles != nprojs)
+		errx(1, "The number of output files %d is not equal to the number of field lists %d",
+				nofiles, nprojs);
+	if ((fields = malloc((max_field + 1) * sizeof(*fields))) == NULL)
+		err(1, NULL);
+
+	/* Read the standard input, unless files are specified */
+	n_input_fds = argc ? 0 : 1;
+	n_output_fds = nofiles ? 0 : nprojs;
+	dgsh_negotiate(DGSH_HANDLE_ERROR, "dgsh-cut", &n_input_fds,
+			&n_output_fds, NULL, &output_fds);
+
+	for (i = 0; i < nprojs; i++) {
+		if (nofiles) {
+			if ((fd = open(ofiles[i], O_WRONLY | O_CREAT | O_TRUNC,
+							0666)) == -1)
+				err(2, "Error opening %s", ofiles[i]);
+			projs[i].name = ofiles[i];
+		} else {
+			fd = output_fds[i];
+			projs[i].name = i == 0 ? "stdout" : "output channel";
+		}
+		projs[i].fd = fd;
+		if ((projs[i].buf = malloc(OUTPUT_BUFFER_SIZE)) == NULL)
+			err(1, NULL);
+	}
+	open_outputs = nprojs;
+
+	/* We will handle SIGPIPE explicitly when calling write(2). */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (argc == 0)
+		project_fd(STDIN_FILENO, "stdin");
+	for (i = 0; i < argc; i++) {
+		if ((fd = open(argv[i], O_RDONLY)) == -1)
+			err(2, "Error opening %s", argv[i]);
+		project_fd(fd, argv[i]);
+		close(fd);
+	}
+
+	for (i = 0; i < nprojs; i++) {
+		output_flush(&projs[i]);
+		close(projs[i].fd);
+	}
+	return 0;
+}
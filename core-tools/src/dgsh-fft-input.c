@@ -1,68 +1,275 @@
+#include <sys/types.h>
+#include <sys/mman.h>	// mmap()
+#include <sys/stat.h>	// fstat()
 #include <assert.h>	// assert()
-#include <stdio.h>	// printf
-#include <complex.h>	// double complex
-#include <unistd.h>	// read(), write()
-#include <stdlib.h>	// free()
+#include <stdbool.h>	// bool
+#include <stdio.h>	// fprintf()
+#include <fcntl.h>	// open()
+#include <unistd.h>	// read()
+#include <stdlib.h>	// strtod()
+#include <string.h>	// memchr()
+#include <errno.h>	// EINTR
 #include <err.h>	// errx()
 
 #include "dgsh.h"
-#include "debug.h"
+#include "dgsh-debug.h"
 
-int main(int argc, char **argv)
+/*
+ * Distribute the samples of a signal across the output channels of an
+ * FFT graph.
+ * The input is a sequence of vectors, each consisting of as many
+ * samples as the number of output channels.  The samples can be
+ * specified as text, one per line, or as binary doubles.
+ * Sample j of each vector is written to output channel j (or to its
+ * bit-reversed position with -r), as a framed stream of doubles
+ * (see dgsh_frame(3)).
+ * Vectors are processed in blocks, so that the memory used is bounded
+ * irrespective of the input's size.
+ */
+
+#define DEFAULT_BLOCK 4096	// Vectors per block
+#define READ_SIZE (1024 * 1024)	// Bytes to read at a time
+#define LINE_MAX_LEN 100	// Maximum length of a text input line
+
+// The input, either mapped into memory or read through a buffer
+struct source {
+	const char *name;
+	int fd;
+	char *data;		// Input data
+	size_t pos;		// Position of the next unprocessed byte
+	size_t len;		// Bytes in data
+	size_t size;		// Allocated bytes in data, when reading
+	bool mapped;		// True if data is mapped to the input file
+	bool eof;
+	long lineno;
+};
+
+static void
+usage(const char *name)
 {
-	char *input_file;
-	FILE *f;
-	int ninput = 4, nlines = 0, i;
-	int ninputfds = 0, noutputfds;
-	int *inputfds = NULL, *outputfds = NULL;
-	size_t len = sizeof(long double), wsize;
-	char line[len + 1];
-	long double *input = (long double *)malloc(sizeof(long double) * ninput);
+	fprintf(stderr, "Usage: %s [-B] [-b block] [-n outputs] [-r] [file]\n"
+		"-B\t\tRead samples as binary doubles\n"
+		"-b block\tProcess block vectors at a time\n"
+		"-n outputs\tNumber of output channels (samples per vector)\n"
+		"-r\t\tDistribute samples in bit-reversed order\n", name);
+	exit(1);
+}
+
+// Open the specified file, mapping it into memory if possible
+static void
+source_open(struct source *s, const char *name)
+{
+	struct stat sb;
+
+	s->name = name ? name : "stdin";
+	s->pos = s->len = s->size = 0;
+	s->data = NULL;
+	s->mapped = s->eof = false;
+	s->lineno = 0;
+	if (name == NULL)
+		s->fd = STDIN_FILENO;
+	else if ((s->fd = open(name, O_RDONLY)) == -1)
+		err(2, "Error opening %s", name);
+
+	if (fstat(s->fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0 &&
+	    (s->data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE,
+			    s->fd, 0)) != MAP_FAILED) {
+		(void)madvise(s->data, sb.st_size, MADV_SEQUENTIAL);
+		s->len = sb.st_size;
+		s->mapped = s->eof = true;
+		DPRINTF(2, "Mapped %zu bytes of %s", s->len, s->name);
+		return;
+	}
+	s->data = NULL;
+}
+
+/*
+ * Read more data, keeping the unprocessed part.
+ * Return false at end of file.
+ */
+static bool
+source_fill(struct source *s)
+{
+	ssize_t n;
 
-	if (argc == 1) {
-		noutputfds = 8;
-		goto negotiate;
+	if (s->eof)
+		return false;
+	if (s->pos > 0) {
+		memmove(s->data, s->data + s->pos, s->len - s->pos);
+		s->len -= s->pos;
+		s->pos = 0;
+	}
+	if (s->size - s->len < READ_SIZE) {
+		s->size = s->len + READ_SIZE;
+		if ((s->data = realloc(s->data, s->size)) == NULL)
+			err(1, NULL);
+	}
+	do
+		n = read(s->fd, s->data + s->len, s->size - s->len);
+	while (n == -1 && errno == EINTR);
+	if (n == -1)
+		err(2, "Error reading from %s", s->name);
+	if (n == 0) {
+		s->eof = true;
+		return false;
 	}
+	s->len += n;
+	return true;
+}
+
+// Read up to n binary samples into v; return the number read
+static size_t
+read_binary(struct source *s, double *v, size_t n)
+{
+	size_t avail, i = 0;
 
-	input_file = argv[1];
-	f = fopen(input_file, "r");
-	if (!f)
-		errx(2, "Open file %s failed", input_file);
-	DPRINTF(4, "Opened input file: %s", input_file);
-
-	while (fgets(line, len, f)) {
-		assert(len == sizeof(input[nlines - 1]));
-		nlines++;
-		if (nlines == ninput) {
-			ninput *= 2;
-			input = (long double *)realloc(input,
-					sizeof(long double) * ninput);
-			if (!input)
-				errx(2, "Realloc for input numbers failed");
+	while (i < n) {
+		avail = (s->len - s->pos) / sizeof(double);
+		if (avail == 0) {
+			if (source_fill(s))
+				continue;
+			if (s->pos != s->len)
+				warnx("%s: Ignoring %zu trailing bytes",
+						s->name, s->len - s->pos);
+			s->pos = s->len;
+			break;
 		}
-		input[nlines - 1] = atof(line);
+		if (avail > n - i)
+			avail = n - i;
+		memcpy(v + i, s->data + s->pos, avail * sizeof(double));
+		s->pos += avail * sizeof(double);
+		i += avail;
+	}
+	return i;
+}
 
-		DPRINTF(4, "Retrieved input %.10Lf\n", input[nlines - 1]);
+// Read up to n text samples into v; return the number read
+static size_t
+read_text(struct source *s, double *v, size_t n)
+{
+	char line[LINE_MAX_LEN], *nl, *end;
+	size_t i, len;
+
+	for (i = 0; i < n; i++) {
+		while ((nl = s->pos == s->len ? NULL : memchr(s->data + s->pos,
+						'\n', s->len - s->pos)) == NULL)
+			if (!source_fill(s))
+				break;
+		if (nl == NULL && s->pos == s->len)
+			break;
+		// A final line may lack a newline
+		len = (nl ? nl : s->data + s->len) - (s->data + s->pos);
+		s->lineno++;
+		if (len >= sizeof(line))
+			errx(2, "%s(%ld): Line too long", s->name, s->lineno);
+		// Mapped data is not NUL-terminated, so parse a copy
+		memcpy(line, s->data + s->pos, len);
+		line[len] = '\0';
+		s->pos += len + (nl != NULL);
+		v[i] = strtod(line, &end);
+		if (end == line)
+			errx(2, "%s(%ld): Invalid number [%s]", s->name,
+					s->lineno, line);
+		DPRINTF(4, "Retrieved input %.10f", v[i]);
+	}
+	return i;
+}
+
+// Return j with its low-order bits bits reversed
+static int
+bit_reverse(int j, int bits)
+{
+	int r = 0;
+
+	while (bits-- > 0) {
+		r = (r << 1) | (j & 1);
+		j >>= 1;
 	}
-	noutputfds = nlines;
+	return r;
+}
 
-negotiate:
+int
+main(int argc, char **argv)
+{
+	struct source src;
+	int ninputfds = 0, noutputfds = -1;
+	int *inputfds = NULL, *outputfds = NULL;
+	int *channel;		// Output channel index of each sample
+	double *samples, *column;
+	size_t block = DEFAULT_BLOCK, nsamples, nvectors, v;
+	bool binary = false, reverse = false;
+	int ch, bits, j;
+
+	while ((ch = getopt(argc, argv, "Bb:n:r")) != -1) {
+		switch (ch) {
+		case 'B':
+			binary = true;
+			break;
+		case 'b':
+			if ((block = atoi(optarg)) == 0)
+				usage(argv[0]);
+			break;
+		case 'n':
+			if ((noutputfds = atoi(optarg)) <= 0)
+				usage(argv[0]);
+			break;
+		case 'r':
+			reverse = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind > 1)
+		usage(argv[0]);
+	source_open(&src, argc - optind == 1 ? argv[optind] : NULL);
 
 	dgsh_negotiate(DGSH_HANDLE_ERROR, "fft-input", &ninputfds, &noutputfds,
 					&inputfds, &outputfds);
-	DPRINTF(4, "Read %d inputs, received %d fds", nlines, noutputfds);
 	assert(ninputfds == 0);
-	assert(noutputfds == nlines);
-
-	for (i = 0; i < noutputfds; i++) {
-		DPRINTF(4, "Write input %.10Lf to fd %d", input[i], outputfds[i]);
-		wsize = write(outputfds[i], &input[i],
-				sizeof(long double));
-		if (wsize == -1)
-			err(1, "write failed");
-	}
+	if (outputfds == NULL)
+		errx(1, "Unable to obtain %d output channels", noutputfds);
+	DPRINTF(2, "Distributing samples to %d channels", noutputfds);
+
+	if ((channel = malloc(noutputfds * sizeof(*channel))) == NULL)
+		err(1, NULL);
+	for (bits = 0; (1 << bits) < noutputfds; bits++)
+		;
+	if (reverse && (1 << bits) != noutputfds)
+		errx(1, "Bit-reversed order requires a power of two outputs");
+	for (j = 0; j < noutputfds; j++)
+		channel[j] = reverse ? bit_reverse(j, bits) : j;
+
+	if ((samples = malloc(block * noutputfds * sizeof(double))) == NULL ||
+	    (column = malloc(block * sizeof(double))) == NULL)
+		err(1, NULL);
+
+	do {
+		nsamples = binary ?
+			read_binary(&src, samples, block * noutputfds) :
+			read_text(&src, samples, block * noutputfds);
+		nvectors = (nsamples + noutputfds - 1) / noutputfds;
+		if (nsamples % noutputfds) {
+			warnx("%s: Padding the last vector with zeros",
+					src.name);
+			memset(samples + nsamples, 0,
+				(nvectors * noutputfds - nsamples) *
+				sizeof(double));
+		}
+		// Write each sample position's values of the block's vectors
+		for (j = 0; j < noutputfds; j++) {
+			for (v = 0; v < nvectors; v++)
+				column[v] = samples[v * noutputfds + j];
+			if (dgsh_frame_write(outputfds[channel[j]],
+					DGSH_FRAME_DOUBLE, column,
+					nvectors) == -1)
+				err(1, "write failed");
+		}
+	} while (nsamples == block * noutputfds);
 
-	fclose(f);
-	free(input);
+	if (src.mapped)
+		munmap(src.data, src.len);
+	else
+		free(src.data);
 	return 0;
 }
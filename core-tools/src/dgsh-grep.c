@@ -0,0 +1,651 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Route each input line to the outputs associated with the patterns
+ * it matches, matching all patterns in a single pass
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dgsh.h"
+#include "dgsh-debug.h"
+
+#define INPUT_BUFFER_SIZE (256 * 1024)
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+/* A pattern and the output to which it routes the lines it selects */
+struct predicate {
+	const char *pattern;
+	bool invert;		/* Select the lines that do not match */
+	bool always;		/* No literal; every line is a candidate */
+	bool use_regex;		/* Confirm candidate lines through re */
+	regex_t re;
+	unsigned long seen;	/* Last line containing the literal */
+};
+
+/* An output channel and its pending data */
+struct output {
+	int fd;
+	const char *name;
+	char *buf;
+	size_t len;
+	uintmax_t count;	/* Number of lines routed to it */
+	bool closed;		/* True if its reader has exited */
+};
+
+/* A literal recognized at an automaton state */
+struct terminal {
+	int pred;		/* Predicate whose literal it is */
+	size_t len;		/* Literal length */
+	int next;		/* Next terminal at the same state, or -1 */
+};
+
+/*
+ * Aho-Corasick automaton recognizing the predicates' literals.
+ * Transitions are stored as a complete table, so that each input
+ * byte costs a single lookup.
+ */
+struct automaton {
+	int *delta;		/* 256 transitions for each state */
+	int *fail;		/* Failure state */
+	int *terminal;		/* First literal ending at the state, or -1 */
+	int *out;		/* Nearest failure state with a literal, or -1 */
+	bool *report;		/* True if some literal ends at the state */
+	int nstates, size;
+	int nstart;		/* Input bytes leading out of the initial state */
+	unsigned char start_byte;	/* The only one, if nstart is 1 */
+	struct terminal *terms;
+	int nterms;
+};
+
+static struct predicate *preds;
+static int npreds;
+
+static struct output *outputs;
+static int open_outputs;
+
+static struct automaton ac;
+
+/* Byte translation applied to the literals and the input */
+static unsigned char fold[256];
+
+static bool opt_count, opt_extended, opt_fixed, opt_icase, opt_word;
+
+/* Number of the line being processed */
+static unsigned long lineno;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-cEFiw] [-o file] ... "
+			"-e pattern | -v pattern ... [file ...]\n"
+			"-c\t\tOutput the number of lines routed to each output\n"
+			"-E\t\tPatterns are extended regular expressions\n"
+			"-e pattern\tRoute lines matching pattern to the next output\n"
+			"-F\t\tPatterns are fixed strings\n"
+			"-i\t\tIgnore case distinctions\n"
+			"-o file\t\tWrite the next output to file\n"
+			"-v pattern\tRoute lines not matching pattern to the next output\n"
+			"-w\t\tMatch fixed strings only as whole words\n", name);
+	exit(1);
+}
+
+static void
+add_predicate(const char *pattern, bool invert)
+{
+	if ((preds = realloc(preds, (npreds + 1) * sizeof(*preds))) == NULL)
+		err(1, NULL);
+	preds[npreds].pattern = pattern;
+	preds[npreds].invert = invert;
+	preds[npreds].seen = 0;
+	npreds++;
+}
+
+/* Add a new state to the automaton and return its number */
+static int
+new_state(void)
+{
+	int i;
+
+	if (ac.nstates == ac.size) {
+		ac.size = ac.size ? ac.size * 2 : 64;
+		ac.delta = realloc(ac.delta, ac.size * 256 * sizeof(*ac.delta));
+		ac.fail = realloc(ac.fail, ac.size * sizeof(*ac.fail));
+		ac.terminal = realloc(ac.terminal, ac.size * sizeof(*ac.terminal));
+		ac.out = realloc(ac.out, ac.size * sizeof(*ac.out));
+		ac.report = realloc(ac.report, ac.size * sizeof(*ac.report));
+		if (!ac.delta || !ac.fail || !ac.terminal || !ac.out || !ac.report)
+			err(1, NULL);
+	}
+	for (i = 0; i < 256; i++)
+		ac.delta[ac.nstates * 256 + i] = -1;
+	ac.fail[ac.nstates] = 0;
+	ac.terminal[ac.nstates] = -1;
+	ac.out[ac.nstates] = -1;
+	ac.report[ac.nstates] = false;
+	return ac.nstates++;
+}
+
+/* Add to the automaton's trie the specified predicate's literal */
+static void
+add_literal(int pred, const char *s, size_t len)
+{
+	int state = 0, next;
+	size_t i, t;
+
+	for (i = 0; i < len; i++) {
+		t = state * 256 + fold[(unsigned char)s[i]];
+		if ((next = ac.delta[t]) == -1) {
+			/* May move ac.delta */
+			next = new_state();
+			ac.delta[t] = next;
+		}
+		state = next;
+	}
+	if ((ac.terms = realloc(ac.terms, (ac.nterms + 1) *
+					sizeof(*ac.terms))) == NULL)
+		err(1, NULL);
+	ac.terms[ac.nterms].pred = pred;
+	ac.terms[ac.nterms].len = len;
+	ac.terms[ac.nterms].next = ac.terminal[state];
+	ac.terminal[state] = ac.nterms++;
+	ac.report[state] = true;
+}
+
+/*
+ * Complete the automaton's transitions and failure links
+ * through a breadth-first traversal of its trie.
+ */
+static void
+build_automaton(void)
+{
+	int *queue, head = 0, tail = 0;
+	int s, c, t, f;
+
+	if ((queue = malloc(ac.nstates * sizeof(*queue))) == NULL)
+		err(1, NULL);
+	for (c = 0; c < 256; c++) {
+		t = ac.delta[c];
+		if (t == -1)
+			ac.delta[c] = 0;
+		else {
+			ac.fail[t] = 0;
+			queue[tail++] = t;
+		}
+	}
+	while (head < tail) {
+		s = queue[head++];
+		f = ac.fail[s];
+		ac.out[s] = ac.terminal[f] != -1 ? f : ac.out[f];
+		if (ac.out[s] != -1)
+			ac.report[s] = true;
+		for (c = 0; c < 256; c++) {
+			t = ac.delta[s * 256 + c];
+			if (t == -1)
+				ac.delta[s * 256 + c] = ac.delta[f * 256 + c];
+			else {
+				ac.fail[t] = ac.delta[f * 256 + c];
+				queue[tail++] = t;
+			}
+		}
+	}
+	free(queue);
+
+	for (c = 0; c < 256; c++)
+		if (ac.delta[fold[c]] != 0) {
+			ac.start_byte = c;
+			ac.nstart++;
+		}
+	DPRINTF(2, "Automaton has %d states for %d literals and %d start bytes",
+			ac.nstates, ac.nterms, ac.nstart);
+}
+
+/*
+ * Return the length of the longest string of ordinary characters that
+ * all strings matching the specified regular expression must contain,
+ * and set *lit to point to its start in a newly allocated string.
+ * Err on the side of not finding a literal.
+ */
+static size_t
+required_literal(const char *re, char **lit)
+{
+	char *run, *best;
+	size_t runlen = 0, bestlen = 0;
+	const char *p, *q;
+	int depth = 0;
+	bool ordinary, optional, repeated;
+	char c;
+
+	if ((run = malloc(strlen(re) + 1)) == NULL ||
+	    (best = malloc(strlen(re) + 1)) == NULL)
+		err(1, NULL);
+	for (p = re; *p; p = q) {
+		q = p + 1;
+		ordinary = false;
+		c = *p;
+		if (c == '\\' && p[1]) {
+			q = p + 2;
+			c = p[1];
+			if (!opt_extended && c == '|')
+				goto alternation;
+			else if (!opt_extended && c == '(')
+				depth++;
+			else if (!opt_extended && c == ')')
+				depth--;
+			else if (!opt_extended && c == '{')
+				q = strstr(q, "\\}") ? strstr(q, "\\}") + 2 : q;
+			else if (!opt_extended && (c == '+' || c == '?'))
+				;	/* GNU repetition operators */
+			else
+				/* \< \w \1 and the like are not literals */
+				ordinary = !isalnum((unsigned char)c) &&
+					c != '<' && c != '>' && c != '`' &&
+					c != '\'';
+		} else if (c == '[') {
+			/* Skip the bracket expression */
+			if (*q == '^')
+				q++;
+			if (*q == ']')
+				q++;
+			while (*q && *q != ']') {
+				if (*q == '[' && (q[1] == ':' || q[1] == '.' ||
+				    q[1] == '=') && (q = strchr(q + 2, ']')) == NULL)
+					break;
+				q++;
+			}
+			if (q == NULL || *q == '\0')
+				break;
+			q++;
+		} else if (opt_extended && c == '|')
+			goto alternation;
+		else if (opt_extended && c == '(')
+			depth++;
+		else if (opt_extended && c == ')')
+			depth--;
+		else if (opt_extended && c == '{')
+			q = strchr(q, '}') ? strchr(q, '}') + 1 : q;
+		else
+			ordinary = strchr(opt_extended ? ".^$*+?" : ".^$*",
+					c) == NULL;
+
+		/* Find out whether the character is repeated */
+		optional = *q == '*' ||
+			(opt_extended && (*q == '?' || *q == '{')) ||
+			(!opt_extended && q[0] == '\\' &&
+			 (q[1] == '?' || q[1] == '{'));
+		repeated = (opt_extended && *q == '+') ||
+			(!opt_extended && q[0] == '\\' && q[1] == '+');
+
+		if (ordinary && depth == 0 && !optional)
+			run[runlen++] = c;
+		if (!ordinary || depth != 0 || optional || repeated) {
+			if (runlen > bestlen) {
+				memcpy(best, run, runlen);
+				bestlen = runlen;
+			}
+			runlen = 0;
+		}
+	}
+	if (runlen > bestlen) {
+		memcpy(best, run, runlen);
+		bestlen = runlen;
+	}
+	free(run);
+	*lit = best;
+	return bestlen;
+
+alternation:
+	/* Each alternative would require a separate literal */
+	free(run);
+	*lit = best;
+	return 0;
+}
+
+/* Compile the predicates into the automaton and regular expressions */
+static void
+compile_predicates(void)
+{
+	struct predicate *pr;
+	char *lit, msg[256];
+	size_t len;
+	int i, rc;
+
+	for (i = 0; i < 256; i++)
+		fold[i] = opt_icase ? tolower(i) : i;
+	new_state();
+	for (pr = preds; pr < preds + npreds; pr++) {
+		if (opt_fixed) {
+			pr->use_regex = false;
+			lit = (char *)pr->pattern;
+			len = strlen(lit);
+		} else {
+			rc = regcomp(&pr->re, pr->pattern, REG_NOSUB |
+					(opt_extended ? REG_EXTENDED : 0) |
+					(opt_icase ? REG_ICASE : 0));
+			if (rc != 0) {
+				regerror(rc, &pr->re, msg, sizeof(msg));
+				errx(2, "%s: %s", pr->pattern, msg);
+			}
+			pr->use_regex = true;
+			len = required_literal(pr->pattern, &lit);
+		}
+		pr->always = (len == 0);
+		if (len)
+			add_literal(pr - preds, lit, len);
+		DPRINTF(2, "Pattern %s literal %.*s", pr->pattern,
+				(int)len, lit);
+		if (!opt_fixed)
+			free(lit);
+	}
+	build_automaton();
+}
+
+/* Return true if c can be part of a word */
+static inline bool
+is_word(unsigned char c)
+{
+	return isalnum(c) || c == '_';
+}
+
+/* Write the specified data directly to the output's file descriptor */
+static void
+output_write_fd(struct output *o, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0 && !o->closed) {
+		if ((n = write(o->fd, data, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EPIPE)
+				err(2, "Error writing to %s", o->name);
+			/* The reader terminated early; stop serving it. */
+			o->closed = true;
+			if (--open_outputs == 0)
+				exit(0);
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+/* Write out the data pending for the output */
+static void
+output_flush(struct output *o)
+{
+	output_write_fd(o, o->buf, o->len);
+	o->len = 0;
+}
+
+/* Buffer the specified data for writing to the output */
+static void
+output_write(struct output *o, const char *data, size_t len)
+{
+	if (o->len + len > OUTPUT_BUFFER_SIZE)
+		output_flush(o);
+	if (len > OUTPUT_BUFFER_SIZE)
+		output_write_fd(o, data, len);
+	else {
+		memcpy(o->buf + o->len, data, len);
+		o->len += len;
+	}
+}
+
+/*
+ * Mark as seen on the current line the predicates whose literals
+ * end at the specified automaton state and line position p.
+ */
+static void
+record_literals(int state, const unsigned char *line,
+		const unsigned char *p, const unsigned char *end)
+{
+	struct terminal *t;
+	int s, i;
+
+	for (s = state; s != -1; s = ac.out[s])
+		for (i = ac.terminal[s]; i != -1; i = t->next) {
+			t = &ac.terms[i];
+			if (opt_word &&
+			    ((p + 1 - t->len > line && is_word(p[-t->len])) ||
+			     (p + 1 < end && is_word(p[1]))))
+				continue;
+			preds[t->pred].seen = lineno;
+		}
+}
+
+/* Run the automaton over the specified line to find its literals */
+static void
+scan_literals(const unsigned char *line, const unsigned char *end)
+{
+	/* Local copies allow the compiler to keep them in registers */
+	const int *delta = ac.delta;
+	const bool *report = ac.report;
+	const unsigned char *p = line;
+	int state = 0;
+
+	if (ac.nstart == 1) {
+		/* Quickly skip to the single byte that can start a literal */
+		while ((p = memchr(p, ac.start_byte, end - p)) != NULL)
+			do {
+				state = delta[state * 256 + fold[*p]];
+				if (report[state])
+					record_literals(state, line, p, end);
+				p++;
+			} while (state != 0 && p < end);
+	} else
+		for (; p < end; p++) {
+			state = delta[state * 256 + fold[*p]];
+			if (report[state])
+				record_literals(state, line, p, end);
+		}
+}
+
+/*
+ * Route the specified line, which is terminated by a NUL character
+ * in place of its newline, to the outputs of the predicates it satisfies.
+ */
+static void
+route_line(char *line, size_t len)
+{
+	struct predicate *pr;
+	bool match;
+	int i;
+
+	lineno++;
+	scan_literals((unsigned char *)line, (unsigned char *)line + len);
+
+	for (i = 0; i < npreds; i++) {
+		pr = &preds[i];
+		if (outputs[i].closed)
+			continue;
+		match = (pr->always || pr->seen == lineno) &&
+			(!pr->use_regex || regexec(&pr->re, line, 0, NULL, 0) == 0);
+		if (match == pr->invert)
+			continue;
+		outputs[i].count++;
+		if (!opt_count) {
+			output_write(&outputs[i], line, len);
+			output_write(&outputs[i], "\n", 1);
+		}
+	}
+}
+
+/* Route the lines read from the specified file descriptor */
+static void
+route_fd(int fd, const char *name)
+{
+	static char *buf;
+	static size_t size;
+	size_t begin = 0, end = 0;
+	char *nl;
+	ssize_t n;
+
+	if (buf == NULL) {
+		size = INPUT_BUFFER_SIZE;
+		if ((buf = malloc(size + 1)) == NULL)
+			err(1, NULL);
+	}
+	for (;;) {
+		/* Make space for reading more data */
+		if (begin > 0) {
+			memmove(buf, buf + begin, end - begin);
+			end -= begin;
+			begin = 0;
+		}
+		if (end == size) {
+			size *= 2;
+			if ((buf = realloc(buf, size + 1)) == NULL)
+				err(1, NULL);
+		}
+		n = read(fd, buf + end, size - end);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			err(2, "Error reading from %s", name);
+		}
+		if (n == 0)
+			break;
+		end += n;
+		while ((nl = memchr(buf + begin, '\n', end - begin)) != NULL) {
+			*nl = '\0';
+			route_line(buf + begin, nl - (buf + begin));
+			begin = nl - buf + 1;
+		}
+	}
+	/* Handle a final line lacking a newline */
+	if (begin < end) {
+		buf[end] = '\0';
+		route_line(buf + begin, end - begin);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n_input_fds, n_output_fds;
+	int *output_fds = NULL;
+	const char **ofiles = NULL;
+	int nofiles = 0;
+	int ch, i, fd;
+	char buff[64];
+	const char *progname = argv[0];
+
+	while ((ch = getopt(argc, argv, "cEe:Fio:v:w")) != -1) {
+		switch (ch) {
+		case 'c':
+			opt_count = true;
+			break;
+		case 'E':
+			opt_extended = true;
+			break;
+		case 'e':
+			add_predicate(optarg, false);
+			break;
+		case 'F':
+			opt_fixed = true;
+			break;
+		case 'i':
+			opt_icase = true;
+			break;
+		case 'o':
+			if ((ofiles = realloc(ofiles, (nofiles + 1) *
+							sizeof(*ofiles))) == NULL)
+				err(1, NULL);
+			ofiles[nofiles++] = optarg;
+			break;
+		case 'v':
+			add_predicate(optarg, true);
+			break;
+		case 'w':
+			opt_word = true;
+			break;
+		case '?':
+		default:
+			usage(progname);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (npreds == 0)
+		usage(progname);
+	if (nofiles && nofiles != npreds)
+		errx(1, "The number of output files %d is not equal to the number of patterns %d",
+				nofiles, npreds);
+	if (opt_word && !opt_fixed)
+		errx(1, "Word matching (-w) is only supported with fixed strings (-F)");
+
+	compile_predicates();
+
+	/* Read the standard input, unless files are specified */
+	n_input_fds = argc ? 0 : 1;
+	n_output_fds = nofiles ? 0 : npreds;
+	dgsh_negotiate(DGSH_HANDLE_ERROR, "dgsh-grep", &n_input_fds,
+			&n_output_fds, NULL, &output_fds);
+
+	if ((outputs = calloc(npreds, sizeof(*outputs))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < npreds; i++) {
+		if (nofiles) {
+			if ((fd = open(ofiles[i], O_WRONLY | O_CREAT | O_TRUNC,
+							0666)) == -1)
+				err(2, "Error opening %s", ofiles[i]);
+			outputs[i].name = ofiles[i];
+		} else {
+			fd = output_fds[i];
+			outputs[i].name = i == 0 ? "stdout" : "output channel";
+		}
+		outputs[i].fd = fd;
+		if ((outputs[i].buf = malloc(OUTPUT_BUFFER_SIZE)) == NULL)
+			err(1, NULL);
+	}
+	open_outputs = npreds;
+
+	/* We will handle SIGPIPE explicitly when calling write(2). */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (argc == 0)
+		route_fd(STDIN_FILENO, "stdin");
+	for (i = 0; i < argc; i++) {
+		if ((fd = open(argv[i], O_RDONLY)) == -1)
+			err(2, "Error opening %s", argv[i]);
+		route_fd(fd, argv[i]);
+		close(fd);
+	}
+
+	for (i = 0; i < npreds; i++) {
+		if (opt_count) {
+			snprintf(buff, sizeof(buff), "%ju\n", outputs[i].count);
+			output_write(&outputs[i], buff, strlen(buff));
+		}
+		output_flush(&outputs[i]);
+		close(outputs[i].fd);
+	}
+	return 0;
+}
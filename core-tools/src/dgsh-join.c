@@ -0,0 +1,748 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Join unsorted inputs, or compute their set operations, through
+ * a hash table built from all inputs except the first one
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dgsh.h"
+#include "dgsh-debug.h"
+#include "merge.h"
+
+/* Maximum size of the blocks from which keys and records are allocated */
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+
+/* Initial number of hash table slots; always a power of two */
+#define INITIAL_TABLE_SIZE 1024
+
+/* Number of partitions into which the inputs are divided when spilled */
+#define NPARTITIONS 32
+
+/* Maximum number of inputs; each one is a bit of an entry's inputs */
+#define MAX_INPUTS 64
+
+/* Records that are output */
+enum mode {
+	MODE_INNER,		/* Joined records */
+	MODE_LEFT,		/* Joined and unpaired first input records */
+	MODE_SEMI,		/* First input records that can be joined */
+	MODE_ANTI,		/* First input records that cannot be joined */
+	MODE_DIFF,		/* First input records in none of the others */
+};
+
+/* The fields of a build input record other than the join field */
+struct rec {
+	struct rec *next;
+	int input;
+	size_t len;
+	char rest[];
+};
+
+/* A distinct key of the build inputs */
+struct entry {
+	uint64_t hash;
+	const char *key;	/* NULL for an empty slot */
+	size_t len;
+	uint64_t inputs;	/* Set of the inputs containing the key */
+	struct rec *recs;	/* Their records, in input order */
+	struct rec **last;
+};
+
+/* Open addressing hash table with linear probing */
+struct table {
+	struct entry *slot;
+	size_t size, n;
+};
+
+/* A growable character buffer */
+struct buffer {
+	char *p;
+	size_t len, size;
+};
+
+/* A block of key and record storage */
+struct arena_block {
+	struct arena_block *next;
+	char data[];
+};
+
+/* The build inputs' keys, and the output lines when these are unique */
+static struct table keys, seen;
+
+/* Key and record storage */
+static struct arena_block *arena;
+static char *arena_free;
+static size_t arena_left;
+static size_t arena_block_size = ARENA_BLOCK_SIZE;
+
+/* Memory occupied by the tables and their contents */
+static size_t mem_used;
+
+/* When exceeded, the inputs are divided into partitions */
+static unsigned long max_mem = 256 * 1024 * 1024;
+static char *opt_tmp_dir = NULL;
+
+/* Temporary files holding the partitions of the build and probe inputs */
+static FILE *build_part[NPARTITIONS], *probe_part[NPARTITIONS];
+static int build_fd[NPARTITIONS], probe_fd[NPARTITIONS];
+static bool partitioned;
+
+static enum mode mode = MODE_INNER;
+static int probe_field = 1, build_field = 1;
+static char separator;		/* 0 for runs of blanks */
+static bool unique;
+
+static int ninputs;
+static uint64_t all_inputs;	/* Set of all build inputs */
+
+/* The record of the first input being joined */
+static const char *probe_key;
+static size_t probe_keylen;
+static struct buffer probe_rest;
+
+/* The line being output */
+static struct buffer out;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a | -s | -v | -d | -i] [-u] [-1 field] "
+			"[-2 field] [-t char]\n"
+			"\t[-m size] [-T directory] [file ...]\n"
+			"-1 field\tJoin on the field of the first input\n"
+			"-2 field\tJoin on the field of the other inputs\n"
+			"-a\t\tAlso output the unpaired records of the first input\n"
+			"-d\t\tOutput the lines of the first input that do not "
+			"appear in the others\n"
+			"-i\t\tOutput the lines of the first input that appear "
+			"in all others\n"
+			"-m size\t\tPartition the inputs to temporary files above "
+			"size memory\n"
+			"-s\t\tOutput the first input's records that can be joined\n"
+			"-T directory\tCreate temporary files in directory\n"
+			"-t char\t\tFields are separated by char\n"
+			"-u\t\tOutput each distinct line only once\n"
+			"-v\t\tOutput the first input's records that cannot be "
+			"joined\n", name);
+	exit(1);
+}
+
+/* Parse the specified option as a size with a suffix and return its value. */
+static unsigned long
+parse_size(const char *progname, const char *opt)
+{
+	char size;
+	unsigned long n;
+
+	size = 'b';
+	if (sscanf(opt, "%lu%c", &n, &size) < 1)
+		usage(progname);
+	switch (size) {
+	case 'B' : case 'b':
+		return n;
+	case 'K' : case 'k':
+		return n * 1024;
+	case 'M' : case 'm':
+		return n * 1024 * 1024;
+	case 'G' : case 'g':
+		return n * 1024 * 1024 * 1024;
+	default:
+		fprintf(stderr, "Unknown size suffix: %c\n", size);
+		usage(progname);
+	}
+	/* NOTREACHED */
+	return 0;
+}
+
+/* Append the specified data to the buffer */
+static void
+buffer_append(struct buffer *b, const char *p, size_t len)
+{
+	if (b->len + len > b->size) {
+		b->size = (b->len + len) * 2;
+		if ((b->p = realloc(b->p, b->size)) == NULL)
+			err(1, NULL);
+	}
+	memcpy(b->p + b->len, p, len);
+	b->len += len;
+}
+
+static inline bool
+is_blank(int c)
+{
+	return c == ' ' || c == '\t';
+}
+
+/* Return true if only the keys of the build inputs are needed */
+static inline bool
+keys_only(void)
+{
+	return mode == MODE_SEMI || mode == MODE_ANTI || mode == MODE_DIFF;
+}
+
+/*
+ * Set the key to the specified field of the line, and, if rest
+ * is not NULL, set rest to the line's other fields, each
+ * preceded by the output separator.
+ * Field 0 is the whole line.
+ */
+static void
+split_key(const char *line, size_t len, int field, const char **key,
+		size_t *keylen, struct buffer *rest)
+{
+	const char *p = line, *end = line + len, *start;
+	char sep = separator ? separator : ' ';
+	int i;
+
+	if (rest)
+		rest->len = 0;
+	if (field == 0) {
+		*key = line;
+		*keylen = len;
+		return;
+	}
+	*key = "";
+	*keylen = 0;
+	for (i = 1; ; i++) {
+		if (!separator) {
+			while (p < end && is_blank(*p))
+				p++;
+			if (p == end)
+				break;
+		}
+		start = p;
+		if (separator)
+			while (p < end && *p != separator)
+				p++;
+		else
+			while (p < end && !is_blank(*p))
+				p++;
+		if (i == field) {
+			*key = start;
+			*keylen = p - start;
+		} else if (rest) {
+			buffer_append(rest, &sep, 1);
+			buffer_append(rest, start, p - start);
+		}
+		if (p == end)
+			break;
+		if (separator)
+			p++;
+	}
+}
+
+/* Return a 64-bit hash of the specified bytes */
+static uint64_t
+hash(const char *p, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--)
+		h = (h ^ (unsigned char)*p++) * 0x100000001b3ULL;
+	return h ^ (h >> 32);
+}
+
+/* Return the partition to which the key with the specified hash belongs */
+static inline int
+partition(uint64_t h)
+{
+	/* Table slots are chosen by the low bits */
+	return (h >> 40) % NPARTITIONS;
+}
+
+/* Return storage of the specified size allocated from the arena */
+static void *
+arena_alloc(size_t size)
+{
+	struct arena_block *b;
+	size_t block;
+	void *p;
+
+	/* Keep subsequent allocations aligned for records */
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (size > arena_left) {
+		block = size > arena_block_size ? size : arena_block_size;
+		if ((b = malloc(sizeof(*b) + block)) == NULL)
+			err(1, NULL);
+		b->next = arena;
+		arena = b;
+		arena_free = b->data;
+		arena_left = block;
+		mem_used += sizeof(*b) + block;
+	}
+	p = arena_free;
+	arena_free += size;
+	arena_left -= size;
+	return p;
+}
+
+/* Double the size of the specified hash table */
+static void
+table_grow(struct table *t)
+{
+	struct entry *old = t->slot, *e;
+	size_t old_size = t->size, i;
+
+	t->size = old_size ? old_size * 2 : INITIAL_TABLE_SIZE;
+	if ((t->slot = calloc(t->size, sizeof(*t->slot))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < old_size; i++) {
+		if (old[i].key == NULL)
+			continue;
+		for (e = &t->slot[old[i].hash & (t->size - 1)]; e->key;
+				e = e == t->slot + t->size - 1 ? t->slot : e + 1)
+			;
+		*e = old[i];
+		if (e->recs == NULL)
+			e->last = &e->recs;
+	}
+	free(old);
+	mem_used += (t->size - old_size) * sizeof(*t->slot);
+}
+
+/*
+ * Return the table's entry for the specified key and hash.
+ * If the key is missing, add it if create is true, or return NULL.
+ */
+static struct entry *
+table_lookup(struct table *t, const char *key, size_t len, uint64_t h,
+		bool create)
+{
+	struct entry *e;
+
+	if (t->size == 0) {
+		if (!create)
+			return NULL;
+		table_grow(t);
+	}
+	/* Keep the load factor below 3/4 */
+	if (create && 4 * (t->n + 1) > 3 * t->size)
+		table_grow(t);
+	for (e = &t->slot[h & (t->size - 1)]; e->key;
+			e = e == t->slot + t->size - 1 ? t->slot : e + 1)
+		if (e->hash == h && e->len == len &&
+				memcmp(e->key, key, len) == 0)
+			return e;
+	if (!create)
+		return NULL;
+	/* The empty key also needs a non-NULL address */
+	if (len) {
+		e->key = arena_alloc(len);
+		memcpy((char *)e->key, key, len);
+	} else
+		e->key = "";
+	e->len = len;
+	e->hash = h;
+	e->inputs = 0;
+	e->recs = NULL;
+	e->last = &e->recs;
+	t->n++;
+	return e;
+}
+
+/* Remove all entries from the tables, releasing their storage */
+static void
+tables_clear(void)
+{
+	struct arena_block *b;
+
+	while ((b = arena) != NULL) {
+		arena = b->next;
+		free(b);
+	}
+	arena_free = NULL;
+	arena_left = 0;
+	free(keys.slot);
+	free(seen.slot);
+	memset(&keys, 0, sizeof(keys));
+	memset(&seen, 0, sizeof(seen));
+	mem_used = 0;
+}
+
+/* Create temporary files for the partitions of an input */
+static void
+partitions_create(FILE **f, int *fd)
+{
+	int i;
+
+	for (i = 0; i < NPARTITIONS; i++) {
+		fd[i] = merge_temp_file(opt_tmp_dir);
+		if ((f[i] = fdopen(dup(fd[i]), "w")) == NULL)
+			err(1, "fdopen");
+		setvbuf(f[i], NULL, _IOFBF, 64 * 1024);
+	}
+}
+
+/* Complete the writing of an input's partitions, to read them back */
+static void
+partitions_rewind(FILE **f, int *fd)
+{
+	int i;
+
+	for (i = 0; i < NPARTITIONS; i++) {
+		if (fclose(f[i]) != 0)
+			err(1, "Write to temporary file failed");
+		if (lseek(fd[i], 0, SEEK_SET) == -1)
+			err(1, "lseek");
+	}
+}
+
+/* Write a build input's key and record to its partition */
+static void
+build_write(int input, const char *key, size_t keylen, const char *rest,
+		size_t restlen)
+{
+	FILE *f = build_part[partition(hash(key, keylen))];
+
+	fprintf(f, "%d %zu ", input, keylen);
+	fwrite(key, 1, keylen, f);
+	fwrite(rest, 1, restlen, f);
+	putc('\n', f);
+}
+
+/* Add a build input's key and record to the hash table */
+static void
+build_add(int input, const char *key, size_t keylen, const char *rest,
+		size_t restlen)
+{
+	struct entry *e;
+	struct rec *r;
+
+	e = table_lookup(&keys, key, keylen, hash(key, keylen), true);
+	e->inputs |= (uint64_t)1 << (input - 1);
+	if (keys_only())
+		return;
+	r = arena_alloc(sizeof(*r) + restlen);
+	r->next = NULL;
+	r->input = input;
+	r->len = restlen;
+	memcpy(r->rest, rest, restlen);
+	*e->last = r;
+	e->last = &r->next;
+}
+
+/*
+ * Move the hash table's contents to the partitions of the build
+ * inputs, to which the remaining build records will also be written.
+ */
+static void
+partition_table(void)
+{
+	struct entry *e;
+	struct rec *r;
+	int i;
+
+	DPRINTF(2, "Partitioning %zu keys", keys.n);
+	partitions_create(build_part, build_fd);
+	for (e = keys.slot; e < keys.slot + keys.size; e++) {
+		if (e->key == NULL)
+			continue;
+		if (keys_only()) {
+			for (i = 1; i < ninputs; i++)
+				if (e->inputs & ((uint64_t)1 << (i - 1)))
+					build_write(i, e->key, e->len, "", 0);
+		} else
+			for (r = e->recs; r; r = r->next)
+				build_write(r->input, e->key, e->len,
+						r->rest, r->len);
+	}
+	tables_clear();
+	partitioned = true;
+}
+
+/* Read the records of the specified build input */
+static void
+build_input(struct merge_input *in, int input)
+{
+	static struct buffer rest;
+	struct buffer *restp;
+	const char *key;
+	size_t keylen;
+
+	restp = keys_only() ? NULL : &rest;
+	while (merge_read_record(in, NULL)) {
+		split_key(in->line, in->linelen, build_field, &key, &keylen,
+				restp);
+		if (partitioned) {
+			build_write(input, key, keylen, rest.p,
+					restp ? rest.len : 0);
+			continue;
+		}
+		build_add(input, key, keylen, rest.p, restp ? rest.len : 0);
+		if (max_mem && mem_used > max_mem && keys.n > INITIAL_TABLE_SIZE / 2)
+			partition_table();
+	}
+}
+
+/* Load the build records of the specified partition into the hash table */
+static void
+build_load(int part)
+{
+	struct merge_input in;
+	const char *p, *end;
+	int input;
+	size_t keylen;
+
+	merge_input_init(&in, build_fd[part], "temporary file");
+	while (merge_read_record(&in, NULL)) {
+		p = in.line;
+		end = in.line + in.linelen;
+		input = 0;
+		while (p < end && *p != ' ')
+			input = input * 10 + (*p++ - '0');
+		keylen = 0;
+		for (p++; p < end && *p != ' '; p++)
+			keylen = keylen * 10 + (*p - '0');
+		p++;
+		if (p + keylen > end)
+			errx(1, "Corrupted temporary file");
+		build_add(input, p, keylen, p + keylen, end - p - keylen);
+	}
+	close(in.fd);
+	free(in.buf);
+}
+
+/* Output the line accumulated in out, unless it is a duplicate */
+static void
+output_line(void)
+{
+	struct entry *e;
+
+	if (unique) {
+		e = table_lookup(&seen, out.p, out.len, hash(out.p, out.len),
+				true);
+		if (e->inputs)
+			return;
+		e->inputs = 1;
+	}
+	fwrite(out.p, 1, out.len, stdout);
+	putchar('\n');
+}
+
+/*
+ * Output the joins of the probe record with the entry's records
+ * of the specified input and the ones following it.
+ */
+static void
+output_joins(const struct entry *e, int input, const struct rec **chosen)
+{
+	const struct rec *r;
+	int i;
+
+	if (input == ninputs) {
+		out.len = 0;
+		buffer_append(&out, probe_key, probe_keylen);
+		buffer_append(&out, probe_rest.p, probe_rest.len);
+		for (i = 1; i < ninputs; i++)
+			buffer_append(&out, chosen[i]->rest, chosen[i]->len);
+		output_line();
+		return;
+	}
+	for (r = e->recs; r; r = r->next)
+		if (r->input == input) {
+			chosen[input] = r;
+			output_joins(e, input + 1, chosen);
+		}
+}
+
+/* Output the results of joining the specified probe record */
+static void
+probe(const char *line, size_t len)
+{
+	const struct rec *chosen[MAX_INPUTS + 1];
+	struct entry *e;
+	bool matched;
+
+	split_key(line, len, probe_field, &probe_key, &probe_keylen,
+			mode == MODE_INNER || mode == MODE_LEFT ?
+			&probe_rest : NULL);
+	e = table_lookup(&keys, probe_key, probe_keylen,
+			hash(probe_key, probe_keylen), false);
+	matched = e && e->inputs == all_inputs;
+
+	switch (mode) {
+	case MODE_DIFF:
+		if (e && e->inputs)
+			return;
+		out.len = 0;
+		buffer_append(&out, line, len);
+		output_line();
+		break;
+	case MODE_SEMI:
+	case MODE_ANTI:
+		if (matched != (mode == MODE_SEMI))
+			return;
+		out.len = 0;
+		buffer_append(&out, line, len);
+		output_line();
+		break;
+	case MODE_LEFT:
+		if (!matched) {
+			out.len = 0;
+			buffer_append(&out, probe_key, probe_keylen);
+			buffer_append(&out, probe_rest.p, probe_rest.len);
+			output_line();
+			break;
+		}
+		/* FALLTHROUGH */
+	case MODE_INNER:
+		if (matched)
+			output_joins(e, 1, chosen);
+		break;
+	}
+}
+
+/* Join the records of the first input, or partition them */
+static void
+probe_input(struct merge_input *in)
+{
+	const char *key;
+	size_t keylen;
+	FILE *f;
+
+	while (merge_read_record(in, NULL)) {
+		if (!partitioned) {
+			probe(in->line, in->linelen);
+			continue;
+		}
+		split_key(in->line, in->linelen, probe_field, &key, &keylen,
+				NULL);
+		f = probe_part[partition(hash(key, keylen))];
+		fwrite(in->line, 1, in->linelen, f);
+		putc('\n', f);
+	}
+}
+
+/* Join the records of each pair of build and probe partitions */
+static void
+join_partitions(void)
+{
+	struct merge_input in;
+	int i;
+
+	for (i = 0; i < NPARTITIONS; i++) {
+		DPRINTF(2, "Joining partition %d", i);
+		tables_clear();
+		build_load(i);
+		merge_input_init(&in, probe_fd[i], "temporary file");
+		while (merge_read_record(&in, NULL))
+			probe(in.line, in.linelen);
+		close(in.fd);
+		free(in.buf);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct merge_input *inputs;
+	int ch, i;
+
+	while ((ch = getopt(argc, argv, "1:2:adim:st:T:uv")) != -1) {
+		switch (ch) {
+		case '1':
+			if ((probe_field = atoi(optarg)) < 0)
+				usage(argv[0]);
+			break;
+		case '2':
+			if ((build_field = atoi(optarg)) < 0)
+				usage(argv[0]);
+			break;
+		case 'a':
+			mode = MODE_LEFT;
+			break;
+		case 'd':
+			mode = MODE_DIFF;
+			probe_field = build_field = 0;
+			unique = true;
+			break;
+		case 'i':
+			mode = MODE_SEMI;
+			probe_field = build_field = 0;
+			unique = true;
+			break;
+		case 'm':
+			max_mem = parse_size(argv[0], optarg);
+			break;
+		case 's':
+			mode = MODE_SEMI;
+			break;
+		case 't':
+			if (strlen(optarg) != 1)
+				usage(argv[0]);
+			separator = *optarg;
+			break;
+		case 'T':
+			opt_tmp_dir = optarg;
+			break;
+		case 'u':
+			unique = true;
+			break;
+		case 'v':
+			mode = MODE_ANTI;
+			break;
+		case '?':
+		default:
+			usage(argv[0]);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	/* Allow the tables to use a reasonable part of a small memory limit */
+	if (max_mem && max_mem / 16 < arena_block_size)
+		arena_block_size = max_mem / 16 + 1;
+
+	inputs = merge_open_inputs("dgsh-join", argc, argv, &ninputs);
+	if (ninputs < 2)
+		errx(1, "At least two inputs are required");
+	if (ninputs > MAX_INPUTS + 1)
+		errx(1, "At most %d inputs can be joined", MAX_INPUTS + 1);
+	all_inputs = ninputs - 1 == MAX_INPUTS ? ~(uint64_t)0 :
+		((uint64_t)1 << (ninputs - 1)) - 1;
+
+	setvbuf(stdout, NULL, _IOFBF, 256 * 1024);
+
+	/* Build the hash table from all inputs except the first one */
+	for (i = 1; i < ninputs; i++) {
+		build_input(&inputs[i], i);
+		close(inputs[i].fd);
+		free(inputs[i].buf);
+	}
+
+	if (partitioned) {
+		partitions_rewind(build_part, build_fd);
+		partitions_create(probe_part, probe_fd);
+		probe_input(&inputs[0]);
+		partitions_rewind(probe_part, probe_fd);
+		join_partitions();
+	} else
+		probe_input(&inputs[0]);
+
+	if (fflush(stdout) != 0)
+		err(3, "Error writing to stdout");
+	return 0;
+}
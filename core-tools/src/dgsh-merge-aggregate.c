@@ -0,0 +1,485 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Merge sorted records, aggregating the fields of records with equal keys
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "merge.h"
+
+/* Number of distinct values counted exactly before switching to HLL */
+#define EXACT_MAX 64
+/* HyperLogLog precision: 2^HLL_P registers */
+#define HLL_P 12
+#define HLL_M (1 << HLL_P)
+
+/* Supported aggregate functions */
+enum agg_func {
+	AF_COUNT,
+	AF_DISTINCT,
+	AF_FIRST,
+	AF_LAST,
+	AF_MAX,
+	AF_MIN,
+	AF_SUM,
+};
+
+static const char *func_name[] = {
+	[AF_COUNT] = "count",
+	[AF_DISTINCT] = "distinct",
+	[AF_FIRST] = "first",
+	[AF_LAST] = "last",
+	[AF_MAX] = "max",
+	[AF_MIN] = "min",
+	[AF_SUM] = "sum",
+};
+
+/* A growable byte string */
+struct string {
+	char *s;
+	size_t len, size;
+};
+
+/* Distinct value counter: exact for few values, HyperLogLog for many */
+struct distinct {
+	int nexact;
+	uint64_t exact[EXACT_MAX];
+	uint8_t *reg;		/* HLL registers, when used */
+	bool dense;		/* True if counting through the registers */
+};
+
+/* An aggregate function applied to a field and its state */
+struct aggregate {
+	enum agg_func func;
+	int field;		/* 1-based field number */
+	bool valid;		/* True if a value has been seen */
+	double num;		/* Numeric result */
+	uintmax_t count;
+	struct string str;	/* First or last value */
+	struct distinct distinct;
+};
+
+/* A field's location within a record */
+struct field {
+	const char *s;
+	size_t len;
+};
+
+static struct aggregate *aggs;
+static int naggs;
+
+/* Key fields; key_end is 0 for a key extending to the end of the line */
+static int key_begin = 1, key_end;
+
+/* Field separator character; 0 for runs of blanks */
+static char separator;
+
+/* Maximum field referenced by an aggregate */
+static int max_field;
+static struct field *fields;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-d char] [-k pos1[,pos2]] "
+			"[-a func:field] ... [file ...]\n"
+			"-a func:field\tAggregate the field through func: "
+			"count, distinct,\n"
+			"\t\tfirst, last, max, min, or sum\n"
+			"-d char\t\tUse char as the field separator\n"
+			"-k pos1[,pos2]\tKey starts at field pos1 and ends "
+			"at pos2 (or line end)\n", name);
+	exit(1);
+}
+
+static inline bool
+is_blank(int c)
+{
+	return c == ' ' || c == '\t';
+}
+
+/*
+ * Locate up to n fields of the specified line, storing them in f.
+ * Return the number of fields located.
+ */
+static int
+split_fields(const char *line, size_t len, int n, struct field *f)
+{
+	const char *p = line, *end = line + len, *q;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (separator) {
+			if (p > end)
+				break;
+			if ((q = memchr(p, separator, end - p)) == NULL)
+				q = end;
+			f[i].s = p;
+			f[i].len = q - p;
+			p = q + 1;
+		} else {
+			while (p < end && is_blank(*p))
+				p++;
+			if (p == end)
+				break;
+			for (q = p; q < end && !is_blank(*q); q++)
+				;
+			f[i].s = p;
+			f[i].len = q - p;
+			p = q;
+		}
+	}
+	return i;
+}
+
+/* Set the key of the input's current record */
+static void
+set_key(struct merge_input *in)
+{
+	struct field f[key_end ? key_end : key_begin];
+	const char *eol = in->line + in->linelen;
+	int n;
+
+	n = split_fields(in->line, in->linelen,
+			key_end ? key_end : key_begin, f);
+	if (n < key_begin) {
+		in->key = eol;
+		in->keylen = 0;
+		return;
+	}
+	in->key = f[key_begin - 1].s;
+	if (key_end == 0)
+		in->keylen = eol - in->key;
+	else
+		in->keylen = f[n - 1].s + f[n - 1].len - in->key;
+}
+
+/* Assign the specified bytes to the string s */
+static void
+string_set(struct string *s, const char *p, size_t len)
+{
+	if (len > s->size) {
+		s->size = len * 2;
+		if ((s->s = realloc(s->s, s->size)) == NULL)
+			err(1, NULL);
+	}
+	memcpy(s->s, p, len);
+	s->len = len;
+}
+
+/* Return a 64-bit hash of the specified bytes */
+static uint64_t
+hash(const char *p, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--)
+		h = (h ^ (unsigned char)*p++) * 0x100000001b3ULL;
+	/* Mix the bits, as HLL depends on their uniformity */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static void
+hll_add(uint8_t *reg, uint64_t h)
+{
+	int idx = h >> (64 - HLL_P);
+	uint64_t w = (h << HLL_P) | (1ULL << (HLL_P - 1));
+	uint8_t rank = __builtin_clzll(w) + 1;
+
+	if (rank > reg[idx])
+		reg[idx] = rank;
+}
+
+static uintmax_t
+hll_estimate(const uint8_t *reg)
+{
+	double sum = 0, estimate;
+	int i, zeros = 0;
+
+	for (i = 0; i < HLL_M; i++) {
+		sum += ldexp(1.0, -reg[i]);
+		if (reg[i] == 0)
+			zeros++;
+	}
+	estimate = 0.7213 / (1 + 1.079 / HLL_M) * HLL_M * HLL_M / sum;
+	/* Small range correction through linear counting */
+	if (estimate <= 2.5 * HLL_M && zeros)
+		estimate = HLL_M * log((double)HLL_M / zeros);
+	return (uintmax_t)(estimate + 0.5);
+}
+
+static void
+distinct_add(struct distinct *d, const char *p, size_t len)
+{
+	uint64_t h = hash(p, len);
+	int i;
+
+	if (d->dense) {
+		hll_add(d->reg, h);
+		return;
+	}
+	for (i = 0; i < d->nexact; i++)
+		if (d->exact[i] == h)
+			return;
+	if (d->nexact < EXACT_MAX) {
+		d->exact[d->nexact++] = h;
+		return;
+	}
+	/* Switch to approximate counting */
+	if (d->reg == NULL && (d->reg = malloc(HLL_M)) == NULL)
+		err(1, NULL);
+	memset(d->reg, 0, HLL_M);
+	for (i = 0; i < d->nexact; i++)
+		hll_add(d->reg, d->exact[i]);
+	hll_add(d->reg, h);
+	d->dense = true;
+}
+
+static uintmax_t
+distinct_count(const struct distinct *d)
+{
+	return d->dense ? hll_estimate(d->reg) : (uintmax_t)d->nexact;
+}
+
+/* Parse the specified field as a number; return false if empty */
+static bool
+field_number(const struct field *f, double *result)
+{
+	char buf[64], *end;
+	size_t len = f->len < sizeof(buf) - 1 ? f->len : sizeof(buf) - 1;
+
+	if (len == 0)
+		return false;
+	memcpy(buf, f->s, len);
+	buf[len] = '\0';
+	*result = strtod(buf, &end);
+	return end != buf;
+}
+
+/* Reset the aggregates for a new key */
+static void
+aggregates_reset(void)
+{
+	struct aggregate *a;
+
+	for (a = aggs; a < aggs + naggs; a++) {
+		a->valid = false;
+		a->count = 0;
+		a->num = 0;
+		a->str.len = 0;
+		a->distinct.nexact = 0;
+		a->distinct.dense = false;
+	}
+}
+
+/* Update the aggregates with the input's current record */
+static void
+aggregates_update(const struct merge_input *in)
+{
+	struct aggregate *a;
+	const struct field *f;
+	int n;
+	double v;
+
+	n = split_fields(in->line, in->linelen, max_field, fields);
+	for (a = aggs; a < aggs + naggs; a++) {
+		if (a->func == AF_COUNT) {
+			a->count++;
+			continue;
+		}
+		if (a->field > n)
+			continue;
+		f = &fields[a->field - 1];
+		switch (a->func) {
+		case AF_DISTINCT:
+			distinct_add(&a->distinct, f->s, f->len);
+			break;
+		case AF_FIRST:
+			if (!a->valid)
+				string_set(&a->str, f->s, f->len);
+			break;
+		case AF_LAST:
+			string_set(&a->str, f->s, f->len);
+			break;
+		case AF_MAX:
+			if (field_number(f, &v) && (!a->valid || v > a->num))
+				a->num = v;
+			else
+				continue;
+			break;
+		case AF_MIN:
+			if (field_number(f, &v) && (!a->valid || v < a->num))
+				a->num = v;
+			else
+				continue;
+			break;
+		case AF_SUM:
+			if (field_number(f, &v))
+				a->num += v;
+			break;
+		case AF_COUNT:
+			break;
+		}
+		a->valid = true;
+	}
+}
+
+/* Output the aggregates followed by the key */
+static void
+aggregates_output(const char *key, size_t keylen)
+{
+	struct aggregate *a;
+	char sep = separator ? separator : ' ';
+
+	for (a = aggs; a < aggs + naggs; a++) {
+		switch (a->func) {
+		case AF_COUNT:
+			printf("%ju", a->count);
+			break;
+		case AF_DISTINCT:
+			printf("%ju", distinct_count(&a->distinct));
+			break;
+		case AF_FIRST:
+		case AF_LAST:
+			fwrite(a->str.s, 1, a->str.len, stdout);
+			break;
+		case AF_MAX:
+		case AF_MIN:
+		case AF_SUM:
+			printf("%.15g", a->num);
+			break;
+		}
+		putchar(sep);
+	}
+	fwrite(key, 1, keylen, stdout);
+	putchar('\n');
+}
+
+/* Merge the specified inputs into the standard output */
+static void
+merge_aggregate(struct merge_input *inputs, int ninputs)
+{
+	struct merge_heap h;
+	struct merge_input *top;
+	bool more;
+
+	merge_heap_init(&h, inputs, ninputs, set_key);
+	more = h.n > 0;
+	while (more) {
+		aggregates_reset();
+		aggregates_update(h.heap[0]);
+		more = merge_heap_advance(&h);
+		while (more && (top = h.heap[0]) &&
+				merge_keycmp(top->key, top->keylen,
+					h.prev, h.prevlen) == 0) {
+			aggregates_update(top);
+			more = merge_heap_advance(&h);
+		}
+		aggregates_output(h.prev, h.prevlen);
+	}
+	merge_heap_free(&h);
+}
+
+/* Add the aggregate specified as func:field */
+static void
+add_aggregate(const char *spec)
+{
+	struct aggregate *a;
+	const char *colon;
+	size_t i, len;
+
+	if ((aggs = realloc(aggs, (naggs + 1) * sizeof(*aggs))) == NULL)
+		err(1, NULL);
+	a = &aggs[naggs++];
+	memset(a, 0, sizeof(*a));
+
+	colon = strchr(spec, ':');
+	len = colon ? (size_t)(colon - spec) : strlen(spec);
+	for (i = 0; i < sizeof(func_name) / sizeof(*func_name); i++)
+		if (strlen(func_name[i]) == len &&
+				strncmp(spec, func_name[i], len) == 0)
+			break;
+	if (i == sizeof(func_name) / sizeof(*func_name))
+		errx(1, "Unknown aggregate function in %s", spec);
+	a->func = i;
+	if (a->func == AF_COUNT)
+		return;
+	if (colon == NULL || (a->field = atoi(colon + 1)) < 1)
+		errx(1, "Missing or invalid field number in %s", spec);
+	if (a->field > max_field)
+		max_field = a->field;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct merge_input *inputs;
+	int ninputs;
+	int ch;
+	char *comma;
+
+	while ((ch = getopt(argc, argv, "a:d:k:")) != -1) {
+		switch (ch) {
+		case 'a':
+			add_aggregate(optarg);
+			break;
+		case 'd':
+			if (strlen(optarg) != 1)
+				usage(argv[0]);
+			separator = *optarg;
+			break;
+		case 'k':
+			key_begin = atoi(optarg);
+			if ((comma = strchr(optarg, ',')) != NULL)
+				key_end = atoi(comma + 1);
+			if (key_begin < 1 || (comma && key_end < key_begin))
+				usage(argv[0]);
+			break;
+		case '?':
+		default:
+			usage(argv[0]);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (naggs == 0)
+		add_aggregate("count");
+	if ((fields = malloc((max_field + 1) * sizeof(*fields))) == NULL)
+		err(1, NULL);
+
+	inputs = merge_open_inputs("dgsh-merge-aggregate", argc, argv,
+			&ninputs);
+
+	setvbuf(stdout, NULL, _IOFBF, 256 * 1024);
+	merge_aggregate(inputs, ninputs);
+	if (fflush(stdout) != 0)
+		err(3, "Error writing to stdout");
+	return 0;
+}
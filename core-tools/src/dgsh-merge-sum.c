@@ -0,0 +1,139 @@
+/*
+ * Copyright 2014-2017 Diomidis Spinellis
+ *
+ * Merge sorted (value, key) pairs, summing the values of equal keys
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "merge.h"
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-t fanin] [file ...]\n", name);
+	exit(1);
+}
+
+static inline bool
+is_space(int c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+/* Parse the current record's value and key */
+static void
+parse_value_key(struct merge_input *in)
+{
+	const char *p = in->line;
+	const char *eol = in->line + in->linelen;
+
+	while (p < eol && is_space(*p))
+		p++;
+	if (p == eol || *p < '0' || *p > '9')
+		errx(1, "%s(%lu): Record does not start with a number",
+				in->name, in->lineno);
+	in->value = 0;
+	while (p < eol && *p >= '0' && *p <= '9')
+		in->value = in->value * 10 + (*p++ - '0');
+	if (p < eol && !is_space(*p))
+		errx(1, "%s(%lu): Missing separator after the number",
+				in->name, in->lineno);
+	while (p < eol && is_space(*p))
+		p++;
+	in->key = p;
+	in->keylen = eol - p;
+}
+
+/* Output the specified value and key */
+static void
+output_record(uintmax_t value, const char *key, size_t keylen)
+{
+	char buf[32];
+	char *p = buf + sizeof(buf);
+
+	*--p = ' ';
+	do {
+		*--p = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	fwrite(p, 1, buf + sizeof(buf) - p, stdout);
+	fwrite(key, 1, keylen, stdout);
+	putchar('\n');
+}
+
+/* Merge the specified inputs into the standard output */
+static void
+merge_sum(struct merge_input *inputs, int ninputs)
+{
+	struct merge_heap h;
+	struct merge_input *top;
+	uintmax_t sum;
+	bool more;
+
+	merge_heap_init(&h, inputs, ninputs, parse_value_key);
+	more = h.n > 0;
+	while (more) {
+		sum = h.heap[0]->value;
+		more = merge_heap_advance(&h);
+		/* Sum up and renew all equal keys */
+		while (more && (top = h.heap[0]) &&
+				merge_keycmp(top->key, top->keylen,
+					h.prev, h.prevlen) == 0) {
+			sum += top->value;
+			more = merge_heap_advance(&h);
+		}
+		output_record(sum, h.prev, h.prevlen);
+	}
+	merge_heap_free(&h);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct merge_input *inputs;
+	int ninputs, fanin = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "t:")) != -1) {
+		switch (ch) {
+		case 't':
+			fanin = atoi(optarg);
+			if (fanin < 2)
+				usage(argv[0]);
+			break;
+		case '?':
+		default:
+			usage(argv[0]);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	inputs = merge_open_inputs("dgsh-merge-sum", argc, argv, &ninputs);
+
+	setvbuf(stdout, NULL, _IOFBF, 256 * 1024);
+	merge_tree(&inputs, &ninputs, fanin, merge_sum);
+	merge_sum(inputs, ninputs);
+	if (fflush(stdout) != 0)
+		err(3, "Error writing to stdout");
+	return merge_wait();
+}
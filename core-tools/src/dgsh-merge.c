@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Merge sorted lines of multiple inputs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "merge.h"
+
+/* True to output only the first of equal lines */
+static bool unique;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-u] [-t fanin] [file ...]\n", name);
+	exit(1);
+}
+
+/* Merge the specified inputs into the standard output */
+static void
+merge(struct merge_input *inputs, int ninputs)
+{
+	struct merge_heap h;
+	struct merge_input *top;
+	bool more, first = true;
+
+	merge_heap_init(&h, inputs, ninputs, NULL);
+	more = h.n > 0;
+	while (more) {
+		top = h.heap[0];
+		if (!unique || first || merge_keycmp(top->line, top->linelen,
+					h.prev, h.prevlen) != 0) {
+			fwrite(top->line, 1, top->linelen, stdout);
+			putchar('\n');
+		}
+		first = false;
+		more = merge_heap_advance(&h);
+	}
+	merge_heap_free(&h);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct merge_input *inputs;
+	int ninputs, fanin = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "t:u")) != -1) {
+		switch (ch) {
+		case 't':
+			fanin = atoi(optarg);
+			if (fanin < 2)
+				usage(argv[0]);
+			break;
+		case 'u':
+			unique = true;
+			break;
+		case '?':
+		default:
+			usage(argv[0]);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	inputs = merge_open_inputs("dgsh-merge", argc, argv, &ninputs);
+
+	setvbuf(stdout, NULL, _IOFBF, 256 * 1024);
+	merge_tree(&inputs, &ninputs, fanin, merge);
+	merge(inputs, ninputs);
+	if (fflush(stdout) != 0)
+		err(3, "Error writing to stdout");
+	return merge_wait();
+}
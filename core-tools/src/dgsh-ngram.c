@@ -0,0 +1,300 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Split the input into words once, and write the words and their
+ * character n-grams of various sizes to separate output channels
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dgsh.h"
+#include "dgsh-debug.h"
+
+#define INPUT_BUFFER_SIZE (256 * 1024)
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+/* An output channel and the tokens written to it */
+struct output {
+	int size;		/* N-gram size; 0 for words */
+	int fd;
+	const char *name;
+	char *buf;
+	size_t len;
+	bool closed;		/* True if its reader has exited */
+};
+
+static struct output *outputs;
+static int noutputs;
+static int open_outputs;
+
+/* True for the bytes that are part of words */
+static bool is_word[256];
+
+/* A word that continues in the next input buffer */
+static char *word;
+static size_t word_len, word_size;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-o file] ... -n size | -w ... "
+			"[file ...]\n"
+			"-n size\tWrite the words' character n-grams of size "
+			"to the next output\n"
+			"-o file\tWrite the next output to file\n"
+			"-w\tWrite the words to the next output\n", name);
+	exit(1);
+}
+
+/* Add an output for the tokens of the specified size */
+static void
+add_output(int size)
+{
+	if ((outputs = realloc(outputs, (noutputs + 1) *
+					sizeof(*outputs))) == NULL)
+		err(1, NULL);
+	memset(&outputs[noutputs], 0, sizeof(*outputs));
+	outputs[noutputs++].size = size;
+}
+
+/* Write the specified data directly to the output's file descriptor */
+static void
+output_write_fd(struct output *o, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0 && !o->closed) {
+		if ((n = write(o->fd, data, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EPIPE)
+				err(2, "Error writing to %s", o->name);
+			/* The reader terminated early; stop serving it. */
+			o->closed = true;
+			if (--open_outputs == 0)
+				exit(0);
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+/* Write out the data pending for the output */
+static void
+output_flush(struct output *o)
+{
+	output_write_fd(o, o->buf, o->len);
+	o->len = 0;
+}
+
+/* Buffer the specified token and a newline for writing to the output */
+static inline void
+output_token(struct output *o, const char *token, size_t len)
+{
+	if (o->len + len + 1 > OUTPUT_BUFFER_SIZE) {
+		output_flush(o);
+		if (len + 1 > OUTPUT_BUFFER_SIZE) {
+			output_write_fd(o, token, len);
+			output_write_fd(o, "\n", 1);
+			return;
+		}
+	}
+	memcpy(o->buf + o->len, token, len);
+	o->buf[o->len + len] = '\n';
+	o->len += len + 1;
+}
+
+/* Write the specified word and its n-grams to the outputs */
+static void
+process_word(const char *w, size_t len)
+{
+	struct output *o;
+	size_t i;
+
+	for (o = outputs; o < outputs + noutputs; o++) {
+		if (o->closed)
+			continue;
+		if (o->size == 0)
+			output_token(o, w, len);
+		else
+			for (i = 0; i + o->size <= len; i++)
+				output_token(o, w + i, o->size);
+	}
+}
+
+/* Append the specified part of a word to the pending word */
+static void
+word_append(const char *p, size_t len)
+{
+	if (word_len + len > word_size) {
+		word_size = (word_len + len) * 2;
+		if ((word = realloc(word, word_size)) == NULL)
+			err(1, NULL);
+	}
+	memcpy(word + word_len, p, len);
+	word_len += len;
+}
+
+/* Process the words of the specified buffer */
+static void
+process_buffer(const char *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	const unsigned char *end = p + len, *start;
+
+	while (p < end) {
+		/* Skip separators, unless a word continues from before */
+		if (word_len == 0)
+			while (p < end && !is_word[*p])
+				p++;
+		start = p;
+		while (p < end && is_word[*p])
+			p++;
+		if (p == end) {
+			/* The word may continue in the next buffer */
+			word_append((const char *)start, p - start);
+			break;
+		}
+		if (word_len) {
+			word_append((const char *)start, p - start);
+			process_word(word, word_len);
+			word_len = 0;
+		} else
+			process_word((const char *)start, p - start);
+	}
+}
+
+/* Process the words read from the specified file descriptor */
+static void
+process_fd(int fd, const char *name)
+{
+	static char *buf;
+	ssize_t n;
+
+	if (buf == NULL && (buf = malloc(INPUT_BUFFER_SIZE)) == NULL)
+		err(1, NULL);
+	for (;;) {
+		n = read(fd, buf, INPUT_BUFFER_SIZE);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			err(2, "Error reading from %s", name);
+		}
+		if (n == 0)
+			break;
+		process_buffer(buf, n);
+	}
+	/* Words do not span files */
+	if (word_len) {
+		process_word(word, word_len);
+		word_len = 0;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n_input_fds, n_output_fds;
+	int *output_fds = NULL;
+	const char **ofiles = NULL;
+	int nofiles = 0;
+	int ch, i, fd, size;
+	const char *progname = argv[0];
+
+	while ((ch = getopt(argc, argv, "n:o:w")) != -1) {
+		switch (ch) {
+		case 'n':
+			if ((size = atoi(optarg)) < 1)
+				usage(progname);
+			add_output(size);
+			break;
+		case 'o':
+			if ((ofiles = realloc(ofiles, (nofiles + 1) *
+							sizeof(*ofiles))) == NULL)
+				err(1, NULL);
+			ofiles[nofiles++] = optarg;
+			break;
+		case 'w':
+			add_output(0);
+			break;
+		case '?':
+		default:
+			usage(progname);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (noutputs == 0)
+		usage(progname);
+	if (nofiles && nofiles != noutputs)
+		errx(1, "The number of output files %d is not equal to the number of outputs %d",
+				nofiles, noutputs);
+
+	/* Words consist of letters, as with tr -cs A-Za-z '\n' */
+	for (i = 'a'; i <= 'z'; i++)
+		is_word[i] = is_word[i - 'a' + 'A'] = true;
+
+	/* Read the standard input, unless files are specified */
+	n_input_fds = argc ? 0 : 1;
+	n_output_fds = nofiles ? 0 : noutputs;
+	dgsh_negotiate(DGSH_HANDLE_ERROR, "dgsh-ngram", &n_input_fds,
+			&n_output_fds, NULL, &output_fds);
+
+	for (i = 0; i < noutputs; i++) {
+		if (nofiles) {
+			if ((fd = open(ofiles[i], O_WRONLY | O_CREAT | O_TRUNC,
+							0666)) == -1)
+				err(2, "Error opening %s", ofiles[i]);
+			outputs[i].name = ofiles[i];
+		} else {
+			fd = output_fds[i];
+			outputs[i].name = i == 0 ? "stdout" : "output channel";
+		}
+		outputs[i].fd = fd;
+		if ((outputs[i].buf = malloc(OUTPUT_BUFFER_SIZE)) == NULL)
+			err(1, NULL);
+	}
+	open_outputs = noutputs;
+
+	/* We will handle SIGPIPE explicitly when calling write(2). */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (argc == 0)
+		process_fd(STDIN_FILENO, "stdin");
+	for (i = 0; i < argc; i++) {
+		if ((fd = open(argv[i], O_RDONLY)) == -1)
+			err(2, "Error opening %s", argv[i]);
+		process_fd(fd, argv[i]);
+		close(fd);
+	}
+
+	for (i = 0; i < noutputs; i++) {
+		output_flush(&outputs[i]);
+		close(outputs[i].fd);
+	}
+	return 0;
+}
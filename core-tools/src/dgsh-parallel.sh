@@ -26,13 +26,113 @@ unset DGSH_OUT
 
 usage()
 {
-  echo 'Usage: dgsh-parallel [-d] -n n|-f file|-l list command ...' 1>&2
+  echo 'Usage: dgsh-parallel [-ad] [-c cpus] -n n|auto|-f file|-l list command ...' 1>&2
   exit 2
 }
 
+# Expand a CPU list, such as 0-3,8,10-11, into one CPU per line
+expand_cpu_list()
+{
+  echo "$1" |
+  tr , '\n' |
+  awk -F- 'NF { for (i = $1; i <= (NF > 1 ? $2 : $1); i++) print i }'
+}
+
+# Output the CPUs this process may run on, one per line
+allowed_cpus()
+{
+  local list
+
+  list=$(sed -n 's/^Cpus_allowed_list:[ \t]*//p' /proc/self/status 2>/dev/null)
+  if [ "$list" ] ; then
+    expand_cpu_list "$list"
+  else
+    seq 0 $(($(getconf _NPROCESSORS_ONLN) - 1))
+  fi
+}
+
+# Output the number of CPUs available, taking into account the CPU
+# affinity mask and any cgroup CPU bandwidth quota
+available_cpus()
+{
+  local ncpu cgroup quota period limit
+
+  ncpu=$(nproc 2>/dev/null || getconf _NPROCESSORS_ONLN)
+
+  # cgroup v2, followed by v1
+  cgroup=$(sed -n 's/^0:://p' /proc/self/cgroup 2>/dev/null)
+  if [ -r "/sys/fs/cgroup$cgroup/cpu.max" ] ; then
+    read quota period <"/sys/fs/cgroup$cgroup/cpu.max"
+  elif [ -r /sys/fs/cgroup/cpu/cpu.cfs_quota_us ] ; then
+    quota=$(cat /sys/fs/cgroup/cpu/cpu.cfs_quota_us)
+    period=$(cat /sys/fs/cgroup/cpu/cpu.cfs_period_us)
+  fi
+  if [ "$quota" ] && [ "$quota" != max ] && [ "$quota" -gt 0 ] ; then
+    limit=$(( (quota + period - 1) / period ))
+    if [ $limit -lt $ncpu ] ; then
+      ncpu=$limit
+    fi
+  fi
+  echo $ncpu
+}
+
+# Output the NUMA node of each CPU read from the standard input
+# as a "node cpu" line, ordered by node
+cpu_nodes()
+{
+  local node
+
+  {
+    for node in /sys/devices/system/node/node[0-9]* ; do
+      test -r $node/cpulist || continue
+      expand_cpu_list "$(cat $node/cpulist)" |
+      sed "s/^/${node##*/node} /"
+    done
+    # Mark the CPUs the process may run on
+    sed 's/^/- /'
+  } |
+  awk '
+    $1 == "-" { order[n++] = $2; next }
+    { node[$2] = $1 }
+    END {
+      for (i = 0; i < n; i++)
+	print (order[i] in node ? node[order[i]] : 0), order[i]
+    }' |
+  sort -n -k1,1 -k2,2
+}
+
+# Output for each of the specified number of replicas a comma-separated
+# list of the CPUs it should be pinned to.
+# CPUs are split into contiguous ranges ordered by NUMA node, and each
+# range is confined to a single node.
+cpu_sets()
+{
+  awk -v n="$1" '
+    { node[c] = $1; cpu[c++] = $2 }
+    END {
+      for (i = 0; i < n; i++) {
+	lo = int(i * c / n)
+	hi = int((i + 1) * c / n)
+	if (hi <= lo)
+	  hi = lo + 1
+	set = cpu[lo]
+	for (j = lo + 1; j < hi; j++)
+	  if (node[j] == node[lo])
+	    set = set "," cpu[j]
+	print set
+      }
+    }'
+}
+
 # Process flags
-while getopts 'df:l:n:' o; do
+while getopts 'ac:df:l:n:' o; do
   case "$o" in
+    a)
+      affinity=1
+      ;;
+    c)
+      cpus="$OPTARG"
+      ;;
     d)
       DEBUG=1
       ;;
@@ -44,7 +144,7 @@ while getopts 'df:l:n:' o; do
       file="$OPTARG"
       nspec=X$nspec
       ;;
-    -l)
+    l)
       list=$(echo "$OPTARG" | sed 's/,/ /g')
       nspec=X$nspec
       ;;
@@ -67,13 +167,28 @@ if [ ! "$nspec" ] || expr $nspec : .. >/dev/null ; then
   usage
 fi
 
+if [ "$n" = auto ] ; then
+  n=$(available_cpus)
+  if [ "$cpus" ] ; then
+    # Only the specified CPUs that the affinity mask allows can be used
+    ncpus=$(expand_cpu_list "$cpus" | grep -Fxc -f <(allowed_cpus))
+    if [ "$ncpus" -eq 0 ] ; then
+      echo "dgsh-parallel: None of the CPUs $cpus is available" 1>&2
+      exit 2
+    fi
+    if [ "$ncpus" -lt "$n" ] ; then
+      n=$ncpus
+    fi
+  fi
+fi
+
 # Ensure generated script is always removed
 SCRIPT="${TMP:-/tmp}/dgsh-parallel-$$"
 
 if [ "$DEBUG" ] ; then
   echo "Script is $SCRIPT" 1>&2
 else
-  trap 'rm -rf "$SCRIPT"' 0
+  trap 'rm -rf "$SCRIPT" "$SCRIPT.cmd"' 0
   trap 'exit 2' 1 2 15
 fi
 
@@ -107,8 +222,28 @@ fi |
 sed 's/[&/\\]/\\&/g' |
 # Replace {} with the name of each node
 while IFS='' read -r node ; do
-  echo "  $@" | sed "s/{}/$node/"
-done >>$SCRIPT
+  echo "$@" | sed "s/{}/$node/"
+done >"$SCRIPT.cmd"
+
+if [ "$affinity" ] ; then
+  # Pin each replica, run as a plain pipeline, to its CPU set
+  if [ "$cpus" ] ; then
+    expand_cpu_list "$cpus"
+  else
+    allowed_cpus
+  fi |
+  cpu_nodes |
+  cpu_sets $(wc -l <"$SCRIPT.cmd") |
+  paste -d '\n' - "$SCRIPT.cmd" |
+  while IFS='' read -r cpuset && IFS='' read -r cmd ; do
+    # Quote the command as a single sh(1) argument
+    cmd=$(echo "$cmd" | sed "s/'/'\\\\''/g")
+    echo "  taskset -c $cpuset env -u DGSH_IN -u DGSH_OUT PATH='$WORK' sh -c '$cmd'"
+  done
+else
+  sed 's/^/  /' "$SCRIPT.cmd"
+fi >>$SCRIPT
+rm -f "$SCRIPT.cmd"
 
 cat >>$SCRIPT <<EOF
 }}
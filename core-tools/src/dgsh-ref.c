@@ -0,0 +1,487 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Output the sorted lines of a reference file, or look up lines in it,
+ * through a persistent index that is rebuilt only when the file changes
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dgsh.h"
+#include "dgsh-debug.h"
+#include "merge.h"
+
+#define INDEX_MAGIC "DGSHREF2"
+
+/* Nanoseconds of a file's modification time */
+#if __APPLE__
+#define MTIME_NSEC(sb) ((sb)->st_mtimespec.tv_nsec)
+#else
+#define MTIME_NSEC(sb) ((sb)->st_mtim.tv_nsec)
+#endif
+
+/*
+ * The index of a reference file, mapped into memory as a whole.
+ * It consists of this header, the file's lines sorted and terminated
+ * by a newline, the offsets of the sorted lines and of the data's end,
+ * and a hash table of line numbers plus one, zero for empty slots.
+ */
+struct index_header {
+	char magic[8];
+	/* Attributes of the file from which the index was built */
+	uint64_t src_dev, src_ino, src_size, src_mtime, src_mtime_nsec;
+	uint64_t nlines;
+	uint64_t data_off, data_len;
+	uint64_t offsets_off;
+	uint64_t table_off, table_size;	/* Size is a power of two */
+	uint64_t index_size;
+};
+
+/* A line of the reference file being indexed */
+struct line {
+	const char *p;
+	size_t len;
+};
+
+/* The mapped index */
+static const struct index_header *index_hdr;
+static const char *index_data;
+static const uint64_t *index_offsets, *index_table;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-l | -u | -v] [-c directory] file\n"
+			"-c directory\tKeep the index in directory\n"
+			"-l\t\tOutput the input lines that appear in file\n"
+			"-u\t\tOutput only the first of equal sorted lines\n"
+			"-v\t\tOutput the input lines that do not appear in file\n",
+			name);
+	exit(1);
+}
+
+/* Return a 64-bit hash of the specified bytes */
+static uint64_t
+hash(const char *p, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--)
+		h = (h ^ (unsigned char)*p++) * 0x100000001b3ULL;
+	return h ^ (h >> 32);
+}
+
+static int
+line_cmp(const void *a, const void *b)
+{
+	const struct line *la = a, *lb = b;
+
+	return merge_keycmp(la->p, la->len, lb->p, lb->len);
+}
+
+/* Return a newly allocated concatenation of the two strings */
+static char *
+concat(const char *a, const char *b)
+{
+	char *r;
+
+	if ((r = malloc(strlen(a) + strlen(b) + 1)) == NULL)
+		err(1, NULL);
+	strcpy(r, a);
+	strcat(r, b);
+	return r;
+}
+
+/* Create the specified directory and any missing parents */
+static void
+make_dirs(char *path)
+{
+	char *p;
+
+	for (p = path + 1; *p; p++)
+		if (*p == '/') {
+			*p = '\0';
+			mkdir(path, 0777);
+			*p = '/';
+		}
+	mkdir(path, 0777);
+}
+
+/*
+ * Return the directory where indices are kept, creating it if needed:
+ * the one specified, or $DGSH_CACHE_DIR, $XDG_CACHE_HOME/dgsh,
+ * $HOME/.cache/dgsh.  Return NULL if no directory is available.
+ */
+static char *
+cache_dir(const char *specified)
+{
+	const char *env;
+	char *dir = NULL;
+
+	if (specified)
+		dir = strdup(specified);
+	else if ((env = getenv("DGSH_CACHE_DIR")) != NULL && *env)
+		dir = strdup(env);
+	else if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env)
+		dir = concat(env, "/dgsh");
+	else if ((env = getenv("HOME")) != NULL && *env)
+		dir = concat(env, "/.cache/dgsh");
+	if (dir == NULL)
+		return NULL;
+	make_dirs(dir);
+	if (access(dir, W_OK | X_OK) == -1) {
+		DPRINTF(2, "Cache directory %s is not usable", dir);
+		free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
+/* Return the path of the index of the file with the specified name */
+static char *
+index_path(const char *dir, const char *fname)
+{
+	char real[PATH_MAX];
+	const char *base;
+	char *path;
+	size_t len;
+
+	/* Name the index after the file's absolute path */
+	if (realpath(fname, real) == NULL)
+		err(2, "%s", fname);
+	base = strrchr(real, '/') + 1;
+	len = strlen(dir) + strlen(base) + 24;
+	if ((path = malloc(len)) == NULL)
+		err(1, NULL);
+	snprintf(path, len, "%s/%s.%016llx.ref", dir, base,
+			(unsigned long long)hash(real, strlen(real)));
+	return path;
+}
+
+/* Return true if the index was built from a file with the attributes sb */
+static bool
+index_valid(const struct index_header *h, size_t size, const struct stat *sb)
+{
+	return size >= sizeof(*h) &&
+		memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) == 0 &&
+		h->index_size == size &&
+		h->src_dev == (uint64_t)sb->st_dev &&
+		h->src_ino == (uint64_t)sb->st_ino &&
+		h->src_size == (uint64_t)sb->st_size &&
+		h->src_mtime == (uint64_t)sb->st_mtime &&
+		h->src_mtime_nsec == (uint64_t)MTIME_NSEC(sb);
+}
+
+/* Write the specified data to fd */
+static void
+write_all(int fd, const void *data, size_t len, const char *name)
+{
+	const char *p = data;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, p, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(2, "Error writing to %s", name);
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+/* Return 8-byte aligned offset corresponding to off */
+static uint64_t
+align(uint64_t off)
+{
+	return (off + 7) & ~(uint64_t)7;
+}
+
+/*
+ * Write to fd the index of the file src, open as srcfd,
+ * with the attributes sb.
+ */
+static void
+index_build(int fd, const char *name, const char *src, int srcfd,
+		const struct stat *sb)
+{
+	static const char zeros[8];
+	struct index_header h;
+	struct line *lines = NULL;
+	uint64_t *offsets, *table, off, slot;
+	size_t nlines = 0, lines_size = 0, i;
+	const char *text, *p, *end, *nl;
+	FILE *f;
+
+	DPRINTF(2, "Building index %s of %s", name, src);
+	text = "";
+	if (sb->st_size > 0 && (text = mmap(NULL, sb->st_size, PROT_READ,
+					MAP_PRIVATE, srcfd, 0)) == MAP_FAILED)
+		err(2, "mmap %s", src);
+	for (p = text, end = text + sb->st_size; p < end; p = nl + 1) {
+		if ((nl = memchr(p, '\n', end - p)) == NULL)
+			nl = end;
+		if (nlines == lines_size) {
+			lines_size = lines_size ? lines_size * 2 : 1024;
+			if ((lines = realloc(lines, lines_size *
+							sizeof(*lines))) == NULL)
+				err(1, NULL);
+		}
+		lines[nlines].p = p;
+		lines[nlines].len = nl - p;
+		nlines++;
+	}
+	qsort(lines, nlines, sizeof(*lines), line_cmp);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+	h.src_dev = sb->st_dev;
+	h.src_ino = sb->st_ino;
+	h.src_size = sb->st_size;
+	h.src_mtime = sb->st_mtime;
+	h.src_mtime_nsec = MTIME_NSEC(sb);
+	h.nlines = nlines;
+	h.data_off = sizeof(h);
+	for (i = 0; i < nlines; i++)
+		h.data_len += lines[i].len + 1;
+	h.offsets_off = align(h.data_off + h.data_len);
+	h.table_off = h.offsets_off + (nlines + 1) * sizeof(*offsets);
+	/* Keep the load factor at most 1/2 */
+	for (h.table_size = 16; h.table_size < 2 * nlines; h.table_size *= 2)
+		;
+	h.index_size = h.table_off + h.table_size * sizeof(*table);
+
+	if ((offsets = malloc((nlines + 1) * sizeof(*offsets))) == NULL ||
+			(table = calloc(h.table_size, sizeof(*table))) == NULL)
+		err(1, NULL);
+	for (i = 0, off = 0; i < nlines; i++) {
+		offsets[i] = off;
+		off += lines[i].len + 1;
+		/* Equal lines are found through the first one */
+		if (i > 0 && line_cmp(&lines[i], &lines[i - 1]) == 0)
+			continue;
+		for (slot = hash(lines[i].p, lines[i].len) &
+				(h.table_size - 1); table[slot];
+				slot = (slot + 1) & (h.table_size - 1))
+			;
+		table[slot] = i + 1;
+	}
+	offsets[nlines] = off;
+
+	if ((f = fdopen(dup(fd), "w")) == NULL)
+		err(1, "fdopen");
+	setvbuf(f, NULL, _IOFBF, 256 * 1024);
+	fwrite(&h, sizeof(h), 1, f);
+	for (i = 0; i < nlines; i++) {
+		fwrite(lines[i].p, 1, lines[i].len, f);
+		putc('\n', f);
+	}
+	fwrite(zeros, 1, h.offsets_off - h.data_off - h.data_len, f);
+	fwrite(offsets, sizeof(*offsets), nlines + 1, f);
+	fwrite(table, sizeof(*table), h.table_size, f);
+	if (fclose(f) != 0)
+		err(2, "Error writing to %s", name);
+
+	free(lines);
+	free(offsets);
+	free(table);
+	if (sb->st_size > 0)
+		munmap((void *)text, sb->st_size);
+}
+
+/* Map into memory the index of the specified file, building it if needed */
+static void
+index_open(const char *fname, const char *specified_dir)
+{
+	struct stat sb, isb;
+	char *dir, *path = NULL, *tmp;
+	void *map;
+	int srcfd, fd = -1;
+
+	if ((srcfd = open(fname, O_RDONLY)) == -1)
+		err(2, "Error opening %s", fname);
+	if (fstat(srcfd, &sb) == -1)
+		err(2, "%s", fname);
+
+	if ((dir = cache_dir(specified_dir)) != NULL) {
+		path = index_path(dir, fname);
+		if ((fd = open(path, O_RDONLY)) != -1) {
+			if (fstat(fd, &isb) == -1)
+				err(2, "%s", path);
+			map = isb.st_size ? mmap(NULL, isb.st_size, PROT_READ,
+					MAP_SHARED, fd, 0) : MAP_FAILED;
+			if (map != MAP_FAILED && index_valid(map,
+						isb.st_size, &sb)) {
+				DPRINTF(2, "Using index %s", path);
+				goto mapped;
+			}
+			if (map != MAP_FAILED)
+				munmap(map, isb.st_size);
+			close(fd);
+		}
+
+		/* Build anew and atomically replace any stale index */
+		tmp = concat(path, ".XXXXXX");
+		if ((fd = mkstemp(tmp)) == -1)
+			err(2, "Unable to create temporary file %s", tmp);
+		index_build(fd, tmp, fname, srcfd, &sb);
+		if (fchmod(fd, 0644) == -1 || rename(tmp, path) == -1) {
+			warn("Unable to save index %s", path);
+			unlink(tmp);
+		}
+		free(tmp);
+	} else {
+		/* Without a place to keep it, the index serves only this run */
+		fd = merge_temp_file(NULL);
+		index_build(fd, "temporary index", fname, srcfd, &sb);
+	}
+	if (fstat(fd, &isb) == -1)
+		err(2, "fstat");
+	if ((map = mmap(NULL, isb.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+			MAP_FAILED)
+		err(2, "mmap");
+
+mapped:
+	close(fd);
+	close(srcfd);
+	free(dir);
+	free(path);
+	index_hdr = map;
+	index_data = (const char *)map + index_hdr->data_off;
+	index_offsets = (const uint64_t *)((const char *)map +
+			index_hdr->offsets_off);
+	index_table = (const uint64_t *)((const char *)map +
+			index_hdr->table_off);
+}
+
+/* Return true if the specified line appears in the reference file */
+static bool
+index_contains(const char *p, size_t len)
+{
+	uint64_t mask = index_hdr->table_size - 1;
+	uint64_t slot, i;
+
+	for (slot = hash(p, len) & mask; (i = index_table[slot]) != 0;
+			slot = (slot + 1) & mask) {
+		i--;
+		if (index_offsets[i + 1] - index_offsets[i] - 1 == len &&
+				memcmp(index_data + index_offsets[i], p, len) == 0)
+			return true;
+	}
+	return false;
+}
+
+/* Output the sorted lines of the reference file */
+static void
+output_sorted(bool unique)
+{
+	const char *prev = NULL, *p;
+	size_t prevlen = 0, len;
+	uint64_t i;
+
+	if (!unique) {
+		write_all(STDOUT_FILENO, index_data, index_hdr->data_len,
+				"stdout");
+		return;
+	}
+	for (i = 0; i < index_hdr->nlines; i++) {
+		p = index_data + index_offsets[i];
+		len = index_offsets[i + 1] - index_offsets[i] - 1;
+		if (prev && merge_keycmp(p, len, prev, prevlen) == 0)
+			continue;
+		fwrite(p, 1, len + 1, stdout);
+		prev = p;
+		prevlen = len;
+	}
+}
+
+/* Output the input lines that appear, or not, in the reference file */
+static void
+output_lookup(int fd, bool present)
+{
+	struct merge_input in;
+
+	merge_input_init(&in, fd, "stdin");
+	while (merge_read_record(&in, NULL)) {
+		if (index_contains(in.line, in.linelen) != present)
+			continue;
+		fwrite(in.line, 1, in.linelen, stdout);
+		putchar('\n');
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n_input_fds, n_output_fds = 1;
+	int *input_fds = NULL;
+	bool lookup = false, present = true, unique = false;
+	const char *dir = NULL;
+	const char *progname = argv[0];
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:luv")) != -1) {
+		switch (ch) {
+		case 'c':
+			dir = optarg;
+			break;
+		case 'l':
+			lookup = true;
+			break;
+		case 'u':
+			unique = true;
+			break;
+		case 'v':
+			lookup = true;
+			present = false;
+			break;
+		case '?':
+		default:
+			usage(progname);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || (lookup && unique))
+		usage(progname);
+
+	n_input_fds = lookup ? 1 : 0;
+	dgsh_negotiate(DGSH_HANDLE_ERROR, "dgsh-ref", &n_input_fds,
+			&n_output_fds, &input_fds, NULL);
+
+	index_open(argv[0], dir);
+
+	setvbuf(stdout, NULL, _IOFBF, 256 * 1024);
+	if (lookup)
+		output_lookup(input_fds[0], present);
+	else
+		output_sorted(unique);
+	if (fflush(stdout) != 0)
+		err(3, "Error writing to stdout");
+	return 0;
+}
@@ -0,0 +1,908 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Sort the lines of multiple inputs in parallel, writing the result
+ * to one or more range-partitioned outputs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dgsh.h"
+#include "dgsh-debug.h"
+#include "merge.h"
+
+/* Maximum size of the blocks from which line storage is allocated */
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+/* Number of runs that are merged into one to limit the open files */
+#define MAX_RUNS 64
+
+/* Sorted ranges at most this long are sorted by insertion */
+#define INSERTION_SORT_SIZE 16
+
+/* Minimum number of lines sorted by each process */
+#define MIN_JOB_LINES (64 * 1024)
+
+/* Number of lines sampled for each output to choose the partitions */
+#define SAMPLES_PER_OUTPUT 1024
+
+/* A line to sort; its storage does not include the newline */
+struct line {
+	const char *p;
+	size_t len;
+};
+
+/* A line sampled from a sorted run and its position in the run */
+struct run_sample {
+	struct line l;
+	off_t offset;
+};
+
+/*
+ * A sorted run written to a temporary file, with a sample of its
+ * lines taken at regular intervals.  The sample allows choosing
+ * the lines that divide all runs among the outputs, and starting to
+ * read each run close to the lines that belong to an output.
+ */
+struct run {
+	int fd;
+	size_t nlines;		/* Lines written to the run */
+	size_t step;		/* One every step lines is sampled */
+	struct run_sample *sample;
+	size_t nsample;
+};
+
+/* An output channel or temporary file and the data pending for it */
+struct output {
+	int fd;
+	const char *name;
+	char *buf;
+	size_t len;
+	bool closed;		/* True if its reader has exited */
+	off_t pos;		/* Bytes output */
+	struct run *run;	/* Run being written, if any */
+};
+
+/* A block of line storage */
+struct arena_block {
+	struct arena_block *next;
+	char data[];
+};
+
+/*
+ * Lines read and not yet written to a run.  The array is shared
+ * with the processes that sort its parts in parallel.
+ */
+static struct line *lines;
+static size_t nlines, lines_size;
+
+/* After sorting, the lines consist of njobs sorted chunks */
+static size_t *chunk_start;
+static int nchunks;
+
+/* Line storage */
+static struct arena_block *arena;
+static char *arena_free;
+static size_t arena_left;
+static size_t arena_block_size = ARENA_BLOCK_SIZE;
+
+/* Memory occupied by the lines */
+static size_t mem_used;
+
+/* When exceeded, the lines are written out as sorted runs */
+static unsigned long max_mem = 256 * 1024 * 1024;
+static char *opt_tmp_dir = NULL;
+
+/* Number of processes sorting the lines */
+static int njobs;
+
+/* True to output only the first of equal lines */
+static bool unique;
+
+static struct output *outputs;
+static int noutputs;
+
+/*
+ * The first line of each output after the first one.
+ * Lines equal to an output's first line belong to that output,
+ * so that equal lines are always written to the same output.
+ */
+static struct line *splitters;
+static int nsplitters;
+
+/* Sorted runs of lines written to temporary files */
+static struct run *runs;
+static int nruns;
+static bool spilled;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-u] [-j jobs] [-m size] [-T directory] "
+			"[-o file] ... [file ...]\n"
+			"-j jobs\t\tSort the lines through up to jobs processes\n"
+			"-m size\t\tWrite sorted runs to temporary files above "
+			"size memory\n"
+			"-o file\t\tWrite the next output to file\n"
+			"-T directory\tCreate temporary files in directory\n"
+			"-u\t\tOutput only the first of equal lines\n", name);
+	exit(1);
+}
+
+/* Parse the specified option as a size with a suffix and return its value. */
+static unsigned long
+parse_size(const char *progname, const char *opt)
+{
+	char size;
+	unsigned long n;
+
+	size = 'b';
+	if (sscanf(opt, "%lu%c", &n, &size) < 1)
+		usage(progname);
+	switch (size) {
+	case 'B' : case 'b':
+		return n;
+	case 'K' : case 'k':
+		return n * 1024;
+	case 'M' : case 'm':
+		return n * 1024 * 1024;
+	case 'G' : case 'g':
+		return n * 1024 * 1024 * 1024;
+	default:
+		fprintf(stderr, "Unknown size suffix: %c\n", size);
+		usage(progname);
+	}
+	/* NOTREACHED */
+	return 0;
+}
+
+/* Return a copy of the specified line allocated from the arena */
+static const char *
+arena_copy(const char *p, size_t len)
+{
+	struct arena_block *b;
+	size_t size;
+	char *r;
+
+	if (len > arena_left) {
+		size = len > arena_block_size ? len : arena_block_size;
+		if ((b = malloc(sizeof(*b) + size)) == NULL)
+			err(1, NULL);
+		b->next = arena;
+		arena = b;
+		arena_free = b->data;
+		arena_left = size;
+		mem_used += sizeof(*b) + size;
+	}
+	r = arena_free;
+	memcpy(r, p, len);
+	arena_free += len;
+	arena_left -= len;
+	return r;
+}
+
+/* Add the specified line to the lines to sort */
+static void
+lines_add(const char *p, size_t len)
+{
+	struct line *old = lines;
+	size_t old_size = lines_size;
+
+	if (nlines == lines_size) {
+		/* Allocate anew; shared mappings cannot be reallocated */
+		lines_size = lines_size ? lines_size * 2 : 1024;
+		lines = mmap(NULL, lines_size * sizeof(*lines),
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON,
+				-1, 0);
+		if (lines == MAP_FAILED)
+			err(1, "mmap");
+		if (old) {
+			memcpy(lines, old, nlines * sizeof(*lines));
+			munmap(old, old_size * sizeof(*lines));
+		}
+		mem_used += (lines_size - old_size) * sizeof(*lines);
+	}
+	lines[nlines].p = len ? arena_copy(p, len) : "";
+	lines[nlines].len = len;
+	nlines++;
+}
+
+/* Remove all lines, releasing their storage */
+static void
+lines_clear(void)
+{
+	struct arena_block *b;
+
+	while ((b = arena) != NULL) {
+		arena = b->next;
+		free(b);
+	}
+	arena_free = NULL;
+	arena_left = 0;
+	if (lines)
+		munmap(lines, lines_size * sizeof(*lines));
+	lines = NULL;
+	nlines = lines_size = 0;
+	mem_used = 0;
+}
+
+static inline int
+line_cmp(const struct line *a, const struct line *b)
+{
+	return merge_keycmp(a->p, a->len, b->p, b->len);
+}
+
+/* Return the byte at depth of the line plus one, or 0 past its end */
+static inline int
+byte_at(const struct line *l, size_t depth)
+{
+	return depth < l->len ? (unsigned char)l->p[depth] + 1 : 0;
+}
+
+/* Sort the n lines, whose first depth bytes are equal, by insertion */
+static void
+insertion_sort(struct line *a, size_t n, size_t depth)
+{
+	struct line t;
+	size_t i, j;
+
+	for (i = 1; i < n; i++) {
+		t = a[i];
+		for (j = i; j > 0 && merge_keycmp(t.p + depth, t.len - depth,
+					a[j - 1].p + depth,
+					a[j - 1].len - depth) < 0; j--)
+			a[j] = a[j - 1];
+		a[j] = t;
+	}
+}
+
+/*
+ * Sort the n lines, whose first depth bytes are equal, through
+ * a most significant digit radix sort, using tmp as scratch space.
+ * The largest bucket is sorted iteratively, limiting the
+ * recursion depth to the logarithm of n.
+ */
+static void
+radix_sort(struct line *a, size_t n, size_t depth, struct line *tmp)
+{
+	size_t count[257], start[257];
+	size_t i, largest;
+	int b;
+
+	while (n > INSERTION_SORT_SIZE) {
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < n; i++)
+			count[byte_at(&a[i], depth)]++;
+		/* Lines that have ended are equal; bucket 0 stays as is */
+		if (count[0] == n)
+			return;
+		largest = 1;
+		start[0] = 0;
+		for (b = 1; b < 257; b++) {
+			start[b] = start[b - 1] + count[b - 1];
+			if (count[b] > count[largest])
+				largest = b;
+		}
+		for (i = 0; i < n; i++)
+			tmp[start[byte_at(&a[i], depth)]++] = a[i];
+		memcpy(a, tmp, n * sizeof(*a));
+		/* Now start[b] is the end of bucket b */
+		for (b = 1; b < 257; b++)
+			if ((size_t)b != largest && count[b] > 1)
+				radix_sort(a + start[b] - count[b], count[b],
+						depth + 1, tmp);
+		a += start[largest] - count[largest];
+		n = count[largest];
+		depth++;
+	}
+	insertion_sort(a, n, depth);
+}
+
+/*
+ * Sort the lines, dividing them into chunks that are sorted
+ * in parallel by separate processes.
+ */
+static void
+sort_lines(void)
+{
+	struct line *tmp;
+	pid_t *pids;
+	size_t lo, hi;
+	int i, status, jobs;
+
+	jobs = nlines / MIN_JOB_LINES;
+	if (jobs > njobs)
+		jobs = njobs;
+	if (jobs < 1)
+		jobs = 1;
+	if ((chunk_start = realloc(chunk_start,
+			(jobs + 1) * sizeof(*chunk_start))) == NULL)
+		err(1, NULL);
+	for (i = 0; i <= jobs; i++)
+		chunk_start[i] = nlines * i / jobs;
+	nchunks = jobs;
+
+	if (jobs == 1) {
+		if ((tmp = malloc(nlines * sizeof(*tmp) + 1)) == NULL)
+			err(1, NULL);
+		radix_sort(lines, nlines, 0, tmp);
+		free(tmp);
+		return;
+	}
+
+	if ((pids = malloc(jobs * sizeof(*pids))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < jobs; i++) {
+		lo = chunk_start[i];
+		hi = chunk_start[i + 1];
+		switch (pids[i] = fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			if ((tmp = malloc((hi - lo) * sizeof(*tmp))) == NULL)
+				err(1, NULL);
+			radix_sort(lines + lo, hi - lo, 0, tmp);
+			exit(0);
+		default:
+			DPRINTF(2, "Process %d sorts lines %zu-%zu",
+					(int)pids[i], lo, hi - 1);
+		}
+	}
+	for (i = 0; i < jobs; i++) {
+		while (waitpid(pids[i], &status, 0) == -1)
+			if (errno != EINTR)
+				err(1, "waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			errx(1, "Sorting process %d failed", (int)pids[i]);
+	}
+	free(pids);
+}
+
+static int
+qsort_line_cmp(const void *a, const void *b)
+{
+	return line_cmp(a, b);
+}
+
+/* Set output p's splitter to a copy of the specified line */
+static void
+set_splitter(int p, const struct line *l)
+{
+	char *copy;
+
+	if ((copy = malloc(l->len + 1)) == NULL)
+		err(1, NULL);
+	memcpy(copy, l->p, l->len);
+	splitters[p - 1].p = copy;
+	splitters[p - 1].len = l->len;
+}
+
+/*
+ * Choose the lines that divide the sorted lines among the outputs
+ * from a sample of them.
+ */
+static void
+choose_splitters(void)
+{
+	struct line *sample;
+	size_t nsample, step, j;
+	int c, p;
+
+	if (noutputs == 1 || nlines == 0)
+		return;
+	if ((sample = malloc((SAMPLES_PER_OUTPUT * noutputs + nchunks) *
+					sizeof(*sample))) == NULL)
+		err(1, NULL);
+	step = nlines / (SAMPLES_PER_OUTPUT * noutputs) + 1;
+	nsample = 0;
+	for (c = 0; c < nchunks; c++)
+		for (j = chunk_start[c]; j < chunk_start[c + 1]; j += step)
+			sample[nsample++] = lines[j];
+	if (nchunks > 1)
+		qsort(sample, nsample, sizeof(*sample), qsort_line_cmp);
+
+	if ((splitters = malloc((noutputs - 1) * sizeof(*splitters))) == NULL)
+		err(1, NULL);
+	for (p = 1; p < noutputs; p++)
+		set_splitter(p, &sample[nsample * p / noutputs]);
+	nsplitters = noutputs - 1;
+	free(sample);
+}
+
+static int
+qsort_run_sample_cmp(const void *a, const void *b)
+{
+	const struct run_sample *sa = a, *sb = b;
+
+	return line_cmp(&sa->l, &sb->l);
+}
+
+/*
+ * Choose the lines that divide the lines of all runs among the outputs
+ * from the runs' samples.  Each sampled line stands for step lines of
+ * its run, so that runs of different sizes are weighted appropriately.
+ * The sample's offset field is used to hold the weight.
+ */
+static void
+choose_run_splitters(void)
+{
+	struct run_sample *sample;
+	size_t nsample = 0, total = 0, sum, j;
+	int r, p;
+
+	if (noutputs == 1)
+		return;
+	for (r = 0; r < nruns; r++) {
+		nsample += runs[r].nsample;
+		total += runs[r].nlines;
+	}
+	if (nsample == 0)
+		return;
+	if ((sample = malloc(nsample * sizeof(*sample))) == NULL)
+		err(1, NULL);
+	nsample = 0;
+	for (r = 0; r < nruns; r++)
+		for (j = 0; j < runs[r].nsample; j++) {
+			sample[nsample].l = runs[r].sample[j].l;
+			sample[nsample++].offset = runs[r].step;
+		}
+	qsort(sample, nsample, sizeof(*sample), qsort_run_sample_cmp);
+
+	if ((splitters = malloc((noutputs - 1) * sizeof(*splitters))) == NULL)
+		err(1, NULL);
+	for (p = 1, j = 0, sum = 0; p < noutputs; p++) {
+		while (j < nsample - 1 && sum + sample[j].offset <=
+				total * p / noutputs)
+			sum += sample[j++].offset;
+		set_splitter(p, &sample[j].l);
+	}
+	nsplitters = noutputs - 1;
+	free(sample);
+}
+
+/* Return the position of the first of the n lines not less than l */
+static size_t
+lower_bound(const struct line *a, size_t n, const struct line *l)
+{
+	size_t lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (line_cmp(&a[mid], l) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Write the specified data directly to the output's file descriptor */
+static void
+output_write_fd(struct output *o, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0 && !o->closed) {
+		if ((n = write(o->fd, data, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EPIPE)
+				err(2, "Error writing to %s", o->name);
+			/* The reader terminated early; stop serving it. */
+			o->closed = true;
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+/* Write out the data pending for the output */
+static void
+output_flush(struct output *o)
+{
+	output_write_fd(o, o->buf, o->len);
+	o->len = 0;
+}
+
+/* Add the line at offset to its run's sample */
+static void
+run_sample_add(struct run *r, const char *p, size_t len, off_t offset)
+{
+	struct run_sample *s;
+	char *copy;
+
+	if ((copy = malloc(len + 1)) == NULL)
+		err(1, NULL);
+	memcpy(copy, p, len);
+	s = &r->sample[r->nsample++];
+	s->l.p = copy;
+	s->l.len = len;
+	s->offset = offset;
+}
+
+/* Buffer the specified line and a newline for writing to the output */
+static inline void
+output_line(struct output *o, const char *p, size_t len)
+{
+	if (o->run && o->run->nlines++ % o->run->step == 0)
+		run_sample_add(o->run, p, len, o->pos);
+	o->pos += len + 1;
+	if (o->len + len + 1 > OUTPUT_BUFFER_SIZE) {
+		output_flush(o);
+		if (len + 1 > OUTPUT_BUFFER_SIZE) {
+			output_write_fd(o, p, len);
+			output_write_fd(o, "\n", 1);
+			return;
+		}
+	}
+	memcpy(o->buf + o->len, p, len);
+	o->buf[o->len + len] = '\n';
+	o->len += len + 1;
+}
+
+/* Initialize the specified output to write to fd */
+static void
+output_init(struct output *o, int fd, const char *name)
+{
+	o->fd = fd;
+	o->name = name;
+	o->len = 0;
+	o->closed = false;
+	o->pos = 0;
+	o->run = NULL;
+	if ((o->buf = malloc(OUTPUT_BUFFER_SIZE)) == NULL)
+		err(1, NULL);
+}
+
+/*
+ * Write to o the sorted lines that belong to output p, merging
+ * the sorted chunks.
+ */
+static void
+write_lines(struct output *o, int p)
+{
+	struct line *cur[nchunks], *end[nchunks], *min;
+	const struct line *prev = NULL;
+	size_t n;
+	int c, m;
+
+	if (nlines == 0)
+		return;
+	for (c = 0; c < nchunks; c++) {
+		cur[c] = lines + chunk_start[c];
+		n = chunk_start[c + 1] - chunk_start[c];
+		end[c] = cur[c] + n;
+		if (p > 0)
+			cur[c] += lower_bound(cur[c], n, &splitters[p - 1]);
+		if (p < nsplitters)
+			end[c] = lines + chunk_start[c] +
+				lower_bound(lines + chunk_start[c], n,
+						&splitters[p]);
+	}
+
+	while (!o->closed) {
+		m = -1;
+		for (c = 0; c < nchunks; c++)
+			if (cur[c] < end[c] && (m == -1 ||
+					line_cmp(cur[c], cur[m]) < 0))
+				m = c;
+		if (m == -1)
+			break;
+		min = cur[m]++;
+		if (unique && prev && line_cmp(min, prev) == 0)
+			continue;
+		output_line(o, min->p, min->len);
+		prev = min;
+	}
+}
+
+static void merge_runs(void);
+
+/*
+ * Initialize o to write a new run of the specified number of lines
+ * to a temporary file.
+ */
+static void
+run_begin(struct output *o, size_t nlines)
+{
+	struct run *r;
+
+	if ((runs = realloc(runs, (nruns + 1) * sizeof(*runs))) == NULL)
+		err(1, NULL);
+	r = &runs[nruns];
+	r->fd = merge_temp_file(opt_tmp_dir);
+	r->nlines = 0;
+	r->step = nlines / (SAMPLES_PER_OUTPUT * noutputs) + 1;
+	if ((r->sample = malloc((nlines / r->step + 1) *
+					sizeof(*r->sample))) == NULL)
+		err(1, NULL);
+	r->nsample = 0;
+	output_init(o, r->fd, "temporary file");
+	o->run = r;
+}
+
+/* Complete the writing of the run begun through o and add it */
+static void
+run_end(struct output *o)
+{
+	output_flush(o);
+	free(o->buf);
+	nruns++;
+	if (nruns == MAX_RUNS)
+		merge_runs();
+}
+
+/* Release the resources of the specified run */
+static void
+run_free(struct run *r)
+{
+	size_t i;
+
+	close(r->fd);
+	for (i = 0; i < r->nsample; i++)
+		free((char *)r->sample[i].l.p);
+	free(r->sample);
+}
+
+/* Sort the lines, write them as a run, and clear them */
+static void
+spill(void)
+{
+	struct output o;
+
+	sort_lines();
+	DPRINTF(2, "Writing run of %zu lines", nlines);
+	run_begin(&o, nlines);
+	write_lines(&o, 0);
+	run_end(&o);
+	lines_clear();
+	spilled = true;
+}
+
+/*
+ * Return the offset of the runs's last sampled line that is less than l,
+ * from which the run's lines not less than l can be read.
+ */
+static off_t
+run_seek(const struct run *r, const struct line *l)
+{
+	size_t lo = 0, hi = r->nsample, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (line_cmp(&r->sample[mid].l, l) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo == 0 ? 0 : r->sample[lo - 1].offset;
+}
+
+/*
+ * Write to o the lines of all runs that belong to output p, merging them.
+ * Output -1 stands for all lines.
+ * Runs are read through their own offsets, so that the processes
+ * writing the outputs can read them concurrently.
+ */
+static void
+write_runs(struct output *o, int p)
+{
+	struct merge_input *inputs;
+	struct merge_heap h;
+	struct merge_input *top;
+	struct line l;
+	const struct line *lower, *upper;
+	bool more, first = true;
+	int i;
+
+	lower = p > 0 ? &splitters[p - 1] : NULL;
+	upper = p >= 0 && p < nsplitters ? &splitters[p] : NULL;
+	if ((inputs = malloc(nruns * sizeof(*inputs))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < nruns; i++)
+		merge_input_init_at(&inputs[i], runs[i].fd, "temporary file",
+				lower ? run_seek(&runs[i], lower) : 0);
+	merge_heap_init(&h, inputs, nruns, NULL);
+	more = h.n > 0;
+	while (more && !o->closed) {
+		top = h.heap[0];
+		l.p = top->line;
+		l.len = top->linelen;
+		/* The merged lines are sorted, so the remaining ones follow */
+		if (upper && line_cmp(&l, upper) >= 0)
+			break;
+		if ((!lower || line_cmp(&l, lower) >= 0) &&
+				(!unique || first ||
+				 merge_keycmp(top->line, top->linelen,
+					 h.prev, h.prevlen) != 0)) {
+			output_line(o, top->line, top->linelen);
+			first = false;
+		}
+		more = merge_heap_advance(&h);
+	}
+	merge_heap_free(&h);
+	for (i = 0; i < nruns; i++)
+		free(inputs[i].buf);
+	free(inputs);
+}
+
+/* Merge the sorted runs into a single one */
+static void
+merge_runs(void)
+{
+	struct output o;
+	size_t total = 0;
+	int i, n = nruns;
+
+	DPRINTF(2, "Merging %d runs", nruns);
+	for (i = 0; i < n; i++)
+		total += runs[i].nlines;
+	run_begin(&o, total);
+	write_runs(&o, -1);
+	for (i = 0; i < n; i++)
+		run_free(&runs[i]);
+	runs[0] = runs[n];
+	nruns = 0;
+	run_end(&o);
+}
+
+/* Write the sorted lines of output p */
+static void
+write_output(int p)
+{
+	if (spilled)
+		write_runs(&outputs[p], p);
+	else
+		write_lines(&outputs[p], p);
+	output_flush(&outputs[p]);
+	close(outputs[p].fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct merge_input *inputs, *in;
+	int ninputs, n_output_fds;
+	int *output_fds = NULL;
+	const char **ofiles = NULL;
+	int nofiles = 0;
+	pid_t *pids;
+	int ch, fd, i, p, status, ret = 0;
+	long ncpu;
+
+	while ((ch = getopt(argc, argv, "j:m:o:T:u")) != -1) {
+		switch (ch) {
+		case 'j':
+			if ((njobs = atoi(optarg)) < 1)
+				usage(argv[0]);
+			break;
+		case 'm':
+			max_mem = parse_size(argv[0], optarg);
+			break;
+		case 'o':
+			if ((ofiles = realloc(ofiles, (nofiles + 1) *
+							sizeof(*ofiles))) == NULL)
+				err(1, NULL);
+			ofiles[nofiles++] = optarg;
+			break;
+		case 'T':
+			opt_tmp_dir = optarg;
+			break;
+		case 'u':
+			unique = true;
+			break;
+		case '?':
+		default:
+			usage(argv[0]);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	/* By default sort in parallel, up to the number of CPUs */
+	if (njobs == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		njobs = ncpu > 0 ? (int)ncpu : 1;
+	}
+
+	/* Allow the lines to use a reasonable part of a small memory limit */
+	if (max_mem && max_mem / 16 < arena_block_size)
+		arena_block_size = max_mem / 16 + 1;
+
+	/* Write to the specified files or to any number of channels */
+	n_output_fds = nofiles ? 0 : -1;
+	inputs = merge_open_channels("dgsh-sort", argc, argv, &ninputs,
+			&n_output_fds, nofiles ? NULL : &output_fds);
+	noutputs = nofiles ? nofiles : n_output_fds;
+	if (noutputs < 1)
+		errx(1, "No output channels");
+	if ((outputs = malloc(noutputs * sizeof(*outputs))) == NULL)
+		err(1, NULL);
+	for (p = 0; p < noutputs; p++)
+		if (nofiles) {
+			if ((fd = open(ofiles[p], O_WRONLY | O_CREAT | O_TRUNC,
+							0666)) == -1)
+				err(2, "Error opening %s", ofiles[p]);
+			output_init(&outputs[p], fd, ofiles[p]);
+		} else
+			output_init(&outputs[p], output_fds[p],
+					p == 0 ? "stdout" : "output channel");
+	/* We will handle SIGPIPE explicitly when calling write(2). */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (in = inputs; in < inputs + ninputs; in++) {
+		while (merge_read_record(in, NULL)) {
+			lines_add(in->line, in->linelen);
+			if (max_mem && mem_used > max_mem)
+				spill();
+		}
+		close(in->fd);
+		free(in->buf);
+	}
+
+	if (spilled) {
+		if (nlines)
+			spill();
+		choose_run_splitters();
+	} else {
+		sort_lines();
+		choose_splitters();
+	}
+
+	/* Write each output through a separate process */
+	if ((pids = malloc(noutputs * sizeof(*pids))) == NULL)
+		err(1, NULL);
+	for (p = 1; p < noutputs; p++)
+		switch (pids[p] = fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			/* Let the other outputs' readers see their end */
+			for (i = 0; i < noutputs; i++)
+				if (i != p)
+					close(outputs[i].fd);
+			write_output(p);
+			exit(0);
+		default:
+			DPRINTF(2, "Process %d writes output %d",
+					(int)pids[p], p);
+			close(outputs[p].fd);
+		}
+	write_output(0);
+
+	for (p = 1; p < noutputs; p++) {
+		while (waitpid(pids[p], &status, 0) == -1)
+			if (errno != EINTR)
+				err(1, "waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			ret = 1;
+	}
+	return ret;
+}
@@ -16,17 +16,20 @@
  */
 
 #ifdef __linux__
-#define _XOPEN_SOURCE 500	// pread pwrite
+#define _XOPEN_SOURCE 600	// pread pwrite pselect
 #endif
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/select.h>
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -121,6 +124,45 @@ struct io_buffer {
 /* Maximum amount of memory to allocate. (Set through -S) */
 static unsigned long max_mem = 256 * 1024 * 1204;
 
+/* Maximum number of dgsh-tee instances sharing a graph's memory budget */
+#define GOVERNOR_SLOTS 1024
+
+/*
+ * Memory accounting shared by all dgsh-tee instances of a graph.
+ * It lives in a shared memory segment named after the graph's
+ * identifier, and is only used when DGSH_MEMORY specifies a budget.
+ * Each attached instance records in a slot the memory it has borrowed,
+ * so that it can be returned when the instance exits, even abnormally.
+ * An instance holds a record lock on its slot while it is attached;
+ * as the system releases the locks of exiting processes, an unlocked
+ * slot marked as used belongs to an instance that did not detach.
+ * Attaching and detaching is serialized through a lock on the
+ * segment's first byte.
+ */
+struct memory_governor {
+	atomic_ulong budget;	/* Memory all instances may allocate */
+	atomic_ulong used;	/* Memory allocated by all instances */
+	atomic_int users;	/* Instances attached to the segment */
+	struct governor_slot {
+		atomic_int pid;		/* Attached instance; 0 if free */
+		atomic_ulong borrowed;	/* Memory it has allocated */
+	} slot[GOVERNOR_SLOTS];
+};
+
+static struct memory_governor *governor;
+static struct governor_slot *governor_slot;
+static char governor_name[64];
+static int governor_fd = -1;
+
+/* Terminating signal received while attached, or 0 */
+static volatile sig_atomic_t governor_signal_received;
+
+/*
+ * Signal mask in effect while waiting for I/O; outside the wait the
+ * terminating signals are blocked
+ */
+static sigset_t governor_wait_mask;
+
 /* Scatter the output across the files, rather than copying it. */
 static bool opt_scatter = false;
 
@@ -131,6 +173,14 @@ static bool opt_scatter = false;
 static int *permute_dest = NULL;
 static int permute_n = 0;
 
+/*
+ * Ordinals of the outputs that drop data they cannot keep up with,
+ * the sampling ratio of the records written to each, and their number
+ */
+static int *lossy_dest = NULL;
+static int *lossy_sample = NULL;
+static int lossy_n = 0;
+
 /* Use a temporary file for overflowing buffered data */
 static bool use_tmp_file = false;
 
@@ -147,6 +197,9 @@ static bool block_len = 0;
 /* Set to true when we reach EOF on input */
 static bool reached_eof = false;
 
+/* Set to true when a sink's reader terminates early */
+static bool sink_closed = false;
+
 /* Record terminator */
 static char rt = '\n';
 
@@ -161,6 +214,10 @@ struct sink_info {
 	struct source_info *ifp;/* Input file we read from */
 	bool chain_last;	/* True if last element in a group; Writing  (copy or scatter)
 				   should not continue to next element */
+	bool lossy;		/* True if data the sink cannot keep up with is dropped */
+	int sample;		/* Write one out of this many records to a lossy sink */
+	int skip_records;	/* Records to drop before writing again to a lossy sink */
+	bool mid_record;	/* True if a record was only partially written */
 };
 
 /* Construct a new sink_info object */
@@ -174,6 +231,9 @@ new_sink_info(const char *name)
 	ofp->name = name ? strdup(name) : NULL;
 	ofp->active = true;
 	ofp->pos_written = ofp->pos_to_write = 0;
+	ofp->lossy = ofp->mid_record = false;
+	ofp->sample = 1;
+	ofp->skip_records = 0;
 	ofp->next = NULL;
 	return ofp;
 }
@@ -190,6 +250,8 @@ struct source_info {
 	bool active;			/* True if this is a source that should be currently
 					   read (rather than chained later on) */
 	bool is_read;			/* True if an active sink reads it */
+	bool is_wanted;			/* True if an active sink reads it
+					   or will read it later on */
 	bool chain_last;		/* True if reading should stop at this element rather
 					   than continue to the next element */
 };
@@ -269,9 +331,254 @@ memory_pool_size(struct buffer_pool *bp, int pool)
 	return ((bp->buffers_allocated - bp->buffers_freed) + (pool - bp->allocated_pool_end + 1)) * buffer_size;
 }
 
-/* Write half of the allocated buffer pool to the temporary file */
+/* Return the total number of bytes held in memory by all sources' pools */
+static unsigned long
+sources_memory_size(struct source_info *ifiles)
+{
+	struct source_info *ifp;
+	unsigned long size = 0;
+
+	for (ifp = ifiles; ifp; ifp = ifp->next)
+		size += (ifp->bp->buffers_allocated - ifp->bp->buffers_freed) * buffer_size;
+	return size;
+}
+
+/*
+ * Apply the specified fcntl(2) record lock command and type to the
+ * byte of the memory governor's segment at the specified offset.
+ * Return the type of a conflicting lock for F_GETLK.
+ */
+static int
+governor_lock(int cmd, int type, off_t offset)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = offset;
+	fl.l_len = 1;
+	while (fcntl(governor_fd, cmd, &fl) == -1)
+		if (errno != EINTR)
+			err(1, "Unable to lock shared memory segment %s",
+					governor_name);
+	return fl.l_type;
+}
+
+/* Return the offset of the specified slot in the governor's segment */
+#define slot_offset(sp) ((char *)(sp) - (char *)governor)
+
+/*
+ * Release a slot, returning to the budget the memory its instance
+ * has borrowed.  Called with the segment locked.
+ */
+static void
+governor_release(struct governor_slot *sp)
+{
+	atomic_fetch_sub(&governor->used, atomic_exchange(&sp->borrowed, 0));
+	atomic_store(&sp->pid, 0);
+	atomic_fetch_sub(&governor->users, 1);
+}
+
+/*
+ * Release the slots of instances that exited without detaching,
+ * such as ones killed by SIGKILL.  Called with the segment locked.
+ */
+static void
+governor_reclaim(void)
+{
+	struct governor_slot *sp;
+	pid_t pid;
+
+	for (sp = governor->slot; sp < governor->slot + GOVERNOR_SLOTS; sp++)
+		if (sp != governor_slot && (pid = atomic_load(&sp->pid)) != 0 &&
+		    governor_lock(F_GETLK, F_WRLCK, slot_offset(sp)) == F_UNLCK) {
+			DPRINTF(2, "Reclaiming %lu bytes of exited instance %d",
+				atomic_load(&sp->borrowed), (int)pid);
+			governor_release(sp);
+		}
+}
+
+/*
+ * Detach from the graph's memory governor, returning the memory
+ * this instance still holds; the last user removes the segment.
+ */
+static void
+governor_detach(void)
+{
+	if (!governor)
+		return;
+	governor_lock(F_SETLKW, F_WRLCK, 0);
+	governor_release(governor_slot);
+	governor_reclaim();
+	if (atomic_load(&governor->users) == 0)
+		shm_unlink(governor_name);
+	/* Closing the segment releases all our locks */
+	close(governor_fd);
+	munmap(governor, sizeof(*governor));
+	governor = NULL;
+}
+
+/*
+ * Record a terminating signal.  Detaching uses functions that are
+ * not async-signal-safe, and could interfere with the code updating
+ * the shared slots, so it is left to governor_check_signal().
+ * The signal is delivered only while the main loop waits for I/O.
+ */
+static void
+governor_signal(int sig)
+{
+	governor_signal_received = sig;
+}
+
+/*
+ * If a terminating signal was received, detach from the memory
+ * governor and terminate through the signal's default action.
+ * Called from the main loop, which the signal interrupts.
+ */
+static void
+governor_check_signal(void)
+{
+	int sig = governor_signal_received;
+
+	if (sig == 0)
+		return;
+	governor_detach();
+	signal(sig, SIG_DFL);
+	sigprocmask(SIG_SETMASK, &governor_wait_mask, NULL);
+	raise(sig);
+}
+
+/*
+ * Attach to the memory governor of the specified dgsh graph,
+ * creating it with the specified budget if it does not exist.
+ * Memory held by instances that exited without detaching is reclaimed.
+ * Consequently, a segment left behind by an earlier graph whose
+ * initiator had the same process id is reset, rather than lending
+ * its stale accounting and budget to this graph.
+ * Return false if no slot is available.
+ */
+static bool
+governor_attach(pid_t graph_id, unsigned long budget)
+{
+	static const int sigs[] = {SIGHUP, SIGINT, SIGTERM};
+	struct governor_slot *sp, *free_slot = NULL;
+	struct stat sb;
+	sigset_t block;
+	size_t i;
+
+	snprintf(governor_name, sizeof(governor_name), "/dgsh-tee-%d-%d",
+			(int)getuid(), (int)graph_id);
+	for (;;) {
+		if ((governor_fd = shm_open(governor_name, O_RDWR | O_CREAT,
+						0600)) == -1)
+			err(1, "Unable to open shared memory segment %s",
+					governor_name);
+		governor_lock(F_SETLKW, F_WRLCK, 0);
+		if (fstat(governor_fd, &sb) == -1)
+			err(1, "Unable to stat shared memory segment %s",
+					governor_name);
+		/* Retry if the last user removed the segment after we opened it */
+		if (sb.st_nlink > 0)
+			break;
+		close(governor_fd);
+	}
+	/* A new segment is zero-filled; resizing an existing one is a no-op */
+	if (ftruncate(governor_fd, sizeof(*governor)) == -1)
+		err(1, "Unable to size shared memory segment %s", governor_name);
+	governor = mmap(NULL, sizeof(*governor), PROT_READ | PROT_WRITE,
+			MAP_SHARED, governor_fd, 0);
+	if (governor == MAP_FAILED)
+		err(1, "Unable to map shared memory segment %s", governor_name);
+
+	governor_reclaim();
+	for (sp = governor->slot; sp < governor->slot + GOVERNOR_SLOTS; sp++)
+		if (atomic_load(&sp->pid) == 0) {
+			free_slot = sp;
+			break;
+		}
+	if (free_slot == NULL) {
+		close(governor_fd);
+		munmap(governor, sizeof(*governor));
+		governor = NULL;
+		return false;
+	}
+	/* The first instance to attach sets the budget */
+	if (atomic_load(&governor->users) == 0) {
+		atomic_store(&governor->budget, budget);
+		atomic_store(&governor->used, 0);
+	}
+	governor_slot = free_slot;
+	governor_lock(F_SETLK, F_WRLCK, slot_offset(governor_slot));
+	atomic_store(&governor_slot->borrowed, 0);
+	atomic_store(&governor_slot->pid, getpid());
+	atomic_fetch_add(&governor->users, 1);
+	governor_lock(F_SETLK, F_UNLCK, 0);
+
+	atexit(governor_detach);
+	sigemptyset(&block);
+	for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+		sigaddset(&block, sigs[i]);
+		if (signal(sigs[i], governor_signal) == SIG_IGN)
+			signal(sigs[i], SIG_IGN);
+	}
+	sigprocmask(SIG_BLOCK, &block, &governor_wait_mask);
+	DPRINTF(2, "Attached to memory governor %s budget=%lu used=%lu",
+		governor_name, atomic_load(&governor->budget),
+		atomic_load(&governor->used));
+	return true;
+}
+
+/*
+ * Obtain a buffer's memory from the graph's budget.
+ * Return false if the budget is exhausted, unless the allocation is forced.
+ */
+static bool
+governor_borrow(bool force)
+{
+	unsigned long used;
+
+	if (!governor)
+		return true;
+	if (force)
+		atomic_fetch_add(&governor->used, buffer_size);
+	else {
+		used = atomic_load(&governor->used);
+		do {
+			if (used + buffer_size > atomic_load(&governor->budget))
+				return false;
+		} while (!atomic_compare_exchange_weak(&governor->used, &used,
+					used + buffer_size));
+	}
+	atomic_fetch_add(&governor_slot->borrowed, buffer_size);
+	return true;
+}
+
+/* Return a buffer's memory to the graph's budget */
+static void
+governor_return(void)
+{
+	if (!governor)
+		return;
+	atomic_fetch_sub(&governor_slot->borrowed, buffer_size);
+	atomic_fetch_sub(&governor->used, buffer_size);
+}
+
+/* Free the memory of the specified pool member */
+static void
+free_pool_buffer(struct buffer_pool *bp, int pool)
+{
+	free(bp->buffers[pool].p);
+	bp->buffers_freed++;
+	governor_return();
+}
+
+/*
+ * Write the allocated buffer pool to the temporary file, until the memory
+ * it occupies is not larger than the specified limit
+ */
 static void
-page_out(struct buffer_pool *bp)
+page_out(struct buffer_pool *bp, unsigned long limit)
 {
 	if (bp->page_file_fd == -1) {
 		char *template;
@@ -296,7 +603,7 @@ page_out(struct buffer_pool *bp)
 	 * starting from the oldest buffers.
 	 * This is good enough for the simple common case where one output fd is blocked.
 	 */
-	while (memory_pool_size(bp, bp->allocated_pool_end - 1) > max_mem / 2) {
+	while (memory_pool_size(bp, bp->allocated_pool_end - 1) > limit) {
 		switch (bp->buffers[bp->page_out_ptr].s) {
 		case s_memory:
 			if (pwrite(bp->page_file_fd, bp->buffers[bp->page_out_ptr].p, buffer_size, (off_t)bp->page_out_ptr * buffer_size) != buffer_size)
@@ -305,8 +612,7 @@ page_out(struct buffer_pool *bp)
 		case s_memory_backed:
 			DPRINTF(4, "Page out buffer %d %p", bp->page_out_ptr, bp->buffers[bp->page_out_ptr].p);
 			bp->buffers[bp->page_out_ptr].s = s_file;
-			free(bp->buffers[bp->page_out_ptr].p);
-			bp->buffers_freed++;
+			free_pool_buffer(bp, bp->page_out_ptr);
 			bp->buffers_paged_out++;
 			DPRINTF(4, "Paged out buffer %d %p", bp->page_out_ptr, bp->buffers[bp->page_out_ptr].p);
 			break;
@@ -323,15 +629,34 @@ page_out(struct buffer_pool *bp)
 
 /*
  * Allocate memory for the specified pool member.
+ * When the graph's memory budget is exhausted and a temporary file is used,
+ * page out half of the pool's memory to make room for it.
+ * Forced allocations may exceed the graph's budget.
  * Return false if no such memory is available.
  */
 static bool
-allocate_pool_buffer(struct buffer_pool *bp, int pool)
+allocate_pool_buffer(struct buffer_pool *bp, int pool, bool force)
 {
 	struct pool_buffer *b = &bp->buffers[pool];
 
+	/*
+	 * A pool without any memory would wait forever for its sinks,
+	 * so allow it to exceed the budget by a buffer to make progress.
+	 */
+	if (bp->buffers_allocated == bp->buffers_freed)
+		force = true;
+	if (!governor_borrow(false)) {
+		if (use_tmp_file)
+			page_out(bp, memory_pool_size(bp, bp->allocated_pool_end - 1) / 2);
+		if (!governor_borrow(force)) {
+			DPRINTF(4, "Graph memory budget exhausted for buffer %ld", b - bp->buffers);
+			bp->max_buffers_allocated = MAX(bp->buffers_allocated - bp->buffers_freed, bp->max_buffers_allocated);
+			return false;
+		}
+	}
 	if ((b->p = malloc(buffer_size)) == NULL) {
 		DPRINTF(4, "Unable to allocate %d bytes for buffer %ld", buffer_size, b - bp->buffers);
+		governor_return();
 		bp->max_buffers_allocated = MAX(bp->buffers_allocated - bp->buffers_freed, bp->max_buffers_allocated);
 		return false;
 	}
@@ -358,8 +683,9 @@ page_in(struct buffer_pool *bp, int pool)
 	case s_file:
 		/* Good time to ensure that there will be page-in memory available */
 		if (memory_pool_size(bp, bp->allocated_pool_end - 1) > max_mem)
-			page_out(bp);
-		if (!allocate_pool_buffer(bp, pool))
+			page_out(bp, max_mem / 2);
+		/* Writing must progress, even if it exceeds the graph's budget */
+		if (!allocate_pool_buffer(bp, pool, true))
 			err(1, "Out of memory paging-in buffer");
 		if (pread(bp->page_file_fd, b->p, buffer_size, (off_t)pool * buffer_size) != buffer_size)
 			err(1, "Read from temporary file failed");
@@ -396,7 +722,7 @@ memory_allocate(struct buffer_pool *bp, int pool)
 	/* Check soft memory limit through allocated plus requested memory. */
 	if (memory_pool_size(bp, pool) > max_mem) {
 		if (use_tmp_file)
-			page_out(bp);
+			page_out(bp, max_mem / 2);
 		else
 			return false;
 	}
@@ -420,7 +746,7 @@ memory_allocate(struct buffer_pool *bp, int pool)
 
 	/* Allocate buffer memory [allocated_pool_end, pool]. */
 	for (i = bp->allocated_pool_end; i <= pool; i++)
-		if (!allocate_pool_buffer(bp, i)) {
+		if (!allocate_pool_buffer(bp, i, false)) {
 			bp->allocated_pool_end = i;
 			return false;
 		}
@@ -462,16 +788,14 @@ memory_free(struct buffer_pool *bp, off_t pos)
 	for (i = bp->free_pool_begin; i < pool_end; i++) {
 		switch (bp->buffers[i].s) {
 		case s_memory:
-			free(bp->buffers[i].p);
-			bp->buffers_freed++;
+			free_pool_buffer(bp, i);
 			break;
 		case s_file:
 			buffer_file_free(bp, i);
 			break;
 		case s_memory_backed:
 			buffer_file_free(bp, i);
-			free(bp->buffers[i].p);
-			bp->buffers_freed++;
+			free_pool_buffer(bp, i);
 			break;
 		case s_none:
 			break;
@@ -486,7 +810,7 @@ memory_free(struct buffer_pool *bp, off_t pos)
 		bp->buffers[i].p = NULL;
 		#endif
 	}
-	bp->free_pool_begin = pool_end;
+	bp->free_pool_begin = MAX(bp->free_pool_begin, pool_end);
 }
 
 /*
@@ -602,6 +926,22 @@ source_read(struct source_info *ifp)
 	return n ? read_ok : read_eof;
 }
 
+/*
+ * Activate the source chained after the specified one, skipping
+ * those that were already read ahead up to their end of file.
+ */
+static void
+activate_next_source(struct source_info *ifp)
+{
+	while (!ifp->chain_last) {
+		ifp = ifp->next;
+		if (!ifp->reached_eof) {
+			ifp->active = true;
+			break;
+		}
+	}
+}
+
 /*
  * Allocate available read data to empty sinks that can be written to,
  * by adjusting their ifp, pos_written, and pos_to_write pointers.
@@ -751,6 +1091,61 @@ allocate_data_to_sinks(fd_set *sink_fds, struct sink_info *files)
 }
 
 
+/*
+ * Advance a lossy sink past the data it will not write:
+ * data freed before the sink could keep up with it, and records
+ * skipped through sampling.  Only whole records are dropped.
+ */
+static void
+lossy_skip(struct sink_info *ofp)
+{
+	struct buffer_pool *bp = ofp->ifp->bp;
+	off_t retained = (off_t)bp->free_pool_begin * buffer_size;
+
+	if (ofp->pos_written < retained) {
+		DPRINTF(4, "Dropping %ld bytes for %s",
+			(long)(retained - ofp->pos_written), fp_name(ofp));
+		ofp->pos_written = retained;
+		/* Resynchronize at the start of the next record. */
+		ofp->skip_records = 1;
+	}
+	while (ofp->skip_records && ofp->pos_written < ofp->pos_to_write) {
+		if (*sink_pointer(bp, ofp->pos_written) == rt)
+			ofp->skip_records--;
+		ofp->pos_written++;
+	}
+}
+
+/*
+ * Return the number of bytes from b to write to a lossy sink.
+ * These are whole records (a single one when sampling) up to PIPE_BUF
+ * bytes, which a pipe will accept atomically or not at all.
+ * Longer records and ones spanning buffers are written in parts.
+ */
+static size_t
+lossy_write_size(struct sink_info *ofp, struct io_buffer b)
+{
+	char *p = b.p;
+	size_t i, end = 0;
+
+	for (i = 0; i < b.size; i++) {
+		if (p[i] != rt)
+			continue;
+		if (end && i >= PIPE_BUF)
+			break;
+		end = i + 1;
+		if (ofp->sample > 1 || ofp->mid_record)
+			break;
+	}
+	if (end)
+		return end;
+	if (ofp->mid_record || ofp->ifp->reached_eof ||
+	    ofp->pos_written + (off_t)b.size < ofp->pos_to_write)
+		return b.size;
+	/* Wait for the rest of the record. */
+	return 0;
+}
+
 /*
  * Write out from the memory buffer to the sinks where write will not block.
  * Free memory no more needed even by the write pointer farthest behind.
@@ -771,11 +1166,15 @@ sink_write(struct source_info *ifiles, fd_set *sink_fds, struct sink_info *ofile
 	allocate_data_to_sinks(sink_fds, ofiles);
 	for (ofp = ofiles; ofp; ofp = ofp->next) {
 		DPRINTF(4, "\n%s(): try write to file %s", __func__, fp_name(ofp));
+		if (ofp->active && ofp->lossy)
+			lossy_skip(ofp);
 		if (ofp->active && FD_ISSET(ofp->fd, sink_fds)) {
 			int n;
 			struct io_buffer b;
 
 			b = sink_buffer(ofp);
+			if (ofp->lossy && b.size)
+				b.size = lossy_write_size(ofp, b);
 			DPRINTF(4, "\n%s(): sink buffer returned %d bytes to write",
 					__func__, (int)b.size);
 			if (b.size == 0)
@@ -788,6 +1187,7 @@ sink_write(struct source_info *ifiles, fd_set *sink_fds, struct sink_info *ofile
 					/* EPIPE is acceptable, for the sink's reader can terminate early. */
 					case EPIPE:
 						ofp->active = false;
+						sink_closed = true;
 						(void)close(ofp->fd);
 						DPRINTF(4, "EPIPE for %s", fp_name(ofp));
 						break;
@@ -801,12 +1201,18 @@ sink_write(struct source_info *ifiles, fd_set *sink_fds, struct sink_info *ofile
 				else {
 					ofp->pos_written += n;
 					written += n;
+					if (ofp->lossy && n > 0) {
+						ofp->mid_record = ((char *)b.p)[n - 1] != rt;
+						if (!ofp->mid_record)
+							ofp->skip_records = ofp->sample - 1;
+					}
 				}
 			}
 			DPRINTF(4, "Wrote %d out of %zu bytes for file %s pos_written=%lu data=[%.*s]",
 				n, b.size, fp_name(ofp), (unsigned long)ofp->pos_written, (int)n * DATA_DUMP, (char *)b.p);
 		}
-		if (ofp->active) {
+		/* Lossy sinks retain data only to complete a record. */
+		if (ofp->active && (!ofp->lossy || ofp->mid_record)) {
 			ofp->ifp->read_min_pos = MIN(ofp->ifp->read_min_pos, ofp->pos_written);
 			ofp->ifp->is_read = true;
 		}
@@ -827,12 +1233,59 @@ sink_write(struct source_info *ifiles, fd_set *sink_fds, struct sink_info *ofile
 	return written;
 }
 
+/*
+ * Close the sources whose data no active sink will ever write,
+ * and free their buffers, so that their producers and the commands
+ * feeding them can terminate early.
+ * Return the number of sinks that remain active.
+ */
+static int
+close_unwanted_sources(struct source_info *ifiles, struct sink_info *ofiles)
+{
+	struct sink_info *ofp;
+	struct source_info *ifp;
+	int active_sinks = 0;
+	bool all_lossy = true;
+
+	for (ifp = ifiles; ifp; ifp = ifp->next)
+		ifp->is_wanted = false;
+
+	for (ofp = ofiles; ofp; ofp = ofp->next)
+		if (!ofp->lossy)
+			all_lossy = false;
+
+	for (ofp = ofiles; ofp; ofp = ofp->next) {
+		/* Lossy sinks alone do not keep the input flowing. */
+		if (!ofp->active || (ofp->lossy && !all_lossy))
+			continue;
+		active_sinks++;
+		/* The sink will also read the rest of its input chain. */
+		for (ifp = ofp->ifp; ifp; ifp = ifp->next) {
+			ifp->is_wanted = true;
+			if (ifp->chain_last)
+				break;
+		}
+	}
+
+	for (ifp = ifiles; ifp; ifp = ifp->next) {
+		if (ifp->is_wanted || ifp->reached_eof)
+			continue;
+		DPRINTF(3, "Closing unwanted source %s", fp_name(ifp));
+		(void)close(ifp->fd);
+		ifp->reached_eof = true;
+		ifp->active = false;
+		memory_free(ifp->bp, (off_t)ifp->bp->allocated_pool_end * buffer_size);
+	}
+	return active_sinks;
+}
+
 static void
 usage(const char *name)
 {
-	fprintf(stderr, "Usage %s [-b size] [-i file] [-IMs] [-o file] [-m size] [-t char]\n"
+	fprintf(stderr, "Usage %s [-b size] [-d n[:ratio]] [-i file] [-IMs] [-o file] [-m size] [-t char]\n"
 		"-a"		"\tOpen output file(s) for appending\n"
 		"-b size"	"\tSpecify the size of the buffer to use (used for stress testing)\n"
+		"-d n[:ratio]"	"\tDrop records output n cannot keep up with; sample 1 in ratio\n"
 		"-f"		"\tOverflow buffered data into a temporary file\n"
 		"-I"		"\tInput-side buffering\n"
 		"-i file"	"\tGather input from specified file\n"
@@ -977,6 +1430,51 @@ parse_permute(char *s)
 	DPRINTF(4, "permute_n=%d", permute_n);
 }
 
+/*
+ * Parse an output ordinal optionally followed by a sampling ratio
+ * (n[:ratio]), and add them to lossy_dest and lossy_sample.
+ */
+static void
+parse_lossy(char *s)
+{
+	char *end;
+	long dest, sample = 1;
+
+	dest = strtol(s, &end, 10);
+	if (*end == ':')
+		sample = strtol(end + 1, &end, 10);
+	if (*end || dest < 1 || sample < 1 || sample > INT_MAX)
+		errx(1, "Illegal lossy output specification [%s]", s);
+	lossy_dest = realloc(lossy_dest, sizeof(int) * (lossy_n + 1));
+	lossy_sample = realloc(lossy_sample, sizeof(int) * (lossy_n + 1));
+	if (lossy_dest == NULL || lossy_sample == NULL)
+		errx(1, "Out of memory for lossy outputs");
+	lossy_dest[lossy_n] = dest - 1;
+	lossy_sample[lossy_n] = sample;
+	lossy_n++;
+	DPRINTF(4, "lossy output %ld sample=%ld", dest, sample);
+}
+
+/*
+ * Mark the outputs specified through lossy_dest as lossy.
+ * Must be called before the output files are chained.
+ */
+static void
+mark_lossy_sinks(struct sink_info *ofiles)
+{
+	struct sink_info *ofp;
+	int i, n;
+
+	for (i = 0; i < lossy_n; i++) {
+		for (ofp = ofiles, n = 0; ofp && n < lossy_dest[i]; ofp = ofp->next)
+			n++;
+		if (ofp == NULL)
+			errx(1, "Lossy output %d does not exist", lossy_dest[i] + 1);
+		ofp->lossy = true;
+		ofp->sample = lossy_sample[i];
+	}
+}
+
 /*
  * Return the input file corresponding to the specified
  * permuted output file number.
@@ -1016,6 +1514,9 @@ memory_stats(struct source_info *ifiles)
 		fprintf(stderr, "Page out: %d In: %d Pages freed: %d\n",
 			ifp->bp->buffers_paged_out, ifp->bp->buffers_paged_in, ifp->bp->pages_freed);
 	}
+	if (governor)
+		fprintf(stderr, "Graph memory budget: %lu Used: %lu\n",
+			atomic_load(&governor->budget), atomic_load(&governor->used));
 }
 
 /*
@@ -1202,9 +1703,11 @@ main(int argc, char *argv[])
 	const char *progname = argv[0];
 	enum state state = read_ob;
 	bool opt_memory_stats = false;
+	bool opt_max_mem = false;
 	bool opt_append = false;
+	char *graph_mem;
 
-	while ((ch = getopt(argc, argv, "ab:fIi:Mm:o:p:S:sTt:")) != -1) {
+	while ((ch = getopt(argc, argv, "ab:d:fIi:Mm:o:p:S:sTt:")) != -1) {
 		switch (ch) {
 		case 'a':
 			opt_append = true;
@@ -1212,6 +1715,9 @@ main(int argc, char *argv[])
 		case 'b':
 			buffer_size = (int)parse_size(progname, optarg);
 			break;
+		case 'd':
+			parse_lossy(optarg);
+			break;
 		case 'f':
 			use_tmp_file = true;
 			break;
@@ -1231,6 +1737,7 @@ main(int argc, char *argv[])
 			break;
 		case 'm':
 			max_mem = parse_size(progname, optarg);
+			opt_max_mem = true;
 			break;
 		case 'M':	/* Provide memory use statistics on termination */
 			opt_memory_stats = true;
@@ -1279,6 +1786,7 @@ main(int argc, char *argv[])
 	int *outputfds;
 	int ninputfds;
 	int *inputfds;
+	int flags;
 	char *name;
 
 	if (permute_n) {
@@ -1308,12 +1816,33 @@ main(int argc, char *argv[])
 
 
 
+	/*
+	 * Without options that make us buffer or transform the data,
+	 * copying or permuting inputs to as many outputs can be done
+	 * by the negotiation, letting us leave the data path.
+	 */
+	flags = DGSH_HANDLE_ERROR;
+	if (!ifiles && !ofiles && !opt_scatter && !lossy_n &&
+			state == read_ob && !use_tmp_file && !opt_memory_stats &&
+			(!permute_n || dgsh_permute(permute_n, permute_dest) == 0))
+		flags |= DGSH_PASS_THROUGH;
+
 	DPRINTF(3, "Calling negotiate in=%d out=%d", ninputfds, noutputfds);
-	dgsh_negotiate(DGSH_HANDLE_ERROR, name, &ninputfds, &noutputfds, &inputfds, &outputfds);
+	dgsh_negotiate(flags, name, &ninputfds, &noutputfds, &inputfds, &outputfds);
 	DPRINTF(3, "nin=%d nout=%d", ninputfds, noutputfds);
 	assert(noutputfds >= 0);
 	assert(ninputfds >= 0);
 
+	/*
+	 * Data we pass on meets again downstream, where it may be read
+	 * in a different order; buffer all input to avoid a deadlock.
+	 */
+	if (dgsh_on_reconvergent_path()) {
+		DPRINTF(2, "On reconvergent path: buffering input");
+		state = read_ib;
+		use_tmp_file = true;
+	}
+
 	if (permute_n && permute_n != ninputfds)
 		errx(1, "The number of inputs %d is not equal to the specified permuted outputs %d", ninputfds, permute_n);
 	if (permute_n && permute_n != noutputfds)
@@ -1351,6 +1880,15 @@ main(int argc, char *argv[])
 		iend = &ifp->next;
 	}
 
+	/* Share the specified memory budget with the graph's other instances */
+	if ((graph_mem = getenv("DGSH_MEMORY")) != NULL && dgsh_graph_id() != -1) {
+		if (!governor_attach(dgsh_graph_id(),
+					parse_size(progname, graph_mem)))
+			warnx("Too many instances share the graph's memory budget; not sharing it");
+		else if (!opt_max_mem)
+			max_mem = atomic_load(&governor->budget);
+	}
+
 	if (buffer_size > max_mem)
 		errx(1, "Buffer size %d is larger than the program's maximum memory limit %lu", buffer_size, max_mem);
 
@@ -1360,6 +1898,9 @@ main(int argc, char *argv[])
 	if (opt_scatter && permute_n)
 		errx(1, "Scattering and permutation cannot be used together");
 
+	if (opt_scatter && lossy_n)
+		errx(1, "Scattering and lossy outputs cannot be used together");
+
 	if (ofiles == NULL) {
 		/* Output to stdout */
 		ofp = new_sink_info("standard output");
@@ -1383,6 +1924,7 @@ main(int argc, char *argv[])
 	/* We will handle SIGPIPE explicitly when calling write(2). */
 	signal(SIGPIPE, SIG_IGN);
 
+	mark_lossy_sinks(ofiles);
 	front_ifp = ifiles;
 	chain_io_files(ifiles, ofiles, permute_n != 0);
 
@@ -1390,8 +1932,22 @@ main(int argc, char *argv[])
 	for (;;) {
 		fd_set source_fds;
 		fd_set sink_fds;
+		bool read_ahead;
 
+		governor_check_signal();
 		show_state(state);
+
+		/* Stop reading data that can no longer be written anywhere. */
+		if (sink_closed) {
+			sink_closed = false;
+			if (close_unwanted_sources(ifiles, ofiles) == 0) {
+				DPRINTF(3, "All sinks closed; terminating");
+				if (opt_memory_stats)
+					memory_stats(ifiles);
+				return 0;
+			}
+		}
+
 		/* Set the fd's we're interested to read/write; close unneeded ones. */
 		FD_ZERO(&source_fds);
 		FD_ZERO(&sink_fds);
@@ -1404,8 +1960,15 @@ main(int argc, char *argv[])
 						FD_SET(ifp->fd, &source_fds);
 				break;
 			case read_ob:
+				/*
+				 * Also read ahead chained sources that are not yet
+				 * active, so that their producers can run concurrently.
+				 * Keep half of the memory for the active ones.
+				 */
+				read_ahead = sources_memory_size(ifiles) +
+					buffer_size <= max_mem / 2;
 				for (ifp = front_ifp; ifp; ifp = ifp->next)
-					if (ifp->active && !ifp->reached_eof)
+					if ((ifp->active || read_ahead) && !ifp->reached_eof)
 						FD_SET(ifp->fd, &source_fds);
 				break;
 			default:
@@ -1433,8 +1996,12 @@ main(int argc, char *argv[])
 
 		/* Block until we can read or write. */
 		show_select_args("Entering select", &source_fds, ifiles, &sink_fds, ofiles, true);
-		if (select(max_fd + 1, &source_fds, &sink_fds, NULL, NULL) < 0)
+		if (pselect(max_fd + 1, &source_fds, &sink_fds, NULL, NULL,
+				governor ? &governor_wait_mask : NULL) < 0) {
+			if (errno == EINTR && governor_signal_received)
+				continue;
 			err(3, "select");
+		}
 		show_select_args("Select returned", &source_fds, ifiles, &sink_fds, ofiles, false);
 
 		/* Write to all file descriptors that accept writes. */
@@ -1504,15 +2071,19 @@ main(int argc, char *argv[])
 			/* Read, from possible sources; set global reached_eof if all have reached it */
 			reached_eof = true;
 			for (ifp = front_ifp; ifp; ifp = ifp->next) {
-				if (!ifp->active)
+				if (!ifp->active) {
+					/* Read ahead; stop on lack of memory. */
+					if (FD_ISSET(ifp->fd, &source_fds) &&
+					    source_read(ifp) == read_eof)
+						ifp->reached_eof = true;
 					continue;
+				}
 				if (FD_ISSET(ifp->fd, &source_fds))
 					switch (source_read(ifp)) {
 					case read_eof:
 						ifp->reached_eof = true;
 						ifp->active = false;
-						if (!ifp->chain_last)
-							ifp->next->active = true;
+						activate_next_source(ifp);
 						break;
 					case read_again:
 						break;
@@ -1,55 +1,229 @@
+#include <sys/select.h>	// select()
 #include <assert.h>	// assert()
-#include <math.h>	// M_PI, pow()
-#include <complex.h>	// I, cexp(), cpow()
+#include <math.h>	// M_PI, cos(), sin()
+#include <stdbool.h>	// bool
 #include <stdio.h>	// DPRINTF
 #include <stdlib.h>	// atoi()
 #include <err.h>	// errx()
+#include <errno.h>	// EINTR
 #include <unistd.h>	// read(), write()
-#include <string.h>	// memcpy()
+#include <string.h>	// memmove()
 
 #include "dgsh.h"
 #include "dgsh-debug.h"
 
-void
-read_number(int fd, long double *x, long double complex *xc)
+/*
+ * Calculate the FFT butterfly y1 = x1 + w * x2, y2 = x1 - w * x2
+ * over streams of samples.
+ * The inputs and outputs are framed binary numeric streams (see
+ * dgsh_frame(3)).  Inputs can consist of real (e.g. the ones written
+ * by dgsh-fft-input) or complex values; the output values are complex.
+ * Samples available on both inputs are processed in blocks.
+ */
+
+#define DEFAULT_BLOCK 4096	// Samples per block
+#define LINE_MAX_LEN 100	// Typical length of a text output line
+
+#define READ_SIZE (64 * 1024)	// Bytes to read at a time
+
+// An input stream and its queued samples
+struct input {
+	int fd;
+	int wire_type;		// Type of the samples read
+	int type;		// Type of the queued samples
+	double *buf;		// Queued samples
+	size_t len;		// Number of samples in buf
+	size_t size;		// Allocated samples in buf
+	char *raw;		// Data read, but not yet decoded
+	size_t rawlen;		// Bytes in raw
+	size_t rawsize;		// Allocated bytes in raw
+	bool eof;
+};
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-b block] [-t] stage n\n"
+		"-b block\tProcess block samples at a time\n"
+		"-t\t\tOutput the results as text\n", name);
+	exit(1);
+}
+
+/*
+ * Append samples to the input's queue.
+ * Real samples are converted if the queue has been made complex
+ * to match the other input.
+ */
+static void
+queue(struct input *in, int type, const void *data, size_t n)
+{
+	const double *d = data;
+	size_t esize, i;
+
+	if (in->wire_type == 0)
+		in->wire_type = in->type = type;
+	else if (type != in->wire_type)
+		errx(1, "Input mixes real and complex samples");
+	esize = dgsh_frame_element_size(in->type);
+
+	if (in->len + n > in->size) {
+		in->size = (in->len + n) * 2;
+		if ((in->buf = realloc(in->buf, in->size * esize)) == NULL)
+			err(1, NULL);
+	}
+	if (type == in->type)
+		memcpy((char *)in->buf + in->len * esize, data, n * esize);
+	else
+		for (i = 0; i < n; i++) {
+			in->buf[2 * (in->len + i)] = d[i];
+			in->buf[2 * (in->len + i) + 1] = 0;
+		}
+	in->len += n;
+}
+
+/*
+ * Read the data available on the input and queue the samples of the
+ * complete frames it contains.
+ * Frames are decoded from the data read rather than through blocking
+ * reads, to avoid deadlocks with producers writing frames to both inputs.
+ */
+static void
+fill(struct input *in)
 {
-	char buf[sizeof(long double complex) + 5];	// \n\0
-	char real[sizeof(long double)];
-	char imag[sizeof(long double)];
-	int rd_size;
-
-	// Read input: 2 float values
-	rd_size = read(fd, buf, sizeof(buf));
-	if (rd_size == -1)
-		err(1, "write failed");
-	DPRINTF(4, "Read %zu characters, long double size: %zu, long double complex size: %zu",
-			rd_size, sizeof(long double), sizeof(long double complex));
-	if (rd_size == sizeof(long double)) {
-		memcpy(x, buf, sizeof(*x));
-		DPRINTF(4, "Read input x: %.10Lf", *x);
-	} else {
-		sscanf(buf, "%s %s", real, imag);
-		*xc = atof(real) + atof(imag)*I;
-		DPRINTF(4, "##xc: %.10f + %.10fi (read %zu characters)\n",
-				creal(*xc), cimag(*xc), rd_size);
+	const void *data;
+	size_t pos, count;
+	ssize_t n;
+	int type;
+
+	if (in->rawsize - in->rawlen < READ_SIZE) {
+		in->rawsize = in->rawlen + READ_SIZE;
+		if ((in->raw = realloc(in->raw, in->rawsize)) == NULL)
+			err(1, NULL);
+	}
+	do
+		n = read(in->fd, in->raw + in->rawlen, in->rawsize - in->rawlen);
+	while (n == -1 && errno == EINTR);
+	if (n == -1)
+		err(1, "read failed");
+	if (n == 0) {
+		in->eof = true;
+		if (in->rawlen != 0)
+			errx(1, "Incomplete frame at end of input");
+		return;
+	}
+	in->rawlen += n;
+
+	for (pos = 0; pos < in->rawlen; pos += n) {
+		n = dgsh_frame_decode(in->raw + pos, in->rawlen - pos, &type,
+				&data, &count);
+		if (n == -1)
+			errx(1, "Invalid input frame");
+		if (n == 0)
+			break;
+		queue(in, type, data, count);
 	}
+	in->rawlen -= pos;
+	memmove(in->raw, in->raw + pos, in->rawlen);
 }
 
-void
-write_number(int fd, long double complex y)
+/*
+ * Butterfly on n complex samples stored as interleaved (real, imaginary)
+ * pairs.  The loops access disjoint arrays sequentially, allowing the
+ * compiler to vectorize them.
+ */
+static void
+butterfly_complex(const double *restrict a, const double *restrict b,
+		double *restrict y1, double *restrict y2, size_t n,
+		double wr, double wi)
 {
-	char buf[sizeof(long double complex)];
-	int wr_size;
-
-	// Write output: 2 float values
-	memset(buf, 0, sizeof(buf));
-	snprintf(buf, sizeof(buf), "%.10f %.10fi", creal(y), cimag(y));
-	DPRINTF(4, "##buf(y): %s, len: %d", buf, strlen(buf));
-	wr_size = write(fd, buf, sizeof(buf));
-	if (wr_size == -1)
-		err(1, "write failed");
-	DPRINTF(4, "##y: %.10f + %.10fi (wrote %zu characters)\n",
-			creal(y), cimag(y), wr_size);
+	size_t i;
+
+	for (i = 0; i < 2 * n; i += 2) {
+		double tr = wr * b[i] - wi * b[i + 1];
+		double ti = wr * b[i + 1] + wi * b[i];
+
+		y1[i] = a[i] + tr;
+		y1[i + 1] = a[i + 1] + ti;
+		y2[i] = a[i] - tr;
+		y2[i + 1] = a[i + 1] - ti;
+	}
+}
+
+// Butterfly on n real samples
+static void
+butterfly_real(const double *restrict a, const double *restrict b,
+		double *restrict y1, double *restrict y2, size_t n,
+		double wr, double wi)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		y1[2 * i] = a[i] + wr * b[i];
+		y1[2 * i + 1] = wi * b[i];
+		y2[2 * i] = a[i] - wr * b[i];
+		y2[2 * i + 1] = -wi * b[i];
+	}
+}
+
+// Convert the queued real samples of the input into complex ones
+static void
+make_complex(struct input *in)
+{
+	double *c;
+	size_t i;
+
+	if ((c = malloc(in->size * 2 * sizeof(double))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < in->len; i++) {
+		c[2 * i] = in->buf[i];
+		c[2 * i + 1] = 0;
+	}
+	free(in->buf);
+	in->buf = c;
+	in->type = DGSH_FRAME_COMPLEX;
+}
+
+// Output n complex samples
+static void
+output(int fd, const double *y, size_t n, bool text)
+{
+	static char *lines;
+	static size_t size;
+	size_t i, len;
+	ssize_t w;
+	int ret;
+
+	if (!text) {
+		if (dgsh_frame_write(fd, DGSH_FRAME_COMPLEX, y, n) == -1)
+			err(1, "write failed");
+		return;
+	}
+	if (size < n * LINE_MAX_LEN) {
+		size = n * LINE_MAX_LEN;
+		if ((lines = realloc(lines, size)) == NULL)
+			err(1, NULL);
+	}
+	for (i = len = 0; i < n; ) {
+		ret = snprintf(lines + len, size - len, "%.10f %.10fi\n",
+				y[2 * i], y[2 * i + 1]);
+		if (ret < 0)
+			err(1, "snprintf");
+		// Large values can exceed LINE_MAX_LEN; retry after growing
+		if ((size_t)ret >= size - len) {
+			size = size * 2 + ret;
+			if ((lines = realloc(lines, size)) == NULL)
+				err(1, NULL);
+			continue;
+		}
+		len += ret;
+		i++;
+	}
+	for (i = 0; i < len; i += w)
+		if ((w = write(fd, lines + i, len - i)) == -1) {
+			if (errno != EINTR)
+				err(1, "write failed");
+			w = 0;
+		}
 }
 
 int
@@ -59,46 +233,116 @@ main(int argc, char** argv)
 	int *outputfds = NULL;
 	int ninputfds = 2;
 	int *inputfds = NULL;
-	long double x1 = -1.0, x2 = -1.0;
-	long double complex xc1, xc2;
-	long double complex y1, y2, w, wmn;
-	size_t wr_size;
-	char negotiation_title[10];
+	struct input in[2];
+	double *y1, *y2;
+	double wr, wi;
+	char negotiation_title[100];
+	size_t block = DEFAULT_BLOCK, per_sample, avail, done, n, i;
+	bool text = false;
+	int ch;
 	int s;	// stage (stage=1,2,3)
 	int m;	// 2^stage
-	int n;	// nth root of unity
+	int k;	// nth root of unity
 
-	assert(argc == 3);
-	s = atoi(argv[1]);
-	m = pow(2, s);
-	n = atoi(argv[2]);
+	while ((ch = getopt(argc, argv, "b:t")) != -1) {
+		switch (ch) {
+		case 'b':
+			if ((block = atoi(optarg)) == 0)
+				usage(argv[0]);
+			break;
+		case 't':
+			text = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2)
+		usage(argv[0]);
+	s = atoi(argv[optind]);
+	m = 1 << s;
+	k = atoi(argv[optind + 1]);
 
 	snprintf(negotiation_title, sizeof(negotiation_title),
-			"%s %s %s", argv[0], argv[1], argv[2]);
+			"%s %s %s", argv[0], argv[optind], argv[optind + 1]);
 	dgsh_negotiate(DGSH_HANDLE_ERROR, negotiation_title, &ninputfds,
 			&noutputfds, &inputfds, &outputfds);
 	assert(ninputfds == 2);
 	assert(noutputfds == 2);
 
-	read_number(inputfds[0], &x1, &xc1);
-	read_number(inputfds[1], &x2, &xc2);
-
-	// Calculate
-	w = 2 * M_PI * I / m;
-	wmn = cpow(cexp(w), n);
-	DPRINTF(4, "w: %.10f + %.10fi", creal(w), cimag(w));
-	DPRINTF(4, "m: %d, n: %d, wmn: %.10f + %.10fi\n",
-			m, n, creal(wmn), cimag(wmn));
-	if (x1 == -1.0 && x2 == -1.0) {
-		y1 = xc1 + wmn * xc2;
-		y2 = xc1 - wmn * xc2;
-	} else {
-		y1 = x1 + wmn * x2;
-		y2 = x1 - wmn * x2;
+	// Precompute the twiddle factor e^(2 pi i k / m)
+	wr = cos(2 * M_PI * k / m);
+	wi = sin(2 * M_PI * k / m);
+	DPRINTF(4, "m: %d, k: %d, w: %.10f + %.10fi\n", m, k, wr, wi);
+
+	for (i = 0; i < 2; i++) {
+		in[i].fd = inputfds[i];
+		in[i].wire_type = in[i].type = 0;
+		in[i].buf = NULL;
+		in[i].raw = NULL;
+		in[i].len = in[i].size = in[i].rawlen = in[i].rawsize = 0;
+		in[i].eof = false;
 	}
+	if ((y1 = malloc(block * 2 * sizeof(double))) == NULL ||
+	    (y2 = malloc(block * 2 * sizeof(double))) == NULL)
+		err(1, NULL);
+
+	for (;;) {
+		fd_set readfds;
+		int nfds = 0;
+
+		/*
+		 * Wait for data on all open inputs, so that a producer
+		 * blocked on one of them cannot starve the other.
+		 */
+		FD_ZERO(&readfds);
+		for (i = 0; i < 2; i++)
+			if (!in[i].eof) {
+				FD_SET(in[i].fd, &readfds);
+				if (in[i].fd >= nfds)
+					nfds = in[i].fd + 1;
+			}
+		if (nfds == 0 && (in[0].len == 0 || in[1].len == 0))
+			break;
+		if (nfds > 0) {
+			if (select(nfds, &readfds, NULL, NULL, NULL) == -1) {
+				if (errno == EINTR)
+					continue;
+				err(1, "select");
+			}
+			for (i = 0; i < 2; i++)
+				if (FD_ISSET(in[i].fd, &readfds))
+					fill(&in[i]);
+		}
 
-	write_number(outputfds[0], y1);
-	write_number(outputfds[1], y2);
+		// Process in blocks the samples available on both inputs
+		avail = in[0].len < in[1].len ? in[0].len : in[1].len;
+		if (avail == 0)
+			continue;
+		if (in[0].type != in[1].type)
+			make_complex(in[0].type == DGSH_FRAME_DOUBLE ?
+					&in[0] : &in[1]);
+		per_sample = in[0].type == DGSH_FRAME_DOUBLE ? 1 : 2;
+		for (done = 0; done < avail; done += n) {
+			const double *a = in[0].buf + done * per_sample;
+			const double *b = in[1].buf + done * per_sample;
+
+			n = avail - done < block ? avail - done : block;
+			if (per_sample == 1)
+				butterfly_real(a, b, y1, y2, n, wr, wi);
+			else
+				butterfly_complex(a, b, y1, y2, n, wr, wi);
+			output(outputfds[0], y1, n, text);
+			output(outputfds[1], y2, n, text);
+		}
+		for (i = 0; i < 2; i++) {
+			in[i].len -= avail;
+			memmove(in[i].buf, in[i].buf + avail * per_sample,
+					in[i].len * per_sample * sizeof(double));
+		}
+	}
 
+	if (in[0].len != in[1].len || !in[0].eof || !in[1].eof)
+		warnx("Inputs have a different number of samples");
 	return 0;
 }
@@ -20,10 +20,39 @@
 #ifndef DGSH_H
 #define DGSH_H
 
+#include <sys/types.h>
+
 #define DGSH_HANDLE_ERROR 0x100
+#define DGSH_PASS_THROUGH 0x200	/* Tool copies its input unchanged */
 
 int
 dgsh_negotiate(int flags, const char *tool_name, int *n_input_fds,
 		int *n_output_fds, int **input_fds, int **output_fds);
 
+pid_t
+dgsh_graph_id(void);
+
+int
+dgsh_on_reconvergent_path(void);
+
+int
+dgsh_permute(int n, const int *outputs);
+
+/* Element types of framed numeric streams */
+#define DGSH_FRAME_DOUBLE 1	/* double */
+#define DGSH_FRAME_COMPLEX 2	/* Pair of doubles: real, imaginary part */
+
+size_t
+dgsh_frame_element_size(int type);
+
+int
+dgsh_frame_write(int fd, int type, const void *data, size_t count);
+
+ssize_t
+dgsh_frame_read(int fd, int *type, void **data, size_t *size);
+
+ssize_t
+dgsh_frame_decode(const void *buf, size_t len, int *type,
+		const void **data, size_t *count);
+
 #endif
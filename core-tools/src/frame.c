@@ -0,0 +1,223 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Framed binary numeric streams.
+ * Each frame consists of a fixed header specifying the type and number
+ * of the elements that follow, and the elements' values in the native
+ * machine representation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>		/* writev() */
+#include <errno.h>		/* EINTR, EINVAL, EPROTO */
+#include <limits.h>		/* SSIZE_MAX */
+#include <stdint.h>		/* uint32_t, uint64_t */
+#include <stdlib.h>		/* realloc() */
+#include <string.h>		/* memcmp() */
+#include <unistd.h>		/* read() */
+
+#include "dgsh.h"
+
+/* Identifies the start of a frame; the digit is the format's version */
+static const char frame_magic[4] = {'D', 'g', 'F', '1'};
+
+struct frame_header {
+	char magic[4];
+	uint32_t type;		/* One of DGSH_FRAME_* */
+	uint64_t count;		/* Number of elements that follow */
+};
+
+/* Return the size in bytes of an element of the specified type, or 0 */
+size_t
+dgsh_frame_element_size(int type)
+{
+	switch (type) {
+	case DGSH_FRAME_DOUBLE:
+		return sizeof(double);
+	case DGSH_FRAME_COMPLEX:
+		return 2 * sizeof(double);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Write to fd a frame containing the count elements of the specified
+ * type stored in data.
+ * Return 0 on success, -1 with errno set on failure.
+ */
+int
+dgsh_frame_write(int fd, int type, const void *data, size_t count)
+{
+	struct frame_header h;
+	struct iovec iov[2];
+	size_t esize;
+	ssize_t n;
+	int i = 0;
+
+	if ((esize = dgsh_frame_element_size(type)) == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (count == 0)
+		return 0;
+
+	memcpy(h.magic, frame_magic, sizeof(h.magic));
+	h.type = type;
+	h.count = count;
+	iov[0].iov_base = &h;
+	iov[0].iov_len = sizeof(h);
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = count * esize;
+
+	/* Continue after partial writes */
+	while (i < 2) {
+		n = writev(fd, iov + i, 2 - i);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		for (; i < 2 && (size_t)n >= iov[i].iov_len; i++)
+			n -= iov[i].iov_len;
+		if (i < 2) {
+			iov[i].iov_base = (char *)iov[i].iov_base + n;
+			iov[i].iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read len bytes from fd into buf.
+ * Return the number of bytes read, which is less than len only at
+ * end of file, or -1 on error.
+ */
+static ssize_t
+read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+		p += n;
+		len -= n;
+	}
+	return p - (char *)buf;
+}
+
+/*
+ * Return the element size of a valid frame header, or 0.
+ * A valid header's frame length fits in an ssize_t, so that a corrupt
+ * element count cannot wrap around the computation of its size.
+ */
+static size_t
+header_element_size(const struct frame_header *h)
+{
+	size_t esize;
+
+	if (memcmp(h->magic, frame_magic, sizeof(h->magic)) != 0)
+		return 0;
+	if ((esize = dgsh_frame_element_size(h->type)) == 0)
+		return 0;
+	if (h->count > (SSIZE_MAX - sizeof(*h)) / esize)
+		return 0;
+	return esize;
+}
+
+/*
+ * Read from fd the next frame, storing its element type in type and
+ * its elements in the buffer pointed by data, whose allocated size
+ * in bytes is pointed by size.  The buffer is enlarged as needed;
+ * it can initially be NULL with a size of 0.
+ * Return the number of elements read, 0 at end of file, or -1 with
+ * errno set on failure.
+ */
+ssize_t
+dgsh_frame_read(int fd, int *type, void **data, size_t *size)
+{
+	struct frame_header h;
+	size_t esize, len;
+	ssize_t n;
+
+	do {
+		if ((n = read_full(fd, &h, sizeof(h))) <= 0)
+			return n;
+		if ((size_t)n < sizeof(h) ||
+		    (esize = header_element_size(&h)) == 0) {
+			errno = EPROTO;
+			return -1;
+		}
+	} while (h.count == 0);
+
+	len = h.count * esize;
+	if (len > *size) {
+		void *p;
+
+		if ((p = realloc(*data, len)) == NULL)
+			return -1;
+		*data = p;
+		*size = len;
+	}
+	if ((n = read_full(fd, *data, len)) == -1)
+		return -1;
+	if ((size_t)n < len) {
+		errno = EPROTO;
+		return -1;
+	}
+	*type = h.type;
+	return h.count;
+}
+
+/*
+ * Decode the frame starting at the len bytes of buf, setting type,
+ * count, and data to its element type, number of elements, and their
+ * location in buf.
+ * This allows programs that multiplex their input through select(2)
+ * to decode frames from the data they have read without blocking.
+ * Return the frame's total length in bytes, 0 if buf does not yet
+ * contain the complete frame, or -1 with errno set to EPROTO if it
+ * does not start with a valid frame.
+ */
+ssize_t
+dgsh_frame_decode(const void *buf, size_t len, int *type,
+		const void **data, size_t *count)
+{
+	struct frame_header h;
+	size_t esize;
+
+	if (len < sizeof(h))
+		return 0;
+	memcpy(&h, buf, sizeof(h));
+	if ((esize = header_element_size(&h)) == 0) {
+		errno = EPROTO;
+		return -1;
+	}
+	if (len - sizeof(h) < h.count * esize)
+		return 0;
+	*type = h.type;
+	*count = h.count;
+	*data = (const char *)buf + sizeof(h);
+	return sizeof(h) + h.count * esize;
+}
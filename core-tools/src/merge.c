@@ -0,0 +1,444 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Merge sorted input streams through a heap, optionally distributing
+ * the work across a tree of processes.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dgsh.h"
+#include "dgsh-debug.h"
+#include "merge.h"
+
+/* Initial size of each input's read buffer */
+#define INPUT_BUFFER_SIZE (256 * 1024)
+
+/* Processes executing the lower levels of a merge tree */
+static pid_t *children;
+static int nchildren;
+
+/* Initialize the specified input to read from fd */
+void
+merge_input_init(struct merge_input *in, int fd, const char *name)
+{
+	in->fd = fd;
+	in->name = name;
+	in->size = INPUT_BUFFER_SIZE;
+	if ((in->buf = malloc(in->size)) == NULL)
+		err(1, NULL);
+	in->begin = in->end = 0;
+	in->eof = false;
+	in->lineno = 0;
+	in->offset = -1;
+}
+
+/*
+ * Initialize the specified input to read fd starting from offset,
+ * without changing the file's offset.  This allows processes sharing
+ * the file descriptor to read different parts of the file.
+ */
+void
+merge_input_init_at(struct merge_input *in, int fd, const char *name,
+		off_t offset)
+{
+	merge_input_init(in, fd, name);
+	in->offset = offset;
+}
+
+/*
+ * Obtain the inputs specified by the operands in argv.
+ * Each '<|' operand denotes a negotiated input channel.
+ * Without operands read all negotiated channels; with
+ * file operands read the standard input and the files.
+ */
+struct merge_input *
+merge_open_inputs(const char *tool_name, int argc, char *argv[], int *ninputs)
+{
+	int noutputs = 1;
+
+	return merge_open_channels(tool_name, argc, argv, ninputs,
+			&noutputs, NULL);
+}
+
+/*
+ * Obtain the inputs specified by the operands in argv, as with
+ * merge_open_inputs, negotiating also the number of output channels
+ * specified in *noutputs (-1 for any), and setting *noutputs and
+ * *output_fds to the obtained ones.
+ */
+struct merge_input *
+merge_open_channels(const char *tool_name, int argc, char *argv[],
+		int *ninputs, int *noutputs, int **output_fds)
+{
+	struct merge_input *inputs;
+	int *input_fds = NULL;
+	int n_input_fds;
+	int nfiles, nchannels;
+	int i, j;
+	char name[32];
+
+	nchannels = nfiles = 0;
+	for (i = 0; i < argc; i++)
+		if (strcmp(argv[i], "<|") == 0)
+			nchannels++;
+		else
+			nfiles++;
+	if (nchannels > 0)
+		n_input_fds = nchannels;
+	else if (nfiles > 0)
+		n_input_fds = 1;
+	else
+		n_input_fds = -1;
+
+	dgsh_negotiate(DGSH_HANDLE_ERROR, tool_name, &n_input_fds,
+			noutputs, &input_fds, output_fds);
+	if (input_fds == NULL)
+		errx(1, "Unable to obtain %d input channels", n_input_fds);
+	DPRINTF(2, "Merging %d channels and %d files", n_input_fds, nfiles);
+
+	*ninputs = n_input_fds + nfiles;
+	if ((inputs = malloc(*ninputs * sizeof(*inputs))) == NULL)
+		err(1, NULL);
+
+	/* Open all inputs before reading to avoid blocking pipe writers */
+	for (i = 0; i < n_input_fds; i++) {
+		snprintf(name, sizeof(name), "channel %d", i);
+		merge_input_init(&inputs[i], input_fds[i],
+				i == 0 ? "stdin" : strdup(name));
+	}
+	for (j = 0; j < argc; j++) {
+		int fd;
+
+		if (strcmp(argv[j], "<|") == 0)
+			continue;
+		if ((fd = open(argv[j], O_RDONLY)) == -1)
+			err(2, "Error opening %s", argv[j]);
+		merge_input_init(&inputs[i++], fd, argv[j]);
+	}
+	return inputs;
+}
+
+/*
+ * Read more data into the buffer of the specified input.
+ * Return false at end of file.
+ */
+static bool
+fill_buffer(struct merge_input *in)
+{
+	ssize_t n;
+
+	if (in->eof)
+		return false;
+	if (in->begin > 0) {
+		memmove(in->buf, in->buf + in->begin, in->end - in->begin);
+		in->end -= in->begin;
+		in->begin = 0;
+	}
+	if (in->end == in->size) {
+		in->size *= 2;
+		if ((in->buf = realloc(in->buf, in->size)) == NULL)
+			err(1, NULL);
+	}
+	do
+		if (in->offset == -1)
+			n = read(in->fd, in->buf + in->end, in->size - in->end);
+		else
+			n = pread(in->fd, in->buf + in->end,
+					in->size - in->end, in->offset);
+	while (n == -1 && errno == EINTR);
+	if (n == -1)
+		err(2, "Error reading from %s", in->name);
+	if (n == 0) {
+		in->eof = true;
+		return false;
+	}
+	in->end += n;
+	if (in->offset != -1)
+		in->offset += n;
+	return true;
+}
+
+/*
+ * Read the next record of the specified input and set its key
+ * through key_fn.
+ * Return false at end of file.
+ */
+bool
+merge_read_record(struct merge_input *in, merge_key_fn key_fn)
+{
+	char *nl;
+
+	for (;;) {
+		nl = memchr(in->buf + in->begin, '\n', in->end - in->begin);
+		if (nl)
+			break;
+		if (!fill_buffer(in)) {
+			/* Handle a final line lacking a newline */
+			if (in->begin == in->end)
+				return false;
+			nl = in->buf + in->end;
+			break;
+		}
+	}
+
+	in->line = in->buf + in->begin;
+	in->linelen = nl - in->line;
+	in->begin = nl - in->buf + (nl < in->buf + in->end);
+	in->lineno++;
+	in->key = in->line;
+	in->keylen = in->linelen;
+	if (key_fn)
+		key_fn(in);
+	return true;
+}
+
+/* Return <0, 0, >0 comparing the current records of a and b */
+static inline int
+input_cmp(const struct merge_heap *h, const struct merge_input *a,
+		const struct merge_input *b)
+{
+	if (h->cmp)
+		return h->cmp(a, b);
+	return merge_keycmp(a->key, a->keylen, b->key, b->keylen);
+}
+
+/* Restore the heap property of the heap starting from i */
+static void
+sift_down(struct merge_heap *h, int i)
+{
+	struct merge_input **heap = h->heap;
+	struct merge_input *t = heap[i];
+	int child, n = h->n;
+
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n &&
+				input_cmp(h, heap[child + 1], heap[child]) < 0)
+			child++;
+		if (input_cmp(h, heap[child], t) >= 0)
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = t;
+}
+
+/* Read the first record of the inputs and arrange them into a heap */
+void
+merge_heap_init(struct merge_heap *h, struct merge_input *inputs,
+		int ninputs, merge_key_fn key_fn)
+{
+	merge_heap_init_cmp(h, inputs, ninputs, key_fn, NULL);
+}
+
+/*
+ * Read the first record of the inputs and arrange them into a heap
+ * ordered through cmp, which also compares the records' values.
+ */
+void
+merge_heap_init_cmp(struct merge_heap *h, struct merge_input *inputs,
+		int ninputs, merge_key_fn key_fn, merge_cmp_fn cmp)
+{
+	int i;
+
+	if ((h->heap = malloc(ninputs * sizeof(*h->heap))) == NULL)
+		err(1, NULL);
+	h->key_fn = key_fn;
+	h->cmp = cmp;
+	h->prev = NULL;
+	h->prevlen = h->prevsize = 0;
+	h->prevvalue = 0;
+	h->n = 0;
+	for (i = 0; i < ninputs; i++)
+		if (merge_read_record(&inputs[i], key_fn))
+			h->heap[h->n++] = &inputs[i];
+	for (i = h->n / 2 - 1; i >= 0; i--)
+		sift_down(h, i);
+}
+
+/*
+ * Consume the record at the top of the heap, saving its key in prev
+ * and its value in prevvalue, and advance its input, verifying that
+ * the input is sorted.
+ * Return false when all inputs have been exhausted.
+ */
+bool
+merge_heap_advance(struct merge_heap *h)
+{
+	struct merge_input *top = h->heap[0];
+
+	if (top->keylen > h->prevsize) {
+		h->prevsize = top->keylen * 2;
+		if ((h->prev = realloc(h->prev, h->prevsize)) == NULL)
+			err(1, NULL);
+	}
+	memcpy(h->prev, top->key, top->keylen);
+	h->prevlen = top->keylen;
+	h->prevvalue = top->value;
+
+	if (merge_read_record(top, h->key_fn)) {
+		struct merge_input prev;
+
+		prev.key = h->prev;
+		prev.keylen = h->prevlen;
+		prev.value = h->prevvalue;
+		if (input_cmp(h, top, &prev) < 0)
+			errx(1, "Input is not sorted: [%.*s] came after [%.*s]",
+					(int)top->keylen, top->key,
+					(int)h->prevlen, h->prev);
+	} else if (--h->n > 0)
+		h->heap[0] = h->heap[h->n];
+	else
+		return false;
+	sift_down(h, 0);
+	return true;
+}
+
+void
+merge_heap_free(struct merge_heap *h)
+{
+	free(h->heap);
+	free(h->prev);
+}
+
+/*
+ * Split the merging of more than fanin inputs into a tree of processes.
+ * Each child process merges (recursively) a subset of the inputs
+ * through fn into a pipe, and the inputs are replaced by the
+ * pipes' read ends, leaving at most fanin inputs for the caller.
+ */
+void
+merge_tree(struct merge_input **inputs, int *ninputs, int fanin, merge_fn fn)
+{
+	struct merge_input *in = *inputs, *subtrees;
+	int n = *ninputs;
+	int g, i, lo, hi;
+	char name[64];
+
+	if (fanin < 2 || n <= fanin)
+		return;
+
+	if ((subtrees = malloc(fanin * sizeof(*subtrees))) == NULL)
+		err(1, NULL);
+	if ((children = realloc(children,
+			(nchildren + fanin) * sizeof(*children))) == NULL)
+		err(1, NULL);
+	fflush(stdout);
+
+	for (g = 0; g < fanin; g++) {
+		int p[2];
+		pid_t pid;
+
+		lo = g * n / fanin;
+		hi = (g + 1) * n / fanin;
+		if (pipe(p) == -1)
+			err(1, "pipe");
+		switch (pid = fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			/* Keep only this subtree's inputs open */
+			close(p[0]);
+			for (i = 0; i < g; i++)
+				close(subtrees[i].fd);
+			for (i = 0; i < n; i++)
+				if ((i < lo || i >= hi) && in[i].fd != -1)
+					close(in[i].fd);
+			if (dup2(p[1], STDOUT_FILENO) == -1)
+				err(1, "dup2");
+			close(p[1]);
+			nchildren = 0;
+
+			in += lo;
+			n = hi - lo;
+			merge_tree(&in, &n, fanin, fn);
+			fn(in, n);
+			if (fflush(stdout) != 0)
+				err(3, "Error writing to stdout");
+			exit(merge_wait());
+		default:
+			DPRINTF(2, "Process %d merges inputs %d-%d",
+					(int)pid, lo, hi - 1);
+			children[nchildren++] = pid;
+			close(p[1]);
+			for (i = lo; i < hi; i++) {
+				close(in[i].fd);
+				in[i].fd = -1;
+				free(in[i].buf);
+			}
+			snprintf(name, sizeof(name), "merge of inputs %d-%d",
+					lo, hi - 1);
+			merge_input_init(&subtrees[g], p[0], strdup(name));
+		}
+	}
+	*inputs = subtrees;
+	*ninputs = fanin;
+}
+
+/*
+ * Wait for the merge tree's child processes to terminate.
+ * Return the exit status of the first one that failed, or 0.
+ */
+int
+merge_wait(void)
+{
+	int i, status, ret = 0;
+
+	for (i = 0; i < nchildren; i++) {
+		if (waitpid(children[i], &status, 0) == -1)
+			err(1, "waitpid");
+		if (ret == 0 && WIFEXITED(status))
+			ret = WEXITSTATUS(status);
+		else if (ret == 0)
+			ret = 1;
+	}
+	nchildren = 0;
+	return ret;
+}
+
+/*
+ * Create and return an anonymous temporary file in the specified
+ * directory, or, if dir is NULL, in the default one.
+ * The location follows tempnam rules (argument, TMPDIR,
+ * P_tmpdir, /tmp), while the creation through mkstemp
+ * avoids race conditions.
+ */
+int
+merge_temp_file(const char *dir)
+{
+	char *template;
+	int fd;
+
+	if ((template = tempnam(dir, "sg-")) == NULL)
+		err(1, "Unable to obtain temporary file name");
+	if ((template = realloc(template, strlen(template) + 7)) == NULL)
+		err(1, "Error obtaining temporary file name space");
+	strcat(template, "XXXXXX");
+	if ((fd = mkstemp(template)) == -1)
+		err(1, "Unable to create temporary file %s", template);
+	unlink(template);
+	free(template);
+	return fd;
+}
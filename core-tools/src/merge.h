@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Merge sorted input streams through a heap, optionally distributing
+ * the work across a tree of processes.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* An input stream of sorted records and its current record */
+struct merge_input {
+	int fd;
+	const char *name;
+	char *buf;		/* Read buffer */
+	size_t size;		/* Allocated buffer size */
+	size_t begin, end;	/* Unprocessed buffer data */
+	bool eof;		/* True when read returned 0 */
+	off_t offset;		/* Position to read through pread, or -1 */
+	unsigned long lineno;	/* Current line number */
+	const char *line;	/* Current record (points into buf) */
+	size_t linelen;		/* Its length, excluding the newline */
+	const char *key;	/* Current record's key */
+	size_t keylen;
+	uintmax_t value;	/* Numeric value, if any */
+};
+
+/* Set the key (and any other fields) of the input's current record */
+typedef void (*merge_key_fn)(struct merge_input *);
+
+/* Merge the specified inputs into the standard output */
+typedef void (*merge_fn)(struct merge_input *, int);
+
+/* Return <0, 0, >0 if the record of a is ordered before, with, or after b's */
+typedef int (*merge_cmp_fn)(const struct merge_input *,
+		const struct merge_input *);
+
+/* A heap of inputs, ordered by their current key or through cmp */
+struct merge_heap {
+	struct merge_input **heap;
+	int n;			/* Number of inputs with records */
+	merge_key_fn key_fn;
+	merge_cmp_fn cmp;	/* NULL for key order */
+	char *prev;		/* Key of the most recently consumed record */
+	size_t prevlen, prevsize;
+	uintmax_t prevvalue;	/* Its numeric value */
+};
+
+/* Return <0, 0, >0 comparing the two byte strings in C locale order */
+static inline int
+merge_keycmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+	int r = memcmp(a, b, alen < blen ? alen : blen);
+
+	if (r)
+		return r;
+	return (alen > blen) - (alen < blen);
+}
+
+struct merge_input *merge_open_inputs(const char *tool_name, int argc,
+		char *argv[], int *ninputs);
+struct merge_input *merge_open_channels(const char *tool_name, int argc,
+		char *argv[], int *ninputs, int *noutputs, int **output_fds);
+void merge_input_init(struct merge_input *in, int fd, const char *name);
+void merge_input_init_at(struct merge_input *in, int fd, const char *name,
+		off_t offset);
+bool merge_read_record(struct merge_input *in, merge_key_fn key_fn);
+void merge_heap_init(struct merge_heap *h, struct merge_input *inputs,
+		int ninputs, merge_key_fn key_fn);
+void merge_heap_init_cmp(struct merge_heap *h, struct merge_input *inputs,
+		int ninputs, merge_key_fn key_fn, merge_cmp_fn cmp);
+bool merge_heap_advance(struct merge_heap *h);
+void merge_heap_free(struct merge_heap *h);
+void merge_tree(struct merge_input **inputs, int *ninputs, int fanin,
+		merge_fn fn);
+int merge_wait(void);
+int merge_temp_file(const char *dir);
+
+#endif /* MERGE_H */
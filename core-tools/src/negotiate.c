@@ -53,6 +53,9 @@
 #ifdef TIME
 #include <time.h>
 static struct timespec tstart={0,0}, tend={0,0};
+/* Message block traffic generated by this process */
+static int mb_writes;
+static unsigned long mb_bytes_written;
 #endif
 
 /* Default negotiation timeout (s) */
@@ -118,6 +121,10 @@ struct dgsh_node_connections {
 						 * not yet binded to a pair
 						 * node's outgoing edges.
 						 */
+	bool reconvergent;			/* True if the node lies on
+						 * paths whose data meet
+						 * again downstream.
+						 */
 };
 
 /* The output of the negotiation process. */
@@ -149,6 +156,10 @@ static struct dgsh_node_pipe_fds self_pipe_fds;	/* A tool's read and write file
 						 */
 static bool init_error = false;
 static volatile sig_atomic_t negotiation_completed = 0;
+static pid_t graph_id = -1;		/* Identifier of the negotiated graph */
+static bool reconvergent = false;	/* On paths that meet downstream */
+static int *pass_through_order;		/* Input passed to each output */
+static int n_pass_through;		/* Number of permuted channels */
 int dgsh_debug_level = 0;
 
 static void get_environment_vars();
@@ -1207,6 +1218,158 @@ node_match_constraints(void)
 	return exit_state;
 }
 
+/**
+ * Mark in the solution the nodes that lie on reconvergent paths,
+ * that is paths that leave a node through different output channels
+ * and meet again at a downstream node.
+ * The node where such paths meet may read its inputs in a different
+ * order than the one in which they are produced, so to avoid a deadlock
+ * the tools on these paths must read their input even when their output
+ * is blocked.
+ * For each node, a traversal from each of its output channels counts
+ * the channels through which downstream nodes are reached; the nodes
+ * where channels meet, and their ancestors reachable from the node,
+ * are marked.
+ */
+STATIC enum op_result
+mark_reconvergent_paths(void)
+{
+	int i, j, f;
+	int n_nodes = chosen_mb->n_nodes;
+	int n_edges = chosen_mb->n_edges;
+	struct dgsh_edge *edges = chosen_mb->edge_array;
+	struct dgsh_node_connections *graph_solution =
+					chosen_mb->graph_solution;
+	enum op_result exit_state = OP_SUCCESS;
+	int *out_start, *in_start;	/* Edges of node i start at [i] */
+	int *out_edges, *in_edges;	/* Edge indices ordered by node */
+	int *channels;			/* Channels through which reached */
+	int *seen;			/* Traversal in which node was seen */
+	int *stack;
+	int sp, traversal = 0;
+
+	out_start = calloc(n_nodes + 1, sizeof(int));
+	in_start = calloc(n_nodes + 1, sizeof(int));
+	out_edges = malloc((n_edges + 1) * sizeof(int));
+	in_edges = malloc((n_edges + 1) * sizeof(int));
+	channels = malloc(n_nodes * sizeof(int));
+	seen = calloc(n_nodes, sizeof(int));
+	stack = malloc((n_nodes + 1) * sizeof(int));
+	if (!out_start || !in_start || !out_edges || !in_edges ||
+			!channels || !seen || !stack) {
+		DPRINTF(4, "ERROR: Failed to allocate memory for reconvergent path analysis.\n");
+		exit_state = OP_ERROR;
+		goto exit;
+	}
+
+	/* Index the connected edges by their origin and destination */
+	for (i = 0; i < n_edges; i++)
+		if (edges[i].instances > 0) {
+			out_start[edges[i].from + 1]++;
+			in_start[edges[i].to + 1]++;
+		}
+	for (i = 0; i < n_nodes; i++) {
+		out_start[i + 1] += out_start[i];
+		in_start[i + 1] += in_start[i];
+		graph_solution[i].reconvergent = false;
+	}
+	for (i = 0; i < n_edges; i++)
+		if (edges[i].instances > 0) {
+			out_edges[out_start[edges[i].from]++] = i;
+			in_edges[in_start[edges[i].to]++] = i;
+		}
+	/* Filling advanced each node's start index to the next node's one */
+	for (i = n_nodes; i > 0; i--) {
+		out_start[i] = out_start[i - 1];
+		in_start[i] = in_start[i - 1];
+	}
+	out_start[0] = in_start[0] = 0;
+
+	for (f = 0; f < n_nodes; f++) {
+		if (out_start[f + 1] - out_start[f] == 0)
+			continue;
+		for (i = 0; i < n_nodes; i++)
+			channels[i] = 0;
+
+		/* Count the channels through which each node is reached */
+		for (j = out_start[f]; j < out_start[f + 1]; j++) {
+			struct dgsh_edge *e = &edges[out_edges[j]];
+
+			traversal++;
+			sp = 0;
+			stack[sp++] = e->to;
+			seen[e->to] = traversal;
+			while (sp > 0) {
+				int n = stack[--sp];
+
+				channels[n] += e->instances;
+				for (i = out_start[n]; i < out_start[n + 1]; i++) {
+					int to = edges[out_edges[i]].to;
+
+					if (seen[to] != traversal) {
+						seen[to] = traversal;
+						stack[sp++] = to;
+					}
+				}
+			}
+		}
+
+		/*
+		 * Paths meet at nodes reached through many channels,
+		 * unless all these channels arrive through a single
+		 * predecessor other than f.
+		 */
+		traversal++;
+		sp = 0;
+		for (i = 0; i < n_nodes; i++) {
+			bool meet = channels[i] > 1;
+
+			for (j = in_start[i]; meet && j < in_start[i + 1]; j++) {
+				int from = edges[in_edges[j]].from;
+
+				if (from != f && channels[from] == channels[i])
+					meet = false;
+			}
+			if (meet) {
+				seen[i] = traversal;
+				stack[sp++] = i;
+			}
+		}
+		if (sp == 0)
+			continue;
+
+		/* Mark them and their ancestors that are reachable from f */
+		graph_solution[f].reconvergent = true;
+		while (sp > 0) {
+			int n = stack[--sp];
+
+			graph_solution[n].reconvergent = true;
+			for (i = in_start[n]; i < in_start[n + 1]; i++) {
+				int from = edges[in_edges[i]].from;
+
+				if (seen[from] != traversal && channels[from] > 0) {
+					seen[from] = traversal;
+					stack[sp++] = from;
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < n_nodes; i++)
+		if (graph_solution[i].reconvergent)
+			DPRINTF(2, "%s(): Node %s, pid: %d lies on reconvergent paths.",
+				__func__, chosen_mb->node_array[i].name,
+				chosen_mb->node_array[i].pid);
+exit:
+	free(out_start);
+	free(in_start);
+	free(out_edges);
+	free(in_edges);
+	free(channels);
+	free(seen);
+	free(stack);
+	return exit_state;
+}
 
 /**
  * This function implements the algorithm that tries to satisfy reported
@@ -1276,6 +1439,9 @@ solve_graph(void)
 	if ((exit_state = calculate_conc_fds()) == OP_ERROR)
 		goto exit;
 
+	if ((exit_state = mark_reconvergent_paths()) == OP_ERROR)
+		goto exit;
+
 	if ((filename = getenv("DGSH_DOT_DRAW")))
 		if ((exit_state = output_graph(filename)) == OP_ERROR)
 			goto exit;
@@ -1444,6 +1610,10 @@ retry:
 		retries++;
 		goto retry;
 	}
+#ifdef TIME
+	if (wsize > 0)
+		mb_bytes_written += wsize;
+#endif
 	return wsize;
 }
 
@@ -1459,6 +1629,8 @@ get_struct_size(int struct_type)
 			return sizeof(struct dgsh_conc);
 		case 4:
 			return sizeof(struct dgsh_node_connections);
+		case 5:
+			return sizeof(int);	/* Concentrator process ids */
 		}
 		return 0;
 }
@@ -1472,6 +1644,7 @@ do_write (int write_fd, void *datastruct, int datastruct_size, int struct_type)
 			prev_elements = 0, size, struct_size, i;
 
 		struct_size = get_struct_size(struct_type);
+		assert(struct_size > 0);
 		all_elements = datastruct_size / struct_size;
 		max_elements = IOV_MAX / struct_size;
 		pieces = all_elements / max_elements;
@@ -1515,6 +1688,12 @@ do_write (int write_fd, void *datastruct, int datastruct_size, int struct_type)
 						&((struct dgsh_node_connections *)
 						datastruct)[i * prev_elements],
 						size);
+					break;
+				case 5:
+					memcpy(struct_piece,
+						&((int *)
+						datastruct)[i * prev_elements],
+						size);
 				}
 				wsize = write_piece(write_fd, struct_piece,
 							size);
@@ -1644,6 +1823,9 @@ write_message_block(int write_fd)
 	struct dgsh_node *p_nodes = chosen_mb->node_array;
 
 	DPRINTF(3, "%s(): %s (%d)", __func__, programname, self_node.index);
+#ifdef TIME
+	mb_writes++;
+#endif
 
 	if (chosen_mb->state == PS_ERROR && errno == 0)
 		errno = EPROTO;
@@ -2110,6 +2292,7 @@ read_chunk(int read_fd, char *buf, int buf_size, int *bytes_read,
 			struct_size, all_elements, max_elements, elements = 0;
 
 		struct_size = get_struct_size(struct_type);
+		assert(struct_size > 0);
 		all_elements = buf_size / struct_size;
 		max_elements = IOV_MAX / struct_size;
 		pieces = all_elements / max_elements;
@@ -2691,6 +2874,122 @@ set_negotiation_complete()
 	negotiation_completed = 1;
 }
 
+#ifdef TIME
+/*
+ * Report the number of message block transmissions (hops) this
+ * process performed and the bytes they transferred
+ */
+void
+print_negotiation_statistics(void)
+{
+	fprintf(stderr, "The dgsh negotiation process %d wrote %d message blocks of %lu bytes\n",
+		(int)getpid(), mb_writes, mb_bytes_written);
+	fflush(stderr);
+}
+#endif
+
+/*
+ * Return an identifier of the graph in which the process negotiated
+ * its I/O channels, which is the same for all the graph's processes,
+ * or -1 if the process is not part of a negotiated graph.
+ */
+pid_t
+dgsh_graph_id(void)
+{
+	return graph_id;
+}
+
+/*
+ * Declare that the tool merely sends each of its n inputs to
+ * the output specified in the corresponding element of outputs,
+ * counting from 0.
+ * Return 0 on success, or -1 if outputs is not a permutation.
+ */
+int
+dgsh_permute(int n, const int *outputs)
+{
+	int i;
+	int *order;
+
+	if (n < 1 || (order = malloc(n * sizeof(int))) == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		order[i] = -1;
+	for (i = 0; i < n; i++) {
+		if (outputs[i] < 0 || outputs[i] >= n ||
+				order[outputs[i]] != -1) {
+			free(order);
+			errno = EINVAL;
+			return -1;
+		}
+		order[outputs[i]] = i;
+	}
+	free(pass_through_order);
+	pass_through_order = order;
+	n_pass_through = n;
+	return 0;
+}
+
+/*
+ * Return true if the tool merely copies its inputs to as many outputs,
+ * which lead to other tools of the graph, in the order declared through
+ * dgsh_permute() or, by default, its single input to its single output.
+ * Tools on reconvergent paths are kept, because they buffer their input,
+ * allowing the tool where the paths meet to read them in any order.
+ */
+static bool
+is_pass_through(int flags)
+{
+	int n = pass_through_order ? n_pass_through : 1;
+	int n_inputs = self_node.dgsh_in ? self_pipe_fds.n_input_fds : 1;
+
+	if (!(flags & DGSH_PASS_THROUGH) || !self_node.dgsh_out)
+		return false;
+	if (reconvergent)
+		return false;
+	return n_inputs == n && self_pipe_fds.n_output_fds == n;
+}
+
+/*
+ * Remove a pass-through tool from the data path, by handing its
+ * input file descriptors to the tools reading its outputs, and exit.
+ * This saves a process and the copying of all data through it.
+ */
+static void
+pass_through(int output_socket)
+{
+	int i;
+
+	for (i = 0; i < self_pipe_fds.n_output_fds; i++) {
+		int input = pass_through_order ? pass_through_order[i] : 0;
+		int fd = self_node.dgsh_in ?
+			self_pipe_fds.input_fds[input] : STDIN_FILENO;
+
+		DPRINTF(2, "%s(): %s (%d) hands its input fd %d to output %d.",
+				__func__, programname, self_node.index, fd, i);
+		write_fd(output_socket, fd);
+	}
+#ifdef TIME
+	print_negotiation_statistics();
+#endif
+	negotiation_completed = 1;
+	exit(EX_OK);
+}
+
+/*
+ * Return true if the negotiated solution places the process on paths
+ * whose data meet again at a downstream process.
+ * To avoid deadlocks, such processes should read all their input,
+ * buffering it as needed, even when their output is blocked.
+ */
+int
+dgsh_on_reconvergent_path(void)
+{
+	return reconvergent;
+}
+
 static int
 setup_file_descriptors(int *n_input_fds, int *n_output_fds,
 		int **input_fds, int **output_fds)
@@ -2955,17 +3254,23 @@ exit:
 			programname, self_node.index, isread ? "read" : "write",
 			state_name(chosen_mb->state));
 	if (chosen_mb->state == PS_COMPLETE) {
+		reconvergent = chosen_mb->graph_solution[
+			self_node.index].reconvergent;
 		if (alloc_io_fds() == OP_ERROR)
 			chosen_mb->state = PS_ERROR;
 		if (read_input_fds(STDIN_FILENO, self_pipe_fds.input_fds) ==
 									OP_ERROR)
 			chosen_mb->state = PS_ERROR;
+		if (chosen_mb->state == PS_COMPLETE && is_pass_through(flags))
+			pass_through(STDOUT_FILENO);
 		if (write_output_fds(STDOUT_FILENO,
 				self_pipe_fds.output_fds, flags) == OP_ERROR)
 			chosen_mb->state = PS_ERROR;
 		if (establish_io_connections(input_fds, n_input_fds, output_fds,
 						n_output_fds) == OP_ERROR)
 			chosen_mb->state = PS_ERROR;
+		if (chosen_mb->state == PS_COMPLETE)
+			graph_id = chosen_mb->initiator_pid;
 	} else if (chosen_mb->state == PS_DRAW_EXIT) {
 		if (n_input_fds != NULL)
 			*n_input_fds = 0;
@@ -2981,6 +3286,7 @@ exit:
 			((double)tstart.tv_sec + 1.0e-9*tstart.tv_nsec));
 		fflush(stderr);
 	}
+	print_negotiation_statistics();
 #endif
 	free_mb(chosen_mb);
 	negotiation_completed = 1;
@@ -178,5 +178,8 @@ void write_fd(int output_socket, int fd_to_write);
 /* Alarm mechanism and on_exit handling */
 void set_negotiation_complete();
 void dgsh_alarm_handler(int);
+#ifdef TIME
+void print_negotiation_statistics(void);
+#endif
 
 #endif /* NEGOTIATE_H */
@@ -0,0 +1,67 @@
+#!/usr/bin/env bash
+#
+# Tests for dgsh-count
+#
+
+COUNT=../src/dgsh-count
+
+export LC_ALL=C
+
+# Test input: the words of a text, one per line
+INPUT=count.in
+tr -cs a-zA-Z \\n <word-properties/LostWorldChap1-3 >$INPUT
+
+# Compare the output of dgsh-count with that of an equivalent pipeline
+# Arguments: test name, pipeline, dgsh-count arguments
+testcase()
+{
+	local name="$1"
+	local expect="$2"
+	shift 2
+	if ! diff <($COUNT "$@" <$INPUT) <(eval "$expect" <$INPUT)
+	then
+		echo 1>&2 "Test $name failed"
+		exit 1
+	else
+		echo 1>&2 "Test $name OK"
+	fi
+}
+
+testcase ranked 'sort | uniq -c | sort -rn'
+testcase top 'sort | uniq -c | sort -rn | head -15' -k 15
+testcase sorted 'sort | uniq -c' -s
+
+# Add up counts, as output by uniq -c
+if ! diff <(sort $INPUT | uniq -c | $COUNT -c) \
+	<(sort $INPUT | uniq -c | sort -rn)
+then
+	echo 1>&2 "Test counted failed"
+	exit 1
+else
+	echo 1>&2 "Test counted OK"
+fi
+
+# Temporary files holding parts of the counts
+testcase spill-ranked 'sort | uniq -c | sort -rn' -m 64k
+testcase spill-top 'sort | uniq -c | sort -rn | head -15' -m 64k -k 15
+testcase spill-sorted 'sort | uniq -c' -m 64k -s
+
+# Ranking that writes and merges more runs than can be open at once
+awk 'BEGIN { for (i = 0; i < 200000; i++) print "k" (i * i) % 30011 }' \
+	>count.many
+if ! diff <($COUNT -m 4k <count.many) <(sort count.many | uniq -c | sort -rn)
+then
+	echo 1>&2 "Test spill-ranked-many failed"
+	exit 1
+else
+	echo 1>&2 "Test spill-ranked-many OK"
+fi
+
+# Parallel counting of the standard input and multiple files
+split -n l/3 $INPUT count.part.
+testcase parallel 'cat - count.part.* | sort | uniq -c | sort -rn' \
+	count.part.*
+testcase parallel-spill 'cat - count.part.* | sort | uniq -c | sort -rn' \
+	-j 2 -m 64k count.part.*
+
+rm -f count.in count.part.* count.many
@@ -0,0 +1,88 @@
+#!/usr/bin/env bash
+#
+# Tests for dgsh-cut
+#
+
+CUT=../src/dgsh-cut
+
+# Shortcut
+testcase()
+{
+	local name="$1"
+	local expect="$2"
+	local in="$3"
+	shift 3
+	if ! diff <($CUT "$@" <"$in") $expect
+	then
+		echo 1>&2 "Test $name failed"
+		exit 1
+	else
+		echo 1>&2 "Test $name OK"
+	fi
+}
+
+testcase blanks <(cat <<RESULT
+b c
+d
+
+RESULT
+) <(cat <<EOF
+  a  b	c  d
+a d
+
+EOF
+) -f 2-3
+
+testcase last <(cat <<RESULT
+d a
+d a
+e e
+x x
+RESULT
+) <(cat <<EOF
+  a  b	c  d
+a d
+  e
+x
+EOF
+) -f NF,1
+
+testcase rest <(cat <<RESULT
+b	c  d
+d
+
+RESULT
+) <(cat <<EOF
+  a  b	c  d
+a d
+x
+EOF
+) -f 2-
+
+testcase separator <(cat <<RESULT
+b:c:c:a:b:c
+:::::
+::x:
+RESULT
+) <(cat <<EOF
+a:b:c
+::
+x:
+EOF
+) -d : -f 2-3,NF,0
+
+# Compare each output with the equivalent awk(1) invocation
+$CUT -f 1 -f 1,NF -f 0 -f 7 -o cut.out0 -o cut.out1 -o cut.out2 -o cut.out3 \
+	web-log-report/logfile
+if ! diff cut.out0 <(awk '{print $1}' web-log-report/logfile) ||
+	! diff cut.out1 <(awk '{print $1, $NF}' web-log-report/logfile) ||
+	! diff cut.out2 web-log-report/logfile ||
+	! diff cut.out3 <(awk '{print $7}' web-log-report/logfile)
+then
+	echo 1>&2 "Test outputs failed"
+	exit 1
+else
+	echo 1>&2 "Test outputs OK"
+fi
+
+rm -f cut.out*
@@ -0,0 +1,129 @@
+#!/bin/sh
+#
+# Regression tests for dgsh-fft-input
+#
+
+TOP=$(cd ../.. ; pwd)
+DGSH="$TOP/build/bin/dgsh"
+PATH="$TOP/build/bin:$PATH"
+export DGSHPATH="$TOP/build/libexec/dgsh"
+
+# Output the values of the framed doubles read from the standard input,
+# one per line
+decode()
+{
+	perl -e '
+	binmode STDIN;
+	while (read(STDIN, $h, 16) == 16) {
+		($magic, $type, $count) = unpack("a4 L Q", $h);
+		die "Bad frame\n" unless $magic eq "DgF1" && $type == 1;
+		read(STDIN, $d, 8 * $count) == 8 * $count or die "Short frame\n";
+		printf("%.17g\n", $_) for unpack("d*", $d);
+	}'
+}
+
+# Output the number of frames read from the standard input
+nframes()
+{
+	perl -e '
+	binmode STDIN;
+	while (read(STDIN, $h, 16) == 16) {
+		($magic, $type, $count) = unpack("a4 L Q", $h);
+		read(STDIN, $d, 8 * $count);
+		$n++;
+	}
+	print $n + 0, "\n"'
+}
+
+# Ensure that the files passed as 2nd and 3rd arguments are the same
+ensure_same()
+{
+	echo -n "$1 "
+	if ! diff $2 $3 >/dev/null
+	then
+		echo "$1: $2 and $3 differ" 1>&2
+		exit 1
+	fi
+	echo OK
+}
+
+# Distribute the file fft.in, or the standard input, to four outputs
+# with the specified options, and ensure that output i receives the
+# samples at positions p[i] of each vector
+# Arguments: test name, dgsh-fft-input options, input file (or empty),
+# positions of the samples received by each output
+distribute()
+{
+	local name="$1" flags="$2" file="$3"
+	shift 3
+	$DGSH -c "dgsh-fft-input -n 4 $flags $file |
+		dgsh-tee -o fft.o0 -o fft.o1 -o fft.o2 -o fft.o3"
+	for i in 0 1 2 3
+	do
+		decode <fft.o$i >fft.out
+		awk "NR % 4 == ($1 + 1) % 4" fft.txt >fft.expected
+		ensure_same "$name output $i" fft.expected fft.out
+		shift
+	done
+}
+
+# Vectors of four samples, as text and as binary doubles, larger than
+# the size read at a time
+awk 'BEGIN {for (i = 1; i <= 200000; i++) printf("%.17g\n", i / 7)}' >fft.txt
+perl -ne 'print pack("d", $_)' fft.txt >fft.bin
+
+# Text input, mapped from a file, and read through a pipe
+cp fft.txt fft.in
+distribute "Mapped text" '' fft.in 0 1 2 3
+cat fft.in | distribute "Piped text" '' '' 0 1 2 3
+
+# Binary input
+cp fft.bin fft.in
+distribute "Mapped binary" -B fft.in 0 1 2 3
+cat fft.in | distribute "Piped binary" -B '' 0 1 2 3
+
+# Bit-reversed order sends sample j to output bitrev(j)
+cp fft.txt fft.in
+distribute "Bit-reversed" -r fft.in 0 2 1 3
+cp fft.bin fft.in
+distribute "Bit-reversed binary" '-r -B' fft.in 0 2 1 3
+
+# Blocks of 7 vectors produce ceil(50000 / 7) frames per output,
+# with the same values
+cp fft.txt fft.in
+distribute "Block" '-b 7' fft.in 0 1 2 3
+echo 7143 >fft.expected
+nframes <fft.o1 >fft.out
+ensure_same "Block frames" fft.expected fft.out
+cat fft.in | distribute "Piped block" '-b 7' '' 0 1 2 3
+cp fft.bin fft.in
+distribute "Binary block" '-B -b 7' fft.in 0 1 2 3
+
+# A mapped file whose last line lacks a newline, and whose last
+# vector is incomplete, which is padded with zeros
+printf '1\n2\n3\n4\n5\n6' >fft.in
+$DGSH -c "dgsh-fft-input -n 4 fft.in |
+	dgsh-tee -o fft.o0 -o fft.o1 -o fft.o2 -o fft.o3" 2>fft.err
+cat fft.o0 fft.o1 fft.o2 fft.o3 | decode >fft.out
+printf '%s\n' 1 5 2 6 3 0 4 0 >fft.expected
+ensure_same "Final line and padding" fft.expected fft.out
+echo -n "Padding warning "
+if ! grep -q 'Padding the last vector with zeros' fft.err
+then
+	echo "Padding warning: not reported" 1>&2
+	exit 1
+fi
+echo OK
+
+# Bit-reversed order requires a power of two outputs
+echo -n "Bit-reversed outputs "
+if $DGSH -c "dgsh-fft-input -r -n 3 fft.in |
+	dgsh-tee -o fft.o0 -o fft.o1 -o fft.o2" 2>/dev/null
+then
+	echo "Bit-reversed outputs: three outputs accepted" 1>&2
+	exit 1
+fi
+echo OK
+
+rm -f fft.txt fft.bin fft.in fft.o0 fft.o1 fft.o2 fft.o3 fft.out \
+	fft.expected fft.err
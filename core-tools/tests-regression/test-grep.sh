@@ -0,0 +1,74 @@
+#!/usr/bin/env bash
+#
+# Tests for dgsh-grep
+#
+
+GREP=../src/dgsh-grep
+
+# Test input: the line numbers of this file followed by its lines
+INPUT=test-grep.in
+cat -n $0 >$INPUT
+
+# Compare each of dgsh-grep's outputs with that of an equivalent
+# grep(1) invocation
+# Arguments: test name, grep flags, dgsh-grep pattern options
+testcase()
+{
+	local name="$1"
+	local flags="$2"
+	shift 2
+
+	local i=0
+	local opts=()
+	local expect=()
+	while [ $# -gt 0 ] ; do
+		opts+=("$1" "$2" -o test-grep.out$i)
+		if [ "$1" = -v ] ; then
+			grep -v $flags -e "$2" $INPUT >test-grep.expect$i
+		else
+			grep $flags -e "$2" $INPUT >test-grep.expect$i
+		fi
+		i=$((i + 1))
+		shift 2
+	done
+	if ! $GREP $flags "${opts[@]}" $INPUT
+	then
+		echo 1>&2 "Test $name failed"
+		exit 1
+	fi
+	while [ $i -gt 0 ] ; do
+		i=$((i - 1))
+		if ! diff test-grep.out$i test-grep.expect$i
+		then
+			echo 1>&2 "Test $name failed"
+			exit 1
+		fi
+	done
+	echo 1>&2 "Test $name OK"
+}
+
+testcase fixed -F -e local -e shift -v opts -e 'no such string'
+testcase basic '' -e '^#' -e 'ex\(pec\)*t' -v '[0-9]\{2,\}' -e '.'
+testcase extended -E -e '(local|shift)' -e 'i=\$\(\(i [-+] 1' -v 'opts|name'
+testcase icase -i -e ECHO -e 'te.*CASE' -v GREP
+testcase word -Fw -e i -e test -v name
+
+# Enough distinct fixed strings to grow the automaton's states
+for i in $(seq 40) ; do
+	echo $i | md5sum | cut -c 1-12
+done >test-grep.many
+cat test-grep.many test-grep.many >>$INPUT
+testcase many -F $(sed 's/^/-e /' test-grep.many)
+
+# Count the selected lines
+$GREP -c -F -e testcase -v testcase -o test-grep.out0 -o test-grep.out1 <$INPUT
+if ! diff <(cat test-grep.out0 test-grep.out1) \
+	<(grep -c testcase $INPUT ; grep -vc testcase $INPUT)
+then
+	echo 1>&2 "Test count failed"
+	exit 1
+else
+	echo 1>&2 "Test count OK"
+fi
+
+rm -f test-grep.in test-grep.many test-grep.out* test-grep.expect*
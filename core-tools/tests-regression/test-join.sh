@@ -0,0 +1,102 @@
+#!/usr/bin/env bash
+#
+# Tests for dgsh-join
+#
+
+JOIN=../src/dgsh-join
+
+export LC_ALL=C
+
+# Test inputs: the words of a text, a dictionary of some of them,
+# and tables keyed by the words
+tr -cs A-Za-z \\n <word-properties/LostWorldChap1-3 | tr A-Z a-z >join.words
+sort -u join.words | awk 'NR % 3 == 0' >join.dict
+awk '{print NR % 50, $0}' join.words >join.left
+awk '{print $0, NR}' join.dict >join.right
+
+# Compare the output of dgsh-join with that of an equivalent pipeline
+# Arguments: test name, pipeline, dgsh-join input, its output filter,
+# dgsh-join arguments
+testcase()
+{
+	local name="$1"
+	local expect="$2"
+	local in="$3"
+	local filter="$4"
+	shift 4
+	if ! diff <($JOIN "$@" <$in | $filter) <(eval "$expect")
+	then
+		echo 1>&2 "Test $name failed"
+		exit 1
+	else
+		echo 1>&2 "Test $name OK"
+	fi
+}
+
+# Set operations preserve the order of the first input
+testcase difference \
+	"awk 'NR == FNR {d[\$0]; next} !(\$0 in d) && !s[\$0]++' join.dict join.words" \
+	join.words cat -d join.dict
+testcase intersection \
+	"awk 'NR == FNR {d[\$0]; next} \$0 in d && !s[\$0]++' join.dict join.words" \
+	join.words cat -i join.dict
+testcase semi 'grep -Fxf join.dict join.words' \
+	join.words cat -s -1 0 -2 0 join.dict
+testcase anti 'grep -vFxf join.dict join.words' \
+	join.words cat -v -1 0 -2 0 join.dict
+
+# Joins, compared with those of sorted inputs
+testcase inner \
+	'join -1 2 <(sort -k2,2 join.left) <(sort join.right) | sort' \
+	join.left sort -1 2 join.right
+testcase left \
+	'join -a 1 -1 2 <(sort -k2,2 join.left) <(sort join.right) | sort' \
+	join.left sort -a -1 2 join.right
+
+# Temporary files holding partitions of the inputs
+testcase difference-spill \
+	'comm -23 <(sort -u join.words) join.dict' \
+	join.words sort -m 16k -d join.dict
+testcase left-spill \
+	'join -a 1 -1 2 <(sort -k2,2 join.left) <(sort join.right) | sort' \
+	join.left sort -m 16k -a -1 2 join.right
+
+# Multiple records with the same key in multiple inputs
+cat >join.in1 <<EOF
+k:1
+k:2
+m:3
+EOF
+cat >join.in2 <<EOF
+k:x
+m:z
+k:y
+q:w
+EOF
+testcase multiple "cat <<EOF
+k:L:1:x
+k:L:1:y
+k:L:2:x
+k:L:2:y
+m:M:3:z
+n:N
+EOF
+" <(printf 'k:L\nm:M\nn:N\n') cat -a -t : join.in1 join.in2
+
+# Set operations with multiple other inputs: the difference is taken
+# from their union, the intersection from their intersection
+printf 'a\nb\nc\nd\n' >join.a
+printf 'a\nb\n' >join.b
+printf 'b\nc\n' >join.c
+testcase difference-multiple 'echo d' join.a cat -d join.b join.c
+testcase intersection-multiple 'echo b' join.a cat -i join.b join.c
+testcase anti-multiple 'printf "a\nc\nd\n"' join.a cat -v -1 0 -2 0 join.b join.c
+
+# The same, with temporary files holding partitions of the inputs
+awk 'NR % 2' join.dict >join.b
+awk 'NR % 3' join.dict >join.c
+testcase difference-multiple-spill \
+	'comm -23 <(sort -u join.words) <(sort -u join.b join.c)' \
+	join.words sort -m 16k -d join.b join.c
+
+rm -f join.*
@@ -0,0 +1,80 @@
+#!/usr/bin/env bash
+#
+# Tests for dgsh-merge-aggregate
+#
+
+MERGE_AGGREGATE=../src/dgsh-merge-aggregate
+
+# Shortcut
+testcase()
+{
+	local name="$1"
+	local expect="$2"
+	local in="$3"
+	shift 3
+	if ! diff <($MERGE_AGGREGATE "$@" <"$in") $expect
+	then
+		echo 1>&2 "Test $name failed"
+		exit 1
+	else
+		echo 1>&2 "Test $name OK"
+	fi
+}
+
+# Behave like dgsh-merge-sum
+testcase sum <(cat <<RESULT
+1 a
+10 b
+4 c
+RESULT
+) <(cat <<EOF
+  1 a
+  5 b
+EOF
+) -k 2 -a sum:1 <(cat <<EOF
+5 b
+4 c
+EOF
+)
+
+testcase functions <(cat <<RESULT
+4 13 1 5 x q 3 a
+1 2 2 2 z z 1 b
+1 7 7 7 z z 1 c
+RESULT
+) <(cat <<EOF
+a 1 x
+a 5 y
+a 3 x
+b 2 z
+EOF
+) -k 1,1 -a count -a sum:2 -a min:2 -a max:2 -a first:3 -a last:3 \
+	-a distinct:3 <(cat <<EOF
+a 4 q
+c 7 z
+EOF
+)
+
+testcase separator <(cat <<RESULT
+1:a:x
+5:b:y
+RESULT
+) <(cat <<EOF
+a:x:1
+b:y:2
+EOF
+) -d : -k 1,2 -a sum:3 <(cat <<EOF
+b:y:3
+EOF
+)
+
+# Approximate distinct count
+n=$(seq 100000 | sed 's/^/k /' | $MERGE_AGGREGATE -k 1,1 -a distinct:2 |
+	cut -d ' ' -f 1)
+if [ "$n" -lt 97000 ] || [ "$n" -gt 103000 ]
+then
+	echo 1>&2 "Test distinct failed: $n"
+	exit 1
+else
+	echo 1>&2 "Test distinct OK"
+fi
@@ -3,7 +3,7 @@
 # Tests for dgsh-merge-sum
 #
 
-MERGE_SUM=../src/dgsh-merge-sum.pl
+MERGE_SUM=../src/dgsh-merge-sum
 
 # Shortcut
 testcase()
@@ -12,7 +12,7 @@ testcase()
 	local expect="$2"
 	local in="$3"
 	shift 3
-	if ! diff <(perl $MERGE_SUM <"$in" "$@") $expect
+	if ! diff <($MERGE_SUM <"$in" "$@") $expect
 	then
 		echo 1>&2 "Test $name failed"
 		exit 1
@@ -136,3 +136,56 @@ EOF
 8 z
 EOF
 )
+
+# Repeated keys within a file
+testcase repeated <(cat <<RESULT
+3 a
+4 c
+RESULT
+) <(cat <<EOF
+1 a
+2 a
+EOF
+) <(cat <<EOF
+4 c
+EOF
+)
+
+# Unsorted input
+if $MERGE_SUM <<EOF 2>/dev/null >/dev/null
+1 b
+1 a
+EOF
+then
+	echo 1>&2 "Test unsorted failed"
+	exit 1
+else
+	echo 1>&2 "Test unsorted OK"
+fi
+
+# Tree of merge processes
+testcase tree <(cat <<RESULT
+2 a
+11 b
+4 c
+2 d
+9 z
+RESULT
+) <(cat <<EOF
+1 a
+1 b
+EOF
+) -t 2 <(cat <<EOF
+1 a
+5 b
+2 d
+1 z
+EOF
+) <(cat <<EOF
+5 b
+4 c
+EOF
+) <(cat <<EOF
+8 z
+EOF
+)
@@ -0,0 +1,86 @@
+#!/usr/bin/env bash
+#
+# Tests for dgsh-merge
+#
+
+MERGE=../src/dgsh-merge
+
+# Shortcut
+testcase()
+{
+	local name="$1"
+	local expect="$2"
+	local in="$3"
+	shift 3
+	if ! diff <($MERGE "$@" <"$in") $expect
+	then
+		echo 1>&2 "Test $name failed"
+		exit 1
+	else
+		echo 1>&2 "Test $name OK"
+	fi
+}
+
+testcase merge <(cat <<RESULT
+a
+b
+b
+c
+d
+RESULT
+) <(cat <<EOF
+a
+b
+d
+EOF
+) <(cat <<EOF
+b
+c
+EOF
+)
+
+testcase unique <(cat <<RESULT
+a
+b
+c
+d
+RESULT
+) <(cat <<EOF
+a
+b
+d
+EOF
+) -u <(cat <<EOF
+b
+c
+EOF
+)
+
+# Byte-wise order and a missing final newline
+testcase bytes <(cat <<RESULT
+A
+B
+a
+b
+RESULT
+) <(printf 'A\na') <(cat <<EOF
+B
+b
+EOF
+)
+
+# Tree of merge processes
+testcase tree <(seq 1 9 | sort) <(printf '1\n4\n') -t 2 \
+	<(printf '2\n5\n') <(printf '3\n6\n9\n') <(printf '7\n8\n')
+
+# Unsorted input
+if $MERGE <<EOF 2>/dev/null >/dev/null
+b
+a
+EOF
+then
+	echo 1>&2 "Test unsorted failed"
+	exit 1
+else
+	echo 1>&2 "Test unsorted OK"
+fi
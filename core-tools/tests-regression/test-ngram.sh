@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+#
+# Tests for dgsh-ngram
+#
+
+NGRAM=../src/dgsh-ngram
+
+export LC_ALL=C
+
+INPUT=word-properties/LostWorldChap1-3
+
+# Output the character n-grams of the specified size of the input's words
+ngram()
+{
+	tr -cs a-zA-Z \\n |
+	perl -ne 'for ($i = 0; $i < length($_) - '$1'; $i++) {
+		print substr($_, $i, '$1'), "\n"; }'
+}
+
+# Compare the specified output with that of an equivalent pipeline
+# Arguments: test name, output file, pipeline
+testcase()
+{
+	local name="$1"
+	local out="$2"
+	local expect="$3"
+	if ! diff $out <(eval "$expect" <$INPUT)
+	then
+		echo 1>&2 "Test $name failed"
+		exit 1
+	else
+		echo 1>&2 "Test $name OK"
+	fi
+}
+
+$NGRAM -w -n 2 -n 3 -o ngram.out0 -o ngram.out1 -o ngram.out2 $INPUT </dev/null
+testcase words ngram.out0 "tr -cs a-zA-Z \\\\n | sed '/^$/d'"
+testcase digrams ngram.out1 'ngram 2'
+testcase trigrams ngram.out2 'ngram 3'
+
+# Words spanning read buffers; standard input
+perl -e 'print "a" x 300000, " ", "b" x 3, "\n"' >ngram.in
+$NGRAM -w -n 300000 -o ngram.out0 -o ngram.out1 <ngram.in
+if ! diff ngram.out0 <(perl -e 'print "a" x 300000, "\n", "b" x 3, "\n"') ||
+	! diff ngram.out1 <(perl -e 'print "a" x 300000, "\n"')
+then
+	echo 1>&2 "Test long failed"
+	exit 1
+else
+	echo 1>&2 "Test long OK"
+fi
+
+rm -f ngram.in ngram.out*
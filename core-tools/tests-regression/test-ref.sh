@@ -0,0 +1,63 @@
+#!/usr/bin/env bash
+#
+# Tests for dgsh-ref
+#
+
+REF=../src/dgsh-ref
+
+export LC_ALL=C
+
+# Test inputs: the words of a text, and a reference file of some of them
+CACHE=ref.cache
+rm -rf $CACHE
+tr -cs A-Za-z \\n <word-properties/LostWorldChap1-3 | tr A-Z a-z >ref.words
+awk 'NR % 7 == 0' ref.words >ref.dict
+
+# Compare the output of dgsh-ref with that of an equivalent pipeline
+# Arguments: test name, pipeline, dgsh-ref arguments
+testcase()
+{
+	local name="$1"
+	local expect="$2"
+	shift 2
+	if ! diff <($REF -c $CACHE "$@" <ref.words) <(eval "$expect")
+	then
+		echo 1>&2 "Test $name failed"
+		exit 1
+	else
+		echo 1>&2 "Test $name OK"
+	fi
+}
+
+testcase sorted 'sort ref.dict' ref.dict
+if ! [ -s $CACHE/ref.dict.*.ref ]
+then
+	echo 1>&2 "Test cached failed"
+	exit 1
+else
+	echo 1>&2 "Test cached OK"
+fi
+testcase sorted-cached 'sort ref.dict' ref.dict
+testcase unique 'sort -u ref.dict' -u ref.dict
+testcase lookup 'grep -Fxf ref.dict ref.words' -l ref.dict
+testcase lookup-absent 'grep -vFxf ref.dict ref.words' -v ref.dict
+
+# A changed file invalidates its index
+echo zzz >>ref.dict
+testcase changed 'sort ref.dict' ref.dict
+
+# A rewrite in place of the same size within the same second
+printf 'a\nb\n' >ref.dict
+touch -d 2020-01-01T00:00:00.1 ref.dict
+testcase same-second-old 'printf "a\nb\n"' ref.dict
+printf 'c\nd\n' >ref.dict
+touch -d 2020-01-01T00:00:00.2 ref.dict
+testcase same-second-new 'printf "c\nd\n"' ref.dict
+
+# Lines lacking a final newline, and empty files
+printf 'b\na' >ref.dict
+testcase final-line 'printf "a\nb\n"' ref.dict
+: >ref.dict
+testcase empty 'true' ref.dict
+
+rm -rf $CACHE ref.words ref.dict
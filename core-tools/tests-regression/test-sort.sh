@@ -0,0 +1,80 @@
+#!/usr/bin/env bash
+#
+# Tests for dgsh-sort
+#
+
+SORT=../src/dgsh-sort
+
+export LC_ALL=C
+
+# Test input: the words of a text, one per line, enough to be
+# sorted by multiple processes
+INPUT=sort.in
+tr -cs a-zA-Z \\n <word-properties/LostWorldChap1-3 >sort.words
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 ; do
+	sed "s/\$/$i/" sort.words
+done >$INPUT
+
+# Compare the output of dgsh-sort with that of sort(1)
+# Arguments: test name, sort arguments, dgsh-sort arguments
+testcase()
+{
+	local name="$1"
+	local expect="$2"
+	shift 2
+	if ! diff <($SORT "$@" <$INPUT) <(sort $expect <$INPUT)
+	then
+		echo 1>&2 "Test $name failed"
+		exit 1
+	else
+		echo 1>&2 "Test $name OK"
+	fi
+}
+
+testcase sorted '' -j 1
+testcase unique -u -j 1 -u
+testcase parallel '' -j 3
+testcase parallel-unique -u -j 3 -u
+testcase spill '' -j 1 -m 256k
+testcase parallel-spill-unique -u -j 3 -m 256k -u
+
+# Range-partitioned outputs, also of the standard input and a file
+# Arguments: test name, dgsh-sort arguments
+partitions()
+{
+	local name="$1"
+	shift
+	$SORT -o sort.out0 -o sort.out1 -o sort.out2 "$@" sort.words <$INPUT
+	if ! diff <(cat sort.out0 sort.out1 sort.out2) \
+		<(sort $INPUT sort.words) ||
+		# Outputs are not empty, and equal lines are not divided
+		[ ! -s sort.out0 -o ! -s sort.out1 -o ! -s sort.out2 ] ||
+		[ "$(tail -1 sort.out0)" = "$(head -1 sort.out1)" ] ||
+		[ "$(tail -1 sort.out1)" = "$(head -1 sort.out2)" ]
+	then
+		echo 1>&2 "Test $name failed"
+		exit 1
+	else
+		echo 1>&2 "Test $name OK"
+	fi
+}
+
+partitions partitions -j 2
+partitions partitions-spill -j 2 -m 256k
+
+# Partitions of spilled runs that cover different ranges of lines
+# are balanced
+seq -w 1 100000 >sort.seq
+$SORT -o sort.out0 -o sort.out1 -o sort.out2 -o sort.out3 -m 64k <sort.seq
+for i in 0 1 2 3 ; do
+	n=$(wc -l <sort.out$i)
+	if ! diff <(cat sort.out0 sort.out1 sort.out2 sort.out3) sort.seq ||
+		[ $n -lt 20000 -o $n -gt 30000 ]
+	then
+		echo 1>&2 "Test partitions-balance failed"
+		exit 1
+	fi
+done
+echo 1>&2 "Test partitions-balance OK"
+
+rm -f sort.in sort.words sort.seq sort.out*
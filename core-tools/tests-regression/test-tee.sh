@@ -103,6 +103,14 @@ do
 	done
 	rm a
 
+	# Test scatter to sinks pinned to CPUs
+	$DGSH -c "
+	dgsh-tee -s -i words |
+	dgsh-parallel -a -n auto cat |
+	sort -mn >a"
+	ensure_same "Scatter to pinned sinks $flags" words a
+	rm a
+
 	# Test line scatter efficient algorithm
 	$DGSH_TEE $flags -s -b 128 <words -o a -o b -o c -o d
 	cat a b c d | sort -n >words2
@@ -159,6 +167,18 @@ do
 	ensure_same "Stdout $flags" $DGSH_TEE_C a
 	rm a
 
+	# Test that the input is closed when all sinks exit
+	yes | $DGSH_TEE $flags | head -1 >a
+	echo y >b
+	ensure_same "Early termination $flags" a b
+	rm a b
+
+	# Test sampling records to a lossy output
+	seq 1 10000 | $DGSH_TEE $flags -d 2:10 -o a -o b
+	seq 1 10 10000 >c
+	ensure_same "Lossy output sampling $flags" b c
+	rm a b c
+
 	# Test buffering
 	# When -l is supported add, say, -l 16
 	for flags2 in '' '-m 2k' '-m 2k -f'
@@ -217,4 +237,49 @@ do
 	rm -f a b c d expect
 done
 
+# Test chained input FIFOs whose first producer is slow, so that the
+# others are read ahead, with a memory limit smaller than their data
+for flags in '' -f
+do
+	rm -f a b c d
+	mkfifo a b c
+	{ sleep 1 ; cat $DGSH_TEE_C ; } >a &
+	cat $WORDS >b &
+	cat $WORDS $DGSH_TEE_C >c &
+	$DGSH_TEE -b 4096 -m 16k $flags -i a -i b -i c >d
+	wait
+	cat $DGSH_TEE_C $WORDS $WORDS $DGSH_TEE_C >expect
+	ensure_same "Slow chained input $flags" expect d
+	rm -f a b c d expect
+done
+
+# Test that a dgsh-tee merely copying its input leaves the data path,
+# unless options make it buffer its input, drop data, or report statistics
+for flags in '' -I -M '-d 1'
+do
+	DGSH_DEBUG_LEVEL=2 $DGSH -c "$DGSH_ENUMERATE 1 | $DGSH_TEE $flags | $DGSH_TEE" >a 2>err
+	echo 0 >b
+	ensure_same "Pass-through $flags" a b
+	echo -n "Pass-through removal $flags "
+	if grep -q 'hands its input' err
+	then
+		removed=yes
+	else
+		removed=no
+	fi
+	if [ -z "$flags" ]
+	then
+		expect=yes
+	else
+		expect=no
+	fi
+	if [ $removed != $expect ]
+	then
+		echo "Pass-through removal $flags: removed=$removed" 1>&2
+		exit 1
+	fi
+	echo OK
+	rm -f a b err
+done
+
 exit 0
@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# Regression tests for dgsh-w
+#
+
+TOP=$(cd ../.. ; pwd)
+DGSH="$TOP/build/bin/dgsh"
+PATH="$TOP/build/bin:$PATH"
+export DGSHPATH="$TOP/build/libexec/dgsh"
+
+# Ensure that the complex numbers in the files passed as 2nd and 3rd
+# arguments are the same, allowing for rounding errors
+ensure_close()
+{
+	echo -n "$1 "
+	if ! [ $(wc -l <$2) -eq $(wc -l <$3) ] ||
+		! paste -d ' ' $2 $3 | awk '
+		function abs(v)
+		{
+			return (v < 0 ? -v : v)
+		}
+		function near(a, b)
+		{
+			return abs(a - b) <= 1e-9 * (abs(a) > 1 ? abs(a) : 1)
+		}
+		!near($1, $3) || !near($2 + 0, $4 + 0) { exit 1 }'
+	then
+		echo "$1: $2 and $3 differ" 1>&2
+		exit 1
+	fi
+	echo OK
+}
+
+# Vectors of two real samples
+seq 1 2000 >w.in
+
+# Butterfly of stage 1: y1 = x1 + x2, y2 = x1 - x2, as text
+awk 'NR % 2 {x = $1; next} {print x + $1, 0}' w.in >w.expected
+awk 'NR % 2 {x = $1; next} {print x - $1, 0}' w.in >>w.expected
+for block in '' '-b 7'
+do
+	$DGSH -c "dgsh-fft-input -n 2 w.in | dgsh-w -t $block 1 0 | dgsh-tee" >w.out
+	ensure_close "Text output $block" w.expected w.out
+done
+
+# Framed output of stage 1 read by stage 2, whose twiddle factor is 1:
+# y1 = 2 x1, y2 = 2 x2
+awk 'NR % 2 {print 2 * $1, 0}' w.in >w.expected
+awk '!(NR % 2) {print 2 * $1, 0}' w.in >>w.expected
+for block in '' '-b 7'
+do
+	$DGSH -c "dgsh-fft-input -n 2 w.in |
+		dgsh-w $block 1 0 |
+		dgsh-w -t $block 2 0 |
+		dgsh-tee" >w.out
+	ensure_close "Framed output $block" w.expected w.out
+done
+
+# Values whose text representation exceeds the typical line length
+printf '1e300\n-2e300\n1e-300\n3\n' >w.in
+printf '%s 0\n' -1e300 3 3e300 -3 >w.expected
+$DGSH -c "dgsh-fft-input -n 2 w.in | dgsh-w -t 1 0 | dgsh-tee" >w.out
+ensure_close "Long text output" w.expected w.out
+
+# A complex input and a real one whose frames arrive after the first
+# block is processed: y1 = (4i - 1) + i, y2 = (4i - 1) - i
+seq 1 200000 >w.in
+$DGSH -c "dgsh-fft-input -n 2 w.in | dgsh-w 1 0 | dgsh-tee -o w.c1 -o w.c2"
+seq 1 100000 >w.in
+$DGSHPATH/dgsh-fft-input -n 1 -b 7 w.in >w.r
+awk '{print 5 * $1 - 1, 0}' w.in >w.expected
+awk '{print 3 * $1 - 1, 0}' w.in >>w.expected
+$DGSH -c "dgsh-tee -i w.c1 -i w.r | dgsh-w -t 1 0 | dgsh-tee" >w.out
+ensure_close "Real frames against complex input" w.expected w.out
+
+# An input whose real samples are followed by complex ones
+seq 1 8 >w.in
+$DGSH -c "dgsh-fft-input -n 2 w.in | dgsh-w 1 0 | dgsh-tee -o w.c1 -o w.c2"
+$DGSHPATH/dgsh-fft-input -n 1 w.in >w.r
+cat w.r w.c1 >w.mixed
+echo -n "Mixed real and complex input "
+$DGSH -c "dgsh-tee -i w.mixed -i w.r | dgsh-w 1 0 | dgsh-tee" >/dev/null 2>w.err
+if ! grep -q 'Input mixes real and complex samples' w.err
+then
+	echo "Mixed real and complex input: not reported" 1>&2
+	exit 1
+fi
+echo OK
+
+rm -f w.in w.expected w.out w.c1 w.c2 w.r w.mixed w.err
@@ -0,0 +1,357 @@
+#include <check.h>  /* Check unit test framework API. */
+#include <stdlib.h> /* EXIT_SUCCESS, EXIT_FAILURE */
+#include <unistd.h> /* pipe() */
+#include <err.h>    /* err() */
+#include <errno.h>  /* EINVAL, EPROTO */
+#include <stdint.h> /* uint32_t, uint64_t, UINT64_MAX */
+#include <string.h> /* memcpy() */
+#include "../src/dgsh.h"
+
+/* Size of a frame header: magic, type, element count */
+#define HEADER_SIZE 16
+
+static int fd[2];
+
+void
+setup_pipe(void)
+{
+	if (pipe(fd) == -1)
+		err(1, "pipe");
+}
+
+void
+retire_pipe(void)
+{
+	close(fd[0]);
+	if (fd[1] != -1)
+		close(fd[1]);
+}
+
+/* Close the pipe's write end, so that reading it reaches end of file */
+static void
+close_writer(void)
+{
+	close(fd[1]);
+	fd[1] = -1;
+}
+
+/* Write to the pipe a frame header with the specified fields */
+static void
+write_header(const char *magic, uint32_t type, uint64_t count)
+{
+	char h[HEADER_SIZE];
+
+	memcpy(h, magic, 4);
+	memcpy(h + 4, &type, sizeof(type));
+	memcpy(h + 8, &count, sizeof(count));
+	if (write(fd[1], h, sizeof(h)) != sizeof(h))
+		err(1, "write");
+}
+
+/* Read from the pipe all available data into buf */
+static size_t
+read_all(char *buf, size_t size)
+{
+	ssize_t n;
+	size_t len = 0;
+
+	close_writer();
+	while ((n = read(fd[0], buf + len, size - len)) > 0)
+		len += n;
+	return len;
+}
+
+START_TEST(test_element_size)
+{
+	ck_assert_int_eq(dgsh_frame_element_size(DGSH_FRAME_DOUBLE),
+			sizeof(double));
+	ck_assert_int_eq(dgsh_frame_element_size(DGSH_FRAME_COMPLEX),
+			2 * sizeof(double));
+	ck_assert_int_eq(dgsh_frame_element_size(0), 0);
+	ck_assert_int_eq(dgsh_frame_element_size(3), 0);
+}
+END_TEST
+
+START_TEST(test_round_trip)
+{
+	double real[] = {1.5, -2, 1e300};
+	double pairs[] = {1, 2, 3, -4};
+	void *data = NULL;
+	size_t size = 0;
+	int type;
+
+	ck_assert_int_eq(dgsh_frame_write(fd[1], DGSH_FRAME_DOUBLE, real, 3), 0);
+	/* Empty frames are not written */
+	ck_assert_int_eq(dgsh_frame_write(fd[1], DGSH_FRAME_COMPLEX, real, 0),
+			0);
+	ck_assert_int_eq(dgsh_frame_write(fd[1], DGSH_FRAME_COMPLEX,
+				pairs, 2), 0);
+	close_writer();
+
+	ck_assert_int_eq(dgsh_frame_read(fd[0], &type, &data, &size), 3);
+	ck_assert_int_eq(type, DGSH_FRAME_DOUBLE);
+	ck_assert_int_eq(size, sizeof(real));
+	ck_assert_int_eq(memcmp(data, real, sizeof(real)), 0);
+
+	/* The buffer grows to hold the larger frame */
+	ck_assert_int_eq(dgsh_frame_read(fd[0], &type, &data, &size), 2);
+	ck_assert_int_eq(type, DGSH_FRAME_COMPLEX);
+	ck_assert_int_eq(size, sizeof(pairs));
+	ck_assert_int_eq(memcmp(data, pairs, sizeof(pairs)), 0);
+
+	ck_assert_int_eq(dgsh_frame_read(fd[0], &type, &data, &size), 0);
+	free(data);
+}
+END_TEST
+
+START_TEST(test_read_skips_empty)
+{
+	double real[] = {7};
+	void *data = NULL;
+	size_t size = 0;
+	int type;
+
+	/* Frames without elements, as written by other implementations */
+	write_header("DgF1", DGSH_FRAME_COMPLEX, 0);
+	ck_assert_int_eq(dgsh_frame_write(fd[1], DGSH_FRAME_DOUBLE, real, 1), 0);
+	close_writer();
+	ck_assert_int_eq(dgsh_frame_read(fd[0], &type, &data, &size), 1);
+	ck_assert_int_eq(type, DGSH_FRAME_DOUBLE);
+	ck_assert_int_eq(((double *)data)[0], 7);
+	free(data);
+}
+END_TEST
+
+START_TEST(test_write_invalid_type)
+{
+	double real[] = {1};
+
+	errno = 0;
+	ck_assert_int_eq(dgsh_frame_write(fd[1], 3, real, 1), -1);
+	ck_assert_int_eq(errno, EINVAL);
+	/* Nothing was written */
+	ck_assert_int_eq(read_all((char *)real, sizeof(real)), 0);
+}
+END_TEST
+
+/* Read a frame whose header was written by the test and expect EPROTO */
+static void
+expect_read_error(void)
+{
+	void *data = NULL;
+	size_t size = 0;
+	int type;
+
+	close_writer();
+	errno = 0;
+	ck_assert_int_eq(dgsh_frame_read(fd[0], &type, &data, &size), -1);
+	ck_assert_int_eq(errno, EPROTO);
+	free(data);
+}
+
+START_TEST(test_read_bad_magic)
+{
+	/* For example, text data or a frame of a later format version */
+	write_header("DgF2", DGSH_FRAME_DOUBLE, 1);
+	if (write(fd[1], "01234567", 8) != 8)
+		err(1, "write");
+	expect_read_error();
+}
+END_TEST
+
+START_TEST(test_read_bad_type)
+{
+	write_header("DgF1", 3, 1);
+	if (write(fd[1], "01234567", 8) != 8)
+		err(1, "write");
+	expect_read_error();
+}
+END_TEST
+
+START_TEST(test_read_truncated_header)
+{
+	if (write(fd[1], "DgF1\1\0\0\0", 8) != 8)
+		err(1, "write");
+	expect_read_error();
+}
+END_TEST
+
+START_TEST(test_read_truncated_data)
+{
+	double real[] = {1, 2};
+
+	write_header("DgF1", DGSH_FRAME_DOUBLE, 3);
+	if (write(fd[1], real, sizeof(real)) != sizeof(real))
+		err(1, "write");
+	expect_read_error();
+}
+END_TEST
+
+START_TEST(test_read_overflow)
+{
+	/* An element count whose size wraps around to 16 bytes */
+	write_header("DgF1", DGSH_FRAME_COMPLEX, (UINT64_MAX >> 4) + 2);
+	if (write(fd[1], "0123456789abcdef", 16) != 16)
+		err(1, "write");
+	expect_read_error();
+}
+END_TEST
+
+START_TEST(test_decode)
+{
+	double pairs[] = {1, 2, 3, 4, 5, 6};
+	char buf[2 * HEADER_SIZE + sizeof(pairs) + sizeof(double)];
+	double real = 8;
+	const void *data;
+	size_t len, count, i;
+	int type;
+
+	ck_assert_int_eq(dgsh_frame_write(fd[1], DGSH_FRAME_COMPLEX,
+				pairs, 3), 0);
+	ck_assert_int_eq(dgsh_frame_write(fd[1], DGSH_FRAME_DOUBLE, &real, 1),
+			0);
+	len = read_all(buf, sizeof(buf));
+	ck_assert_int_eq(len, sizeof(buf));
+
+	/* Incomplete frames need more data */
+	for (i = 0; i < HEADER_SIZE + sizeof(pairs); i++)
+		ck_assert_int_eq(dgsh_frame_decode(buf, i, &type, &data,
+					&count), 0);
+
+	/* Complete frames are located in the buffer */
+	ck_assert_int_eq(dgsh_frame_decode(buf, len, &type, &data, &count),
+			HEADER_SIZE + sizeof(pairs));
+	ck_assert_int_eq(type, DGSH_FRAME_COMPLEX);
+	ck_assert_int_eq(count, 3);
+	ck_assert_int_eq((const char *)data - buf, HEADER_SIZE);
+	ck_assert_int_eq(memcmp(data, pairs, sizeof(pairs)), 0);
+
+	ck_assert_int_eq(dgsh_frame_decode(buf + HEADER_SIZE + sizeof(pairs),
+				HEADER_SIZE + sizeof(double), &type, &data,
+				&count), HEADER_SIZE + sizeof(double));
+	ck_assert_int_eq(type, DGSH_FRAME_DOUBLE);
+	ck_assert_int_eq(count, 1);
+	ck_assert_int_eq(*(const double *)data, 8);
+}
+END_TEST
+
+START_TEST(test_decode_mismatch)
+{
+	char buf[HEADER_SIZE];
+	const void *data;
+	size_t count;
+	int type;
+
+	write_header("DgF1", 3, 1);
+	ck_assert_int_eq(read_all(buf, sizeof(buf)), sizeof(buf));
+	errno = 0;
+	ck_assert_int_eq(dgsh_frame_decode(buf, sizeof(buf), &type, &data,
+				&count), -1);
+	ck_assert_int_eq(errno, EPROTO);
+
+	memcpy(buf, "dgF1", 4);
+	errno = 0;
+	ck_assert_int_eq(dgsh_frame_decode(buf, sizeof(buf), &type, &data,
+				&count), -1);
+	ck_assert_int_eq(errno, EPROTO);
+}
+END_TEST
+
+START_TEST(test_decode_overflow)
+{
+	char buf[HEADER_SIZE + 2 * sizeof(double)];
+	const void *data;
+	size_t count;
+	int type;
+
+	/* An element count whose size wraps around to the data's length */
+	write_header("DgF1", DGSH_FRAME_COMPLEX, (UINT64_MAX >> 4) + 2);
+	if (write(fd[1], "0123456789abcdef", 16) != 16)
+		err(1, "write");
+	ck_assert_int_eq(read_all(buf, sizeof(buf)), sizeof(buf));
+	errno = 0;
+	ck_assert_int_eq(dgsh_frame_decode(buf, sizeof(buf), &type, &data,
+				&count), -1);
+	ck_assert_int_eq(errno, EPROTO);
+}
+END_TEST
+
+Suite *
+suite_frame(void)
+{
+	Suite *s = suite_create("Frame");
+
+	TCase *tc_es = tcase_create("element size");
+	tcase_add_checked_fixture(tc_es, NULL, NULL);
+	tcase_add_test(tc_es, test_element_size);
+	suite_add_tcase(s, tc_es);
+
+	TCase *tc_rt = tcase_create("round trip");
+	tcase_add_checked_fixture(tc_rt, setup_pipe, retire_pipe);
+	tcase_add_test(tc_rt, test_round_trip);
+	suite_add_tcase(s, tc_rt);
+
+	TCase *tc_rse = tcase_create("read skips empty");
+	tcase_add_checked_fixture(tc_rse, setup_pipe, retire_pipe);
+	tcase_add_test(tc_rse, test_read_skips_empty);
+	suite_add_tcase(s, tc_rse);
+
+	TCase *tc_wit = tcase_create("write invalid type");
+	tcase_add_checked_fixture(tc_wit, setup_pipe, retire_pipe);
+	tcase_add_test(tc_wit, test_write_invalid_type);
+	suite_add_tcase(s, tc_wit);
+
+	TCase *tc_rbm = tcase_create("read bad magic");
+	tcase_add_checked_fixture(tc_rbm, setup_pipe, retire_pipe);
+	tcase_add_test(tc_rbm, test_read_bad_magic);
+	suite_add_tcase(s, tc_rbm);
+
+	TCase *tc_rbt = tcase_create("read bad type");
+	tcase_add_checked_fixture(tc_rbt, setup_pipe, retire_pipe);
+	tcase_add_test(tc_rbt, test_read_bad_type);
+	suite_add_tcase(s, tc_rbt);
+
+	TCase *tc_rth = tcase_create("read truncated header");
+	tcase_add_checked_fixture(tc_rth, setup_pipe, retire_pipe);
+	tcase_add_test(tc_rth, test_read_truncated_header);
+	suite_add_tcase(s, tc_rth);
+
+	TCase *tc_rtd = tcase_create("read truncated data");
+	tcase_add_checked_fixture(tc_rtd, setup_pipe, retire_pipe);
+	tcase_add_test(tc_rtd, test_read_truncated_data);
+	suite_add_tcase(s, tc_rtd);
+
+	TCase *tc_ro = tcase_create("read overflow");
+	tcase_add_checked_fixture(tc_ro, setup_pipe, retire_pipe);
+	tcase_add_test(tc_ro, test_read_overflow);
+	suite_add_tcase(s, tc_ro);
+
+	TCase *tc_d = tcase_create("decode");
+	tcase_add_checked_fixture(tc_d, setup_pipe, retire_pipe);
+	tcase_add_test(tc_d, test_decode);
+	suite_add_tcase(s, tc_d);
+
+	TCase *tc_dm = tcase_create("decode mismatch");
+	tcase_add_checked_fixture(tc_dm, setup_pipe, retire_pipe);
+	tcase_add_test(tc_dm, test_decode_mismatch);
+	suite_add_tcase(s, tc_dm);
+
+	TCase *tc_do = tcase_create("decode overflow");
+	tcase_add_checked_fixture(tc_do, setup_pipe, retire_pipe);
+	tcase_add_test(tc_do, test_decode_overflow);
+	suite_add_tcase(s, tc_do);
+
+	return s;
+}
+
+int
+main()
+{
+	int number_failed;
+	SRunner *sr = srunner_create(suite_frame());
+
+	srunner_run_all(sr, CK_VERBOSE);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -7,6 +7,7 @@
 #include <stdio.h> /* snprintf */
 #include <unistd.h> /* pipe */
 #include <sys/types.h>
+#include <sys/wait.h> /* waitpid */
 #include <sys/socket.h> /* socket */
 #include <sys/un.h> /* sockaddr_un */
 #include "../src/negotiate.h"
@@ -624,6 +625,13 @@ setup_test_free_graph_solution(void)
 	setup_graph_solution();
 }
 
+void
+setup_test_mark_reconvergent_paths(void)
+{
+	setup_chosen_mb();
+	setup_graph_solution();
+}
+
 void
 setup_test_solve_graph(void)
 {
@@ -664,6 +672,21 @@ setup_test_establish_io_connections(void)
 	setup_self_node();
 }
 
+/* A tool with one input and one output, both leading to other tools */
+void
+setup_test_pass_through(void)
+{
+	setup_chosen_mb();
+	memcpy(&self_node, &chosen_mb->node_array[1], sizeof(struct dgsh_node));
+	self_pipe_fds.n_input_fds = 1;
+	self_pipe_fds.input_fds = (int *)malloc(sizeof(int));
+	self_pipe_fds.input_fds[0] = 3;
+	self_pipe_fds.n_output_fds = 1;
+	self_pipe_fds.output_fds = (int *)malloc(sizeof(int));
+	self_pipe_fds.output_fds[0] = 4;
+	reconvergent = false;
+}
+
 void setup_pi(void)
 {
 	pi = (struct portinfo *)calloc(5, sizeof(struct portinfo));
@@ -998,6 +1021,14 @@ retire_test_free_graph_solution(void)
 	retire_chosen_mb();
 }
 
+void
+retire_test_mark_reconvergent_paths(void)
+{
+	retire_graph_solution(chosen_mb->graph_solution,
+			chosen_mb->n_nodes - 1);
+	retire_chosen_mb();
+}
+
 void
 retire_test_solve_graph(void)
 {
@@ -1043,6 +1074,18 @@ retire_test_establish_io_connections(void)
 	retire_pipe_fds();
 }
 
+void
+retire_test_pass_through(void)
+{
+	/* See setup_test_pass_through() */
+	retire_chosen_mb();
+	retire_pipe_fds();
+	reconvergent = false;
+	free(pass_through_order);
+	pass_through_order = NULL;
+	n_pass_through = 0;
+}
+
 void
 retire_pi(void)
 {
@@ -1080,6 +1123,11 @@ START_TEST(test_solve_graph)
 	ck_assert_int_eq(graph_solution[3].edges_incoming[1].instances, 1);
 	ck_assert_int_eq(graph_solution[1].edges_outgoing[1].instances, 1);
 	ck_assert_int_eq((long int)graph_solution[3].edges_outgoing, 0);
+	/* Paths from proc2 meet at proc0; paths from proc1 at proc3. */
+	ck_assert_int_eq(graph_solution[0].reconvergent, true);
+	ck_assert_int_eq(graph_solution[1].reconvergent, true);
+	ck_assert_int_eq(graph_solution[2].reconvergent, true);
+	ck_assert_int_eq(graph_solution[3].reconvergent, true);
 	retire_test_solve_graph();
 
 	/* An impossible case. */
@@ -1129,6 +1177,38 @@ START_TEST(test_solve_graph)
 }
 END_TEST
 
+START_TEST(test_mark_reconvergent_paths)
+{
+	DPRINTF(4, "%s()", __func__);
+	struct dgsh_edge *edges = chosen_mb->edge_array;
+	struct dgsh_node_connections *graph_solution =
+			chosen_mb->graph_solution;
+	int i;
+
+	/* Default topology: paths meet at proc0 and proc3 */
+	for (i = 0; i < chosen_mb->n_edges; i++)
+		edges[i].instances = 1;
+	ck_assert_int_eq(mark_reconvergent_paths(), OP_SUCCESS);
+	for (i = 0; i < chosen_mb->n_nodes; i++)
+		ck_assert_int_eq(graph_solution[i].reconvergent, true);
+
+	/* Without the edges to proc0 no paths meet */
+	edges[0].instances = 0;
+	edges[2].instances = 0;
+	ck_assert_int_eq(mark_reconvergent_paths(), OP_SUCCESS);
+	for (i = 0; i < chosen_mb->n_nodes; i++)
+		ck_assert_int_eq(graph_solution[i].reconvergent, false);
+
+	/* Two channels from proc1 meet at proc3 */
+	edges[3].instances = 2;
+	ck_assert_int_eq(mark_reconvergent_paths(), OP_SUCCESS);
+	ck_assert_int_eq(graph_solution[0].reconvergent, false);
+	ck_assert_int_eq(graph_solution[1].reconvergent, true);
+	ck_assert_int_eq(graph_solution[2].reconvergent, false);
+	ck_assert_int_eq(graph_solution[3].reconvergent, true);
+}
+END_TEST
+
 START_TEST(test_calculate_conc_fds)
 {
 	DPRINTF(4, "%s()", __func__);
@@ -1206,6 +1286,197 @@ START_TEST(test_establish_io_connections)
 }
 END_TEST
 
+START_TEST(test_is_pass_through)
+{
+	/* A single input copied to a single output */
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), true);
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH |
+				DGSH_HANDLE_ERROR), true);
+
+	/* Tools that buffer or transform their data do not declare it */
+	ck_assert_int_eq(is_pass_through(0), false);
+	ck_assert_int_eq(is_pass_through(DGSH_HANDLE_ERROR), false);
+
+	/* Tools on reconvergent paths are kept to buffer their input */
+	reconvergent = true;
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), false);
+	reconvergent = false;
+
+	/* The output must lead to another tool */
+	self_node.dgsh_out = 0;
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), false);
+	self_node.dgsh_out = 1;
+
+	/* An input from outside the graph is the standard input */
+	self_node.dgsh_in = 0;
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), true);
+	self_node.dgsh_in = 1;
+
+	/* Without a permutation only one channel can be handed over */
+	self_pipe_fds.n_output_fds = 2;
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), false);
+	self_pipe_fds.n_output_fds = 1;
+	self_pipe_fds.n_input_fds = 0;
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), false);
+	self_pipe_fds.n_input_fds = 1;
+}
+END_TEST
+
+START_TEST(test_pass_through)
+{
+	char msg[] = "hello";
+	char buff[20];
+	int data[2], sock[2];
+	int fd, status;
+	pid_t pid;
+
+	if (pipe(data) == -1)
+		err(1, "pipe");
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) == -1)
+		err(1, "socketpair");
+	self_pipe_fds.input_fds[0] = data[0];
+
+	switch ((pid = fork())) {
+	case 0:
+		/* Child: hand the input to the output and exit */
+		close(sock[1]);
+		close(data[1]);
+		pass_through(sock[0]);
+		exit(1);	/* Not reached */
+	case -1:
+		err(1, "fork");
+	}
+
+	/* Parent: receive the input and read the test message through it */
+	close(sock[0]);
+	close(data[0]);
+	fd = read_fd(sock[1]);
+	ck_assert_int_ne(fd, -1);
+	if (write(data[1], msg, sizeof(msg)) != sizeof(msg))
+		err(1, "write");
+	ck_assert_int_eq(read(fd, buff, sizeof(buff)), sizeof(msg));
+	ck_assert_str_eq(buff, msg);
+
+	/* The tool has left the data path */
+	ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+	ck_assert_int_eq(WIFEXITED(status), true);
+	ck_assert_int_eq(WEXITSTATUS(status), EX_OK);
+
+	/* Closing the original input's writer ends the handed input */
+	close(data[1]);
+	ck_assert_int_eq(read(fd, buff, sizeof(buff)), 0);
+	close(fd);
+	close(sock[1]);
+}
+END_TEST
+
+START_TEST(test_dgsh_permute)
+{
+	int identity[] = {0, 1, 2};
+	int cross[] = {1, 0};
+	int rotate[] = {1, 2, 0};
+	int repeated[] = {1, 1, 0};
+	int negative[] = {0, -1};
+	int large[] = {0, 2};
+
+	/* Valid permutations record the input passed to each output */
+	ck_assert_int_eq(dgsh_permute(3, identity), 0);
+	ck_assert_int_eq(n_pass_through, 3);
+	ck_assert_int_eq(pass_through_order[0], 0);
+	ck_assert_int_eq(pass_through_order[1], 1);
+	ck_assert_int_eq(pass_through_order[2], 2);
+	ck_assert_int_eq(dgsh_permute(2, cross), 0);
+	ck_assert_int_eq(n_pass_through, 2);
+	ck_assert_int_eq(pass_through_order[0], 1);
+	ck_assert_int_eq(pass_through_order[1], 0);
+	ck_assert_int_eq(dgsh_permute(3, rotate), 0);
+	ck_assert_int_eq(pass_through_order[0], 2);
+	ck_assert_int_eq(pass_through_order[1], 0);
+	ck_assert_int_eq(pass_through_order[2], 1);
+
+	/* Invalid ones fail and leave the declared permutation unchanged */
+	errno = 0;
+	ck_assert_int_eq(dgsh_permute(3, repeated), -1);
+	ck_assert_int_eq(errno, EINVAL);
+	ck_assert_int_eq(dgsh_permute(2, negative), -1);
+	ck_assert_int_eq(dgsh_permute(2, large), -1);
+	ck_assert_int_eq(dgsh_permute(0, identity), -1);
+	ck_assert_int_eq(n_pass_through, 3);
+	ck_assert_int_eq(pass_through_order[0], 2);
+
+	/* A permutation is handed over only with as many channels */
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), false);
+	self_pipe_fds.n_input_fds = self_pipe_fds.n_output_fds = 3;
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), true);
+	ck_assert_int_eq(is_pass_through(0), false);
+	self_pipe_fds.n_output_fds = 2;
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), false);
+	self_pipe_fds.n_output_fds = 3;
+
+	/* Permuting tools on reconvergent paths are kept as well */
+	reconvergent = true;
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), false);
+	self_pipe_fds.n_input_fds = self_pipe_fds.n_output_fds = 1;
+}
+END_TEST
+
+START_TEST(test_pass_through_permutation)
+{
+	/* Input i is sent to output outputs[i] */
+	int outputs[] = {1, 2, 0};
+	int data[3][2], sock[2];
+	int fd[3];
+	char buff[2];
+	int i, status;
+	pid_t pid;
+
+	for (i = 0; i < 3; i++)
+		if (pipe(data[i]) == -1)
+			err(1, "pipe");
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) == -1)
+		err(1, "socketpair");
+	free(self_pipe_fds.input_fds);
+	self_pipe_fds.input_fds = (int *)malloc(3 * sizeof(int));
+	for (i = 0; i < 3; i++)
+		self_pipe_fds.input_fds[i] = data[i][0];
+	self_pipe_fds.n_input_fds = self_pipe_fds.n_output_fds = 3;
+	ck_assert_int_eq(dgsh_permute(3, outputs), 0);
+	ck_assert_int_eq(is_pass_through(DGSH_PASS_THROUGH), true);
+
+	switch ((pid = fork())) {
+	case 0:
+		/* Child: hand the inputs to the outputs and exit */
+		close(sock[1]);
+		pass_through(sock[0]);
+		exit(1);	/* Not reached */
+	case -1:
+		err(1, "fork");
+	}
+
+	/* Parent: write each input's number and read it from its output */
+	close(sock[0]);
+	for (i = 0; i < 3; i++) {
+		fd[i] = read_fd(sock[1]);
+		ck_assert_int_ne(fd[i], -1);
+	}
+	for (i = 0; i < 3; i++) {
+		buff[0] = '0' + i;
+		if (write(data[i][1], buff, 1) != 1)
+			err(1, "write");
+		close(data[i][1]);
+	}
+	for (i = 0; i < 3; i++) {
+		ck_assert_int_eq(read(fd[outputs[i]], buff, sizeof(buff)), 1);
+		ck_assert_int_eq(buff[0], '0' + i);
+		close(fd[outputs[i]]);
+	}
+	ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+	ck_assert_int_eq(WIFEXITED(status), true);
+	ck_assert_int_eq(WEXITSTATUS(status), EX_OK);
+	close(sock[1]);
+}
+END_TEST
+
 struct dgsh_edge **edges_in;
 int n_edges_in;
 struct dgsh_edge **edges_out;
@@ -2956,6 +3227,30 @@ suite_connect(void)
 	tcase_add_test(tc_eic, test_establish_io_connections);
 	suite_add_tcase(s, tc_eic);
 
+	TCase *tc_ipt = tcase_create("is pass through");
+	tcase_add_checked_fixture(tc_ipt, setup_test_pass_through,
+					  retire_test_pass_through);
+	tcase_add_test(tc_ipt, test_is_pass_through);
+	suite_add_tcase(s, tc_ipt);
+
+	TCase *tc_pt = tcase_create("pass through");
+	tcase_add_checked_fixture(tc_pt, setup_test_pass_through,
+					 retire_test_pass_through);
+	tcase_add_test(tc_pt, test_pass_through);
+	suite_add_tcase(s, tc_pt);
+
+	TCase *tc_dp = tcase_create("dgsh permute");
+	tcase_add_checked_fixture(tc_dp, setup_test_pass_through,
+					 retire_test_pass_through);
+	tcase_add_test(tc_dp, test_dgsh_permute);
+	suite_add_tcase(s, tc_dp);
+
+	TCase *tc_ptp = tcase_create("pass through permutation");
+	tcase_add_checked_fixture(tc_ptp, setup_test_pass_through,
+					  retire_test_pass_through);
+	tcase_add_test(tc_ptp, test_pass_through_permutation);
+	suite_add_tcase(s, tc_ptp);
+
 	TCase *tc_anc = tcase_create("alloc node connections");
 	tcase_add_checked_fixture(tc_anc, NULL, NULL);
 	tcase_add_test(tc_anc, test_alloc_node_connections);
@@ -3012,6 +3307,12 @@ suite_solve(void)
 	tcase_add_test(tc_ssg, test_solve_graph);
 	suite_add_tcase(s, tc_ssg);
 
+	TCase *tc_mrp = tcase_create("mark reconvergent paths");
+	tcase_add_checked_fixture(tc_mrp, setup_test_mark_reconvergent_paths,
+					  retire_test_mark_reconvergent_paths);
+	tcase_add_test(tc_mrp, test_mark_reconvergent_paths);
+	suite_add_tcase(s, tc_mrp);
+
 	TCase *tc_ccf = tcase_create("calculate conc fds");
 	tcase_add_checked_fixture(tc_ccf, setup_test_calculate_conc_fds,
 					  retire_test_calculate_conc_fds);
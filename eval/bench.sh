@@ -0,0 +1,236 @@
+#!/bin/sh
+#
+# Benchmark the examples and the core tools on deterministic synthetic
+# data (see synth-data.sh), and output the results in JSON format,
+# so that they can be compared across commits
+#
+#  Copyright 2017 Diomidis Spinellis
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+usage()
+{
+	echo "Usage: $0 [-n runs] [-o file] [-s scale] [benchmark ...]" 1>&2
+	exit 2
+}
+
+RUNS=3
+SCALE=10
+OUTPUT=
+
+while getopts 'n:o:s:' o; do
+	case "$o" in
+	n)
+		RUNS="$OPTARG"
+		;;
+	o)
+		OUTPUT="$OPTARG"
+		;;
+	s)
+		SCALE="$OPTARG"
+		;;
+	*)
+		usage
+		;;
+	esac
+done
+shift $((OPTIND-1))
+# Benchmarks to run; all by default
+SELECTED="$*"
+
+EVAL=$(pwd)
+TOP=$(cd .. ; pwd)
+DGSH=${DGSH:-$TOP/build/bin/dgsh}
+LIBEXEC=${LIBEXEC:-$TOP/build/libexec/dgsh}
+EXAMPLE=$TOP/example
+PATH="$TOP/build/bin:$PATH"
+export DGSHPATH="$LIBEXEC"
+export LC_ALL=C
+
+SYNTH=$EVAL/synth-$SCALE
+WORK=$EVAL/bench-work
+
+sh synth-data.sh $SCALE $SYNTH || exit 1
+
+COMMIT=$(git rev-parse HEAD 2>/dev/null || echo unknown)
+OUTPUT=${OUTPUT:-bench-$(echo $COMMIT | cut -c1-12)-$SCALE.json}
+
+# Determine how resource usage is measured
+if /usr/bin/time -v true >/dev/null 2>&1 ; then
+	TIMER=gnu-time
+else
+	TIMER=times
+fi
+
+# Output the number of bytes in the specified files or directories
+input_bytes()
+{
+	find "$@" -type f ! -path '*/.git/*' -exec cat {} + | wc -c
+}
+
+# Output the total user and system time of the shell's children in
+# seconds, as recorded by times(1) in the specified file.
+# (Running times in a subshell would report the subshell's children.)
+children_times()
+{
+	sed -n '2s/\([0-9]*\)m\([0-9.]*\)s/\1 \2/gp' $1 |
+	awk '{print $1 * 60 + $2, $3 * 60 + $4}'
+}
+
+# Run the command once, setting the variable RESULT to its elapsed,
+# user, and system time, maximum RSS, voluntary and involuntary context
+# switches, and exit status
+measure_once()
+{
+	local status
+
+	rm -rf $WORK
+	mkdir -p $WORK
+	if [ $TIMER = gnu-time ] ; then
+		(cd $WORK && /usr/bin/time -v -o $EVAL/bench.time "$@" \
+			<$STDIN >$EVAL/bench.out 2>$EVAL/bench.err)
+		status=$?
+		RESULT=$(awk -F': ' -v status=$status '
+			/Elapsed \(wall clock\)/ {
+				n = split($2, t, ":")
+				elapsed = 0
+				for (i = 1; i <= n; i++)
+					elapsed = elapsed * 60 + t[i]
+			}
+			/User time/ { user = $2 }
+			/System time/ { sys = $2 }
+			/Maximum resident set size/ { rss = $2 }
+			/Voluntary context switches/ { vcs = $2 }
+			/Involuntary context switches/ { ics = $2 }
+			END {
+				printf("%.3f %s %s %s %s %s %d\n", elapsed, user,
+				    sys, rss, vcs, ics, status)
+			}' $EVAL/bench.time)
+	else
+		local start end
+
+		times >$EVAL/bench.before
+		start=$(date +%s.%N)
+		(cd $WORK && "$@" <$STDIN >$EVAL/bench.out 2>$EVAL/bench.err)
+		status=$?
+		end=$(date +%s.%N)
+		times >$EVAL/bench.after
+		RESULT=$(echo $start $end $(children_times $EVAL/bench.before) \
+			$(children_times $EVAL/bench.after) $status |
+			awk '{printf("%.3f %.3f %.3f null null null %d\n",
+				$2 - $1, $5 - $3, $6 - $4, $7)}')
+	fi
+}
+
+# Run the named benchmark with the specified standard input, input
+# files or directories (for calculating its throughput), and command
+bench()
+{
+	local name="$1" bytes best run
+	STDIN="$2"
+	local size="$3"
+	shift 3
+
+	if [ -n "$SELECTED" ] && ! echo " $SELECTED " | grep -q " $name " ; then
+		return
+	fi
+	echo "Running $name" 1>&2
+
+	bytes=$(input_bytes $size)
+	best=
+	run=0
+	while [ $run -lt $RUNS ] ; do
+		measure_once "$@"
+		# Keep the fastest run
+		if [ -z "$best" ] || [ $(echo "$RESULT $best" |
+		    awk '{print $1 < $8}') = 1 ] ; then
+			best="$RESULT"
+		fi
+		run=$((run + 1))
+	done
+
+	echo "$name $bytes $best" |
+	awk -v first=$FIRST '{
+		printf("%s    {\"name\": \"%s\", \"input_bytes\": %d, " \
+		    "\"elapsed\": %s, \"throughput_mb_s\": %s, " \
+		    "\"user\": %s, \"system\": %s, \"max_rss_kb\": %s, " \
+		    "\"voluntary_cs\": %s, \"involuntary_cs\": %s, " \
+		    "\"exit_status\": %d}",
+		    first ? "" : ",\n", $1, $2, $3,
+		    $3 > 0 ? sprintf("%.3f", $2 / 1024 / 1024 / $3) : "null",
+		    $4, $5, $6, $7, $8, $9)
+	}' >>$OUTPUT
+	FIRST=0
+}
+
+cat >$OUTPUT <<EOF
+{
+  "commit": "$COMMIT",
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "host": "$(uname -n)",
+  "system": "$(uname -sr)",
+  "cpus": $(getconf _NPROCESSORS_ONLN),
+  "scale": $SCALE,
+  "runs": $RUNS,
+  "timer": "$TIMER",
+  "results": [
+EOF
+FIRST=1
+
+# Examples
+bench word-properties $SYNTH/text.txt $SYNTH/text.txt \
+	$DGSH $EXAMPLE/word-properties.sh
+bench text-properties $SYNTH/text.txt $SYNTH/text.txt \
+	$DGSH $EXAMPLE/text-properties.sh
+bench compress-compare $SYNTH/text.txt $SYNTH/text.txt \
+	$DGSH $EXAMPLE/compress-compare.sh
+bench spell-highlight $SYNTH/text.txt $SYNTH/text.txt \
+	$DGSH $EXAMPLE/spell-highlight.sh
+bench parallel-word-count $SYNTH/text.txt $SYNTH/text.txt \
+	$DGSH $EXAMPLE/parallel-word-count.sh
+bench web-log-report $SYNTH/access.log $SYNTH/access.log \
+	$DGSH $EXAMPLE/web-log-report.sh
+bench code-metrics /dev/null $SYNTH/tree.new \
+	$DGSH $EXAMPLE/code-metrics.sh $SYNTH/tree.new
+bench duplicate-files /dev/null $SYNTH/tree.new \
+	$DGSH $EXAMPLE/duplicate-files.sh $SYNTH/tree.new
+bench map-hierarchy /dev/null "$SYNTH/tree.old $SYNTH/tree.new" \
+	$DGSH $EXAMPLE/map-hierarchy.sh $SYNTH/tree.old $SYNTH/tree.new hier
+bench commit-stats /dev/null $SYNTH/repo \
+	sh -c "cd $SYNTH/repo && $DGSH $EXAMPLE/commit-stats.sh"
+bench fft-block8 /dev/null $SYNTH/samples.txt \
+	$DGSH $EXAMPLE/fft-block8.sh $SYNTH/samples.txt
+
+# Core tools in isolation
+bench dgsh-tee-copy $SYNTH/text.txt $SYNTH/text.txt \
+	$LIBEXEC/dgsh-tee -o /dev/null -o /dev/null -o /dev/null -o /dev/null
+bench dgsh-tee-scatter $SYNTH/text.txt $SYNTH/text.txt \
+	$LIBEXEC/dgsh-tee -s -o /dev/null -o /dev/null -o /dev/null -o /dev/null
+bench dgsh-merge $SYNTH/sorted-1.txt "$SYNTH/sorted-1.txt $SYNTH/sorted-2.txt $SYNTH/sorted-3.txt $SYNTH/sorted-4.txt" \
+	dgsh-merge $SYNTH/sorted-2.txt $SYNTH/sorted-3.txt $SYNTH/sorted-4.txt
+bench dgsh-merge-sum $SYNTH/counts-1.txt "$SYNTH/counts-1.txt $SYNTH/counts-2.txt $SYNTH/counts-3.txt $SYNTH/counts-4.txt" \
+	dgsh-merge-sum $SYNTH/counts-2.txt $SYNTH/counts-3.txt $SYNTH/counts-4.txt
+bench dgsh-merge-aggregate $SYNTH/sorted-1.txt "$SYNTH/sorted-1.txt $SYNTH/sorted-2.txt $SYNTH/sorted-3.txt $SYNTH/sorted-4.txt" \
+	dgsh-merge-aggregate -k 1,1 -a count -a sum:2 -a distinct:3 \
+	$SYNTH/sorted-2.txt $SYNTH/sorted-3.txt $SYNTH/sorted-4.txt
+bench dgsh-fft-input /dev/null $SYNTH/samples.txt \
+	$LIBEXEC/dgsh-fft-input -n 1 $SYNTH/samples.txt
+
+cat >>$OUTPUT <<EOF
+
+  ]
+}
+EOF
+rm -rf $WORK bench.time bench.out bench.err bench.before bench.after
+echo "Results are in $OUTPUT" 1>&2
@@ -0,0 +1,97 @@
+#!/bin/sh
+#
+# Compare the performance of dgsh-merge-aggregate with that of the
+# equivalent sort -m | awk pipeline on synthetic sorted inputs
+#
+#  Copyright 2017 Diomidis Spinellis
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+. 'eval-lib.sh'
+
+# Number of input files and records in each one
+NFILES=${1:-16}
+NRECORDS=${2:-1000000}
+
+# Number of distinct items; distinct counts are exact up to 64 values
+NITEMS=64
+
+MERGE_AGGREGATE=${MERGE_AGGREGATE:-../build/bin/dgsh-merge-aggregate}
+
+export LC_ALL=C
+
+mkdir -p time out err merge-data
+
+SIZE=$NFILES-$NRECORDS-$NITEMS
+
+# Create deterministic sorted input files of key, value, item records
+i=1
+while [ $i -le $NFILES ]
+do
+	FILE=merge-data/$SIZE-$i
+	if ! [ -r $FILE ]
+	then
+		awk -v seed=$i -v n=$NRECORDS -v items=$NITEMS 'BEGIN {
+			srand(seed)
+			for (i = 0; i < n; i++)
+				printf("k%06d %d i%d\n", int(rand() * n / 4),
+				    int(rand() * 1000), int(rand() * items))
+		}' |
+		sort -k1,1 >$FILE
+	fi
+	i=$(expr $i + 1)
+done
+
+timerun merge-aggregate-$SIZE $MERGE_AGGREGATE -k 1,1 \
+	-a count -a sum:2 -a max:2 -a distinct:3 merge-data/$SIZE-* </dev/null
+
+timerun sort-awk-$SIZE sh -c "sort -m -k1,1 merge-data/$SIZE-* |
+	awk '
+	function output() {
+		printf(\"%d %d %d %d %s\\n\", count, sum, max, ndistinct, key)
+	}
+	\$1 != key {
+		if (NR > 1)
+			output()
+		key = \$1
+		count = sum = ndistinct = 0
+		max = \$2
+		delete seen
+	}
+	{
+		count++
+		sum += \$2
+		if (\$2 > max)
+			max = \$2
+		if (!(\$3 in seen)) {
+			seen[\$3] = 1
+			ndistinct++
+		}
+	}
+	END { if (NR) output() }'"
+
+# With at most NITEMS distinct items per key, results should match
+if cmp out/merge-aggregate-$SIZE out/sort-awk-$SIZE
+then
+	echo "Results are identical"
+else
+	echo "Results differ"
+fi
+
+for PROG in merge-aggregate sort-awk
+do
+	printf '%s\t' $PROG
+	sed -n 's/.*Elapsed (wall clock) time (h:mm:ss or m:ss): //p' \
+		time/$PROG-$SIZE
+done
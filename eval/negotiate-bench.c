@@ -0,0 +1,484 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Benchmark the dgsh negotiation on a synthetic graph.
+ * Build a graph of the specified shape and size, connect its processes
+ * through socket pairs as the dgsh shell does, and have each process
+ * take part in the negotiation, either by calling dgsh_negotiate()
+ * or by running dgsh-conc.  Output a JSON object with the time it took
+ * and the message block traffic it generated, as reported by the
+ * negotiation code compiled with -DTIME.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dgsh.h"
+
+/* A process taking part in the negotiation */
+struct proc {
+	enum {
+		k_node,		/* Calls dgsh_negotiate() */
+		k_conc_out,	/* dgsh-conc -o: one input to many outputs */
+		k_conc_in,	/* dgsh-conc -i: many inputs to one output */
+	} kind;
+	int nin, nout;		/* Declared channels; -1 for flexible */
+	int nedges_in, nedges_out;
+	pid_t pid;
+};
+
+/* A socket pair connecting two processes */
+struct edge {
+	int from, to;		/* Index of the connected processes */
+	int fd_from, fd_to;	/* Driver's ends of the socket pair; -1 if closed */
+};
+
+static struct proc *procs;
+static int nprocs, procs_size;
+static struct edge *edges;
+static int nedges, edges_size;
+
+/* Declare all node channels as flexible */
+static bool opt_flexible;
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage %s [-f] [-c path] [-n nodes] [-s shape] [-w width]\n"
+		"-c path"	"\tPath of the dgsh-conc program to use\n"
+		"-f"		"\tDeclare the nodes' I/O channels as flexible\n"
+		"-n nodes"	"\tApproximate number of processes in the graph (default 100)\n"
+		"-s shape"	"\tGraph shape: chain, fanout, scatter-gather, or nested\n"
+		"-w width"	"\tWidth of each nested scatter-gather block (default 4)\n",
+		name);
+	exit(1);
+}
+
+/* Add a process of the specified kind and channels; return its index */
+static int
+add_proc(int kind, int nin, int nout)
+{
+	struct proc *p;
+
+	if (nprocs == procs_size) {
+		procs_size = procs_size ? procs_size * 2 : 64;
+		if ((procs = realloc(procs, procs_size * sizeof(*procs))) == NULL)
+			err(1, "Out of memory for processes");
+	}
+	p = &procs[nprocs];
+	p->kind = kind;
+	if (kind == k_node && opt_flexible) {
+		p->nin = nin ? -1 : 0;
+		p->nout = nout ? -1 : 0;
+	} else {
+		p->nin = nin;
+		p->nout = nout;
+	}
+	p->nedges_in = p->nedges_out = 0;
+	return nprocs++;
+}
+
+static void
+add_edge(int from, int to)
+{
+	if (nedges == edges_size) {
+		edges_size = edges_size ? edges_size * 2 : 64;
+		if ((edges = realloc(edges, edges_size * sizeof(*edges))) == NULL)
+			err(1, "Out of memory for edges");
+	}
+	edges[nedges].from = from;
+	edges[nedges].to = to;
+	edges[nedges].fd_from = edges[nedges].fd_to = -1;
+	nedges++;
+	procs[from].nedges_out++;
+	procs[to].nedges_in++;
+}
+
+/*
+ * Add a scatter-gather block fed by process from: a concentrator
+ * scattering to width branches, each built by the specified function,
+ * and a concentrator gathering their outputs.
+ * Return the index of the gathering concentrator.
+ */
+static int
+add_scatter_gather(int from, int width, int (*branch)(int, int), int arg)
+{
+	int i, scatter, gather, *ends;
+
+	if ((ends = malloc(width * sizeof(int))) == NULL)
+		err(1, "Out of memory for branches");
+	scatter = add_proc(k_conc_out, 1, width);
+	add_edge(from, scatter);
+	for (i = 0; i < width; i++)
+		ends[i] = branch(scatter, arg);
+	gather = add_proc(k_conc_in, width, 1);
+	for (i = 0; i < width; i++)
+		add_edge(ends[i], gather);
+	free(ends);
+	return gather;
+}
+
+/* Add a single filter fed by from and return its index */
+static int
+add_filter(int from, int unused)
+{
+	int n = add_proc(k_node, 1, 1);
+
+	(void)unused;
+	add_edge(from, n);
+	return n;
+}
+
+static int nested_width;
+
+/*
+ * Add a block of the specified nesting depth fed by from: a node
+ * splitting its input to a scatter-gather block of blocks of
+ * depth - 1, and a node joining their output.
+ * Return the index of the joining node.
+ */
+static int
+add_nested(int from, int depth)
+{
+	int split, gather, join;
+
+	if (depth == 0)
+		return add_filter(from, 0);
+	split = add_proc(k_node, 1, nested_width);
+	add_edge(from, split);
+	gather = add_scatter_gather(split, nested_width, add_nested, depth - 1);
+	join = add_proc(k_node, nested_width, 1);
+	add_edge(gather, join);
+	return join;
+}
+
+/* Return the number of processes in a nested block of the specified depth */
+static int
+nested_size(int depth)
+{
+	return depth == 0 ? 1 : 4 + nested_width * nested_size(depth - 1);
+}
+
+/*
+ * Build a graph of the specified shape with about n processes.
+ * Return the width of its widest concentrator and set *depth to its
+ * nesting depth.
+ */
+static int
+build_graph(const char *progname, const char *shape, int n, int *depth)
+{
+	int i, last, width;
+
+	*depth = 0;
+	if (strcmp(shape, "chain") == 0) {
+		if (n < 2)
+			errx(1, "A chain requires at least two nodes");
+		last = add_proc(k_node, 0, 1);
+		for (i = 0; i < n - 2; i++)
+			last = add_filter(last, 0);
+		add_edge(last, add_proc(k_node, 1, 0));
+		return 0;
+	} else if (strcmp(shape, "fanout") == 0) {
+		int source, scatter;
+
+		width = n - 2;
+		if (width < 1)
+			errx(1, "A fanout requires at least 3 nodes");
+		source = add_proc(k_node, 0, width);
+		scatter = add_proc(k_conc_out, 1, width);
+		add_edge(source, scatter);
+		for (i = 0; i < width; i++)
+			add_edge(scatter, add_proc(k_node, 1, 0));
+		return width;
+	} else if (strcmp(shape, "scatter-gather") == 0) {
+		int source, gather;
+
+		width = n - 4;
+		if (width < 1)
+			errx(1, "A scatter-gather requires at least 5 nodes");
+		source = add_proc(k_node, 0, width);
+		gather = add_scatter_gather(source, width, add_filter, 0);
+		add_edge(gather, add_proc(k_node, width, 0));
+		return width;
+	} else if (strcmp(shape, "nested") == 0) {
+		if (nested_width < 1)
+			errx(1, "The nested block width must be at least 1");
+		/* Deepest nesting that fits with the source and the sink */
+		while (nested_size(*depth + 1) + 2 <= n)
+			(*depth)++;
+		if (*depth == 0)
+			errx(1, "A nested graph of width %d requires at least %d nodes",
+				nested_width, nested_size(1) + 2);
+		last = add_nested(add_proc(k_node, 0, 1), *depth);
+		add_edge(last, add_proc(k_node, 1, 0));
+		return nested_width;
+	} else
+		usage(progname);
+	return 0;
+}
+
+/* Return the current time in seconds */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Move the specified file descriptors to the target ones, and close
+ * all other descriptors the driver holds.
+ */
+static void
+remap_fds(int *src, int *dst, int n)
+{
+	int i, max_dst = STDERR_FILENO;
+
+	for (i = 0; i < n; i++)
+		if (dst[i] > max_dst)
+			max_dst = dst[i];
+	/* Move the sources out of the way of the targets */
+	for (i = 0; i < n; i++)
+		if ((src[i] = fcntl(src[i], F_DUPFD, max_dst + 1)) == -1)
+			err(1, "Error duplicating socket");
+	for (i = 0; i < nedges; i++) {
+		if (edges[i].fd_from != -1)
+			(void)close(edges[i].fd_from);
+		if (edges[i].fd_to != -1)
+			(void)close(edges[i].fd_to);
+	}
+	for (i = 0; i < n; i++) {
+		if (dup2(src[i], dst[i]) == -1)
+			err(1, "Error redirecting socket");
+		(void)close(src[i]);
+	}
+}
+
+/* Run the process at index i; never returns */
+static void
+run_proc(int i, const char *conc_path)
+{
+	struct proc *p = &procs[i];
+	int nfds = p->nedges_in + p->nedges_out;
+	int *src, *dst, j, in = 0, out = 0, fd;
+	char name[32], width[16];
+
+	if ((src = malloc(nfds * sizeof(int))) == NULL ||
+	    (dst = malloc(nfds * sizeof(int))) == NULL)
+		err(1, "Out of memory for file descriptors");
+
+	/*
+	 * Ports are numbered as dgsh-conc expects them: the first
+	 * input and output on 0 and 1, the rest from 3 onward.
+	 */
+	for (j = 0; j < nedges; j++)
+		if (edges[j].to == i) {
+			src[in + out] = edges[j].fd_to;
+			dst[in + out] = in == 0 ? STDIN_FILENO : 2 + in;
+			in++;
+		} else if (edges[j].from == i) {
+			src[in + out] = edges[j].fd_from;
+			dst[in + out] = out == 0 ? STDOUT_FILENO : 2 + out;
+			out++;
+		}
+	remap_fds(src, dst, nfds);
+
+	/* Unconnected standard input or output */
+	if ((in == 0 || out == 0) && (fd = open("/dev/null", O_RDWR)) != -1) {
+		if (in == 0)
+			dup2(fd, STDIN_FILENO);
+		if (out == 0)
+			dup2(fd, STDOUT_FILENO);
+		if (fd > STDERR_FILENO)
+			close(fd);
+	}
+
+	switch (p->kind) {
+	case k_node:
+		setenv("DGSH_IN", in ? "1" : "0", 1);
+		setenv("DGSH_OUT", out ? "1" : "0", 1);
+		snprintf(name, sizeof(name), "node-%d", i);
+		exit(dgsh_negotiate(0, name, &p->nin, &p->nout, &src, &dst) == 0 ? 0 : 1);
+	case k_conc_out:
+	case k_conc_in:
+		snprintf(width, sizeof(width), "%d",
+			p->kind == k_conc_out ? p->nedges_out : p->nedges_in);
+		execl(conc_path, "dgsh-conc", p->kind == k_conc_out ? "-o" : "-i",
+			width, (char *)NULL);
+		err(1, "Error executing %s", conc_path);
+	}
+	exit(1);
+}
+
+/*
+ * Read everything from fd into a dynamically allocated
+ * null-terminated string.
+ */
+static char *
+read_all(int fd)
+{
+	size_t size = 64 * 1024, len = 0;
+	char *buff = malloc(size);
+	ssize_t n;
+
+	if (buff == NULL)
+		err(1, "Out of memory for output");
+	while ((n = read(fd, buff + len, size - 1 - len)) > 0)
+		if ((len += n) == size - 1 &&
+		    (buff = realloc(buff, size *= 2)) == NULL)
+			err(1, "Out of memory for output");
+	buff[len] = '\0';
+	return buff;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *progname = argv[0];
+	const char *conc_path = "./negotiate-bench-conc";
+	const char *shape = "chain";
+	int i, j, ch, n = 100, width, depth, status, nconcs = 0, failed = 0;
+	int err_pipe[2], writes, total_writes = 0;
+	unsigned long bytes, total_bytes = 0;
+	double start, elapsed, negotiation = -1;
+	struct rlimit rl;
+	char *output, *line;
+
+	nested_width = 4;
+	while ((ch = getopt(argc, argv, "c:fn:s:w:")) != -1) {
+		switch (ch) {
+		case 'c':
+			conc_path = optarg;
+			break;
+		case 'f':
+			opt_flexible = true;
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 's':
+			shape = optarg;
+			break;
+		case 'w':
+			nested_width = atoi(optarg);
+			break;
+		case '?':
+		default:
+			usage(progname);
+		}
+	}
+	if (argc != optind)
+		usage(progname);
+
+	width = build_graph(progname, shape, n, &depth);
+	for (i = 0; i < nprocs; i++)
+		if (procs[i].kind != k_node)
+			nconcs++;
+
+	/* The driver holds the sockets of a whole concentrator's ports */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	/* Large graphs need more than the default negotiation timeout */
+	setenv("DGSH_TIMEOUT", "120", 0);
+
+	/* Processes report their statistics on their standard error */
+	if (pipe(err_pipe) == -1)
+		err(1, "Error creating pipe");
+
+	/*
+	 * Processes are created in topological order, so the driver
+	 * only holds the sockets of edges whose consumer has not yet
+	 * been started.
+	 */
+	start = now();
+	for (i = 0; i < nprocs; i++) {
+		for (j = 0; j < nedges; j++)
+			if (edges[j].from == i) {
+				int sv[2];
+
+				if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+					err(1, "Error creating socket pair");
+				edges[j].fd_from = sv[0];
+				edges[j].fd_to = sv[1];
+			}
+		switch (procs[i].pid = fork()) {
+		case -1:
+			err(1, "Error creating process");
+		case 0:
+			if (dup2(err_pipe[1], STDERR_FILENO) == -1)
+				err(1, "Error redirecting standard error");
+			close(err_pipe[0]);
+			close(err_pipe[1]);
+			run_proc(i, conc_path);
+		}
+		for (j = 0; j < nedges; j++)
+			if (edges[j].from == i) {
+				close(edges[j].fd_from);
+				edges[j].fd_from = -1;
+			} else if (edges[j].to == i) {
+				close(edges[j].fd_to);
+				edges[j].fd_to = -1;
+			}
+	}
+	close(err_pipe[1]);
+
+	output = read_all(err_pipe[0]);
+	for (i = 0; i < nprocs; i++)
+		if (waitpid(procs[i].pid, &status, 0) == -1 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed++;
+	elapsed = now() - start;
+
+	for (line = strtok(output, "\n"); line; line = strtok(NULL, "\n"))
+		if (sscanf(line, "The dgsh negotiation process %*d wrote %d message blocks of %lu bytes",
+		    &writes, &bytes) == 2) {
+			total_writes += writes;
+			total_bytes += bytes;
+		} else if (sscanf(line, "The dgsh negotiation procedure took about %lf seconds",
+		    &negotiation) != 1)
+			fprintf(stderr, "%s\n", line);
+
+	printf("{\"shape\": \"%s\", \"flexible\": %s, \"width\": %d, "
+		"\"depth\": %d, \"processes\": %d, \"concentrators\": %d, "
+		"\"edges\": %d, \"elapsed\": %.5f, ",
+		shape, opt_flexible ? "true" : "false", width, depth,
+		nprocs, nconcs, nedges, elapsed);
+	if (negotiation >= 0)
+		printf("\"negotiation\": %.5f, ", negotiation);
+	else
+		printf("\"negotiation\": null, ");
+	printf("\"message_blocks\": %d, \"message_bytes\": %lu, "
+		"\"bytes_per_block\": %.0f, \"failed\": %d}\n",
+		total_writes, total_bytes,
+		total_writes ? (double)total_bytes / total_writes : 0,
+		failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,126 @@
+#!/bin/sh
+#
+# Benchmark how the dgsh negotiation scales with the size and shape of
+# synthetic graphs, and output the results in JSON format, so that
+# they can be compared across commits
+#
+#  Copyright 2017 Diomidis Spinellis
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+usage()
+{
+	echo "Usage: $0 [-m max-nodes] [-n runs] [-o file]" 1>&2
+	exit 2
+}
+
+RUNS=3
+MAX=2000
+OUTPUT=
+
+while getopts 'm:n:o:' o; do
+	case "$o" in
+	m)
+		MAX="$OPTARG"
+		;;
+	n)
+		RUNS="$OPTARG"
+		;;
+	o)
+		OUTPUT="$OPTARG"
+		;;
+	*)
+		usage
+		;;
+	esac
+done
+
+# The negotiation code is compiled with -DTIME to report its traffic
+SRC=../core-tools/src
+if ! [ negotiate-bench -nt negotiate-bench.c ] ||
+    ! [ negotiate-bench -nt $SRC/negotiate.c ] ; then
+	${CC:-cc} -O2 -DTIME -I$SRC -o negotiate-bench negotiate-bench.c \
+		$SRC/negotiate.c $SRC/dgsh-elf.s || exit 1
+fi
+if ! [ negotiate-bench-conc -nt $SRC/dgsh-conc.c ] ||
+    ! [ negotiate-bench-conc -nt $SRC/negotiate.c ] ; then
+	${CC:-cc} -O2 -DTIME -I$SRC -o negotiate-bench-conc $SRC/dgsh-conc.c \
+		$SRC/negotiate.c $SRC/dgsh-elf.s || exit 1
+fi
+
+COMMIT=$(git rev-parse HEAD 2>/dev/null || echo unknown)
+OUTPUT=${OUTPUT:-negotiate-bench-$(echo $COMMIT | cut -c1-12).json}
+
+cat >$OUTPUT <<EOF
+{
+  "commit": "$COMMIT",
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "host": "$(uname -n)",
+  "system": "$(uname -sr)",
+  "cpus": $(getconf _NPROCESSORS_ONLN),
+  "runs": $RUNS,
+  "results": [
+EOF
+FIRST=1
+
+# Run the driver with the specified arguments, and append the result
+# of its fastest run to the output
+run()
+{
+	local best result run
+
+	echo "Running negotiate-bench $*" 1>&2
+	best=
+	run=0
+	while [ $run -lt $RUNS ] ; do
+		if ! result=$(./negotiate-bench "$@") ; then
+			echo "negotiate-bench $* failed: $result" 1>&2
+			exit 1
+		fi
+		# Keep the fastest run
+		if [ -z "$best" ] || [ $(echo "$result $best" |
+		    sed 's/[^0-9.]*"elapsed": \([0-9.]*\).*"elapsed": \([0-9.]*\).*/\1 \2/' |
+		    awk '{print $1 < $2}') = 1 ] ; then
+			best="$result"
+		fi
+		run=$((run + 1))
+	done
+	if [ $FIRST = 0 ] ; then
+		echo , >>$OUTPUT
+	fi
+	echo "    $best" | tr -d '\n' >>$OUTPUT
+	FIRST=0
+}
+
+for n in 10 20 50 100 200 500 1000 2000 ; do
+	if [ $n -gt $MAX ] ; then
+		break
+	fi
+	for flexible in '' -f ; do
+		run $flexible -s chain -n $n
+		run $flexible -s nested -w 4 -n $n
+		if [ $n -ge 40 ] ; then
+			run $flexible -s nested -w 16 -n $n
+		fi
+		run $flexible -s fanout -n $n
+		run $flexible -s scatter-gather -n $n
+	done
+done
+
+cat >>$OUTPUT <<EOF
+
+  ]
+}
+EOF
+echo "Results are in $OUTPUT" 1>&2
@@ -0,0 +1,236 @@
+#!/bin/sh
+#
+# Generate deterministic synthetic benchmark inputs that require no
+# network access: text, web logs, numeric streams, sorted key-value
+# files, source code trees, and a git repository.
+# The output depends only on the specified scale, and is identical
+# across runs, machines, and awk implementations.
+#
+#  Copyright 2017 Diomidis Spinellis
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+# Approximate size of the text and log inputs in MB
+SCALE=${1:-10}
+# Directory where the data are created
+SYNTH=${2:-synth-$SCALE}
+
+export LC_ALL=C
+
+# Park-Miller minimal standard generator.
+# Its products fit in a double's mantissa, so unlike srand()/rand() it
+# produces the same sequence in all awk implementations.
+RNG='
+function rnd_seed(s) { rnd_x = s % 2147483646 + 1 }
+function rnd() {
+	rnd_x = (rnd_x * 16807) % 2147483647
+	return rnd_x / 2147483647
+}
+# Integer in [0, n)
+function rnd_int(n) { return int(rnd() * n) }
+# Integer in [0, n) with a Zipf-like distribution favoring low values
+function rnd_zipf(n,  r) { r = rnd(); return int(n * r * r * r) }
+# Deterministic pronounceable word for the specified number
+function word(n,  w, c, v) {
+	c = "bcdfghjklmnprstvwz"
+	v = "aeiou"
+	w = ""
+	do {
+		w = w substr(c, n % 18 + 1, 1) substr(v, int(n / 18) % 5 + 1, 1)
+		n = int(n / 90)
+	} while (n > 0)
+	return w
+}
+'
+
+mkdir -p $SYNTH
+
+# Text: lines of words with a Zipf-like frequency distribution
+if ! [ -r $SYNTH/text.txt ] ; then
+	echo "Generating $SYNTH/text.txt" 1>&2
+	awk -v size=$SCALE "$RNG"'
+	BEGIN {
+		rnd_seed(1)
+		limit = size * 1024 * 1024
+		while (total < limit) {
+			n = 5 + rnd_int(10)
+			line = ""
+			for (i = 0; i < n; i++) {
+				w = word(rnd_zipf(50000))
+				if (i == 0 && rnd_int(4) == 0)
+					w = toupper(substr(w, 1, 1)) substr(w, 2)
+				line = line (i ? " " : "") w
+			}
+			if (rnd_int(8) == 0)
+				line = line "."
+			print line
+			total += length(line) + 1
+		}
+	}' >$SYNTH/text.txt
+fi
+
+# Web server log in the Common Log Format, similar to the ClarkNet traces
+if ! [ -r $SYNTH/access.log ] ; then
+	echo "Generating $SYNTH/access.log" 1>&2
+	awk -v size=$SCALE "$RNG"'
+	BEGIN {
+		rnd_seed(2)
+		split("Jan Feb Mar Apr May Jun Jul Aug Sep Oct Nov Dec", month)
+		split("html gif jpg txt cgi", ext)
+		limit = size * 1024 * 1024
+		t = 0
+		while (total < limit) {
+			if (rnd_int(3) == 0)
+				host = sprintf("%d.%d.%d.%d", 128 + rnd_zipf(64),
+				    rnd_int(256), rnd_int(256), 1 + rnd_int(254))
+			else
+				host = word(rnd_zipf(2000)) "." \
+				    word(rnd_int(40)) (rnd_int(2) ? ".com" : ".net")
+			t += rnd_int(3)
+			day = 28 + int(t / 86400)
+			path = ""
+			for (d = rnd_int(3); d >= 0; d--)
+				path = path "/" word(rnd_zipf(300))
+			path = path "." ext[1 + rnd_zipf(5)]
+			r = rnd_int(100)
+			status = r < 85 ? 200 : r < 95 ? 304 : r < 99 ? 404 : 500
+			bytes = status == 200 ? 100 + rnd_zipf(100000) : "-"
+			line = sprintf("%s - - [%02d/%s/1995:%02d:%02d:%02d -0400] " \
+			    "\"GET %s HTTP/1.0\" %d %s", host, day, month[8],
+			    int(t / 3600) % 24, int(t / 60) % 60, t % 60, path,
+			    status, bytes)
+			print line
+			total += length(line) + 1
+		}
+	}' >$SYNTH/access.log
+fi
+
+# Numeric samples: noisy sinusoids
+if ! [ -r $SYNTH/samples.txt ] ; then
+	echo "Generating $SYNTH/samples.txt" 1>&2
+	awk -v size=$SCALE "$RNG"'
+	BEGIN {
+		rnd_seed(3)
+		n = size * 1024 * 1024 / 12
+		for (i = 0; i < n; i++) {
+			v = sin(i * 0.7) + 0.5 * sin(i * 2.1)
+			printf("%.8f\n", v + 0.1 * (rnd() - 0.5))
+		}
+	}' >$SYNTH/samples.txt
+fi
+
+# Sorted key, count, item files for the merging tools
+for i in 1 2 3 4 ; do
+	if ! [ -r $SYNTH/sorted-$i.txt ] ; then
+		echo "Generating $SYNTH/sorted-$i.txt" 1>&2
+		awk -v size=$SCALE -v seed=$i "$RNG"'
+		BEGIN {
+			rnd_seed(10 + seed)
+			n = size * 1024 * 1024 / 16 / 4
+			for (i = 0; i < n; i++)
+				print word(rnd_zipf(n)), 1 + rnd_int(100), \
+				    word(rnd_int(50))
+		}' |
+		sort -k1,1 >$SYNTH/sorted-$i.txt
+	fi
+	# The same data as count, key pairs, like the output of uniq -c
+	if ! [ -r $SYNTH/counts-$i.txt ] ; then
+		awk '{print $2, $1}' $SYNTH/sorted-$i.txt >$SYNTH/counts-$i.txt
+	fi
+done
+
+# Two versions of a C source code tree, with duplicate files
+if ! [ -d $SYNTH/tree.new ] ; then
+	echo "Generating $SYNTH/tree.old and $SYNTH/tree.new" 1>&2
+	for version in old new ; do
+		awk -v size=$SCALE -v dir=$SYNTH/tree.$version \
+		    -v version=$version "$RNG"'
+		# Output a C function to the specified file
+		function cfunction(file, name,  i, n) {
+			printf("/*\n * Process the %s of the %s\n */\n",
+			    word(rnd_int(500)), word(rnd_int(500))) >file
+			printf("static int\n%s(int %s, char *%s)\n{\n", name,
+			    word(rnd_int(100)), word(rnd_int(100))) >file
+			n = 2 + rnd_int(20)
+			for (i = 0; i < n; i++)
+				printf("\t%s = %s(%d, \"%s\");\n",
+				    word(rnd_int(100)), word(rnd_int(1000)),
+				    rnd_int(1000), word(rnd_int(5000))) >file
+			printf("\treturn %d;\n}\n\n", rnd_int(10)) >file
+		}
+		BEGIN {
+			ndirs = 5 * size
+			for (d = 0; d < ndirs; d++) {
+				path = dir "/" word(d)
+				if (d % 3 == 2)
+					path = path "/" word(d * 7)
+				system("mkdir -p " path)
+				for (f = 0; f < 10; f++) {
+					seed = d * 100 + f
+					# Modify a tenth of the files
+					if (version == "new" && seed % 10 == 3)
+						seed += 100000
+					file = path "/" word(seed) ".c"
+					rnd_seed(seed)
+					base = word(seed)
+					header = word(d)
+					# Each sixth file has one of four duplicated contents
+					if (f % 6 == 5) {
+						rnd_seed(d % 4)
+						base = "common"
+						header = "common"
+					}
+					printf("#include \"%s.h\"\n\n",
+					    header) >file
+					n = 3 + rnd_int(15)
+					for (i = 0; i < n; i++)
+						cfunction(file, base "_" word(i))
+					close(file)
+				}
+				file = path "/" word(d) ".h"
+				printf("#define %s %d\n", toupper(word(d)), d) >file
+				close(file)
+			}
+		}'
+	done
+fi
+
+# Git repository with deterministic commits
+if ! [ -d $SYNTH/repo ] && command -v git >/dev/null ; then
+	echo "Generating $SYNTH/repo" 1>&2
+	git init -q $SYNTH/repo
+	awk -v size=$SCALE "$RNG"'
+	BEGIN {
+		rnd_seed(4)
+		t = 788918400	# 1995-01-01
+		n = 100 * size
+		for (i = 0; i < n; i++) {
+			t += rnd_int(86400)
+			author = word(rnd_zipf(30))
+			print t, author, word(rnd_int(50)) ".c", word(rnd_int(5000))
+		}
+	}' |
+	(
+		cd $SYNTH/repo
+		while read t author file text ; do
+			echo "$text" >>$file
+			git add $file
+			GIT_AUTHOR_NAME=$author GIT_AUTHOR_EMAIL=$author@example.com \
+			GIT_COMMITTER_NAME=$author \
+			GIT_COMMITTER_EMAIL=$author@example.com \
+			GIT_AUTHOR_DATE="$t +0000" GIT_COMMITTER_DATE="$t +0000" \
+			git commit -q -m "Change $file" --no-gpg-sign
+		done
+	)
+fi
@@ -0,0 +1,500 @@
+/*
+ * Copyright 2017 Diomidis Spinellis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Micro-benchmark of dgsh-tee in isolation.
+ * Run a single dgsh-tee process between a synthetic producer and
+ * one or more synthetic consumers connected over pipes, and output
+ * a JSON object with its throughput and resource usage.
+ *
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE		// wait4, WNOWAIT
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CONSUMERS 16
+#define MAX_TEE_ARGS 64
+
+/* Size of a producer's or consumer's read(2) or write(2) calls */
+#define CHUNK_SIZE (64 * 1024)
+
+/* Bytes transferred at full speed before a bursty endpoint pauses */
+#define BURST_SIZE (4 * 1024 * 1024)
+#define BURST_PAUSE_MS 100
+
+/* Point at which a stalled endpoint pauses or an eof-early one stops */
+#define EVENT_POINT (1024 * 1024)
+#define STALL_MS 1000
+
+/* Behaviour of a synthetic producer or consumer */
+enum profile {
+	p_fast,		/* Transfer data as fast as possible */
+	p_slow,		/* Transfer data at a limited rate */
+	p_bursty,	/* Alternate bursts of data with pauses */
+	p_stalled,	/* Stop transferring data for a while, then continue */
+	p_eof_early,	/* Close the pipe after transferring a little data */
+};
+
+static const char *profile_names[] = {
+	"fast", "slow", "bursty", "stalled", "eof-early",
+};
+
+/* Rate of slow endpoints in bytes per second */
+static double slow_rate = 16 * 1024 * 1024;
+
+/*
+ * Bytes received by each consumer, followed by the bytes sent by the
+ * producer; shared with the child processes
+ */
+static unsigned long long *transferred;
+#define PRODUCED MAX_CONSUMERS
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage %s [-c profile] [-n size] [-p profile] [-r rate] [-t path] [-- tee-option ...]\n"
+		"-c profile"	"\tAdd a consumer with the specified profile (default two fast ones)\n"
+		"-n size[k|M|G]""\tNumber of bytes to produce (default 256M)\n"
+		"-p profile"	"\tSpecify the producer's profile (default fast)\n"
+		"-r rate[k|M|G]""\tBytes per second of slow producers and consumers (default 16M)\n"
+		"-t path"	"\tPath of the dgsh-tee program to benchmark\n"
+		"Profiles are fast, slow, bursty, stalled, and eof-early\n",
+		name);
+	exit(1);
+}
+
+static unsigned long long
+parse_size(const char *progname, const char *s)
+{
+	char *endptr;
+	unsigned long long n = strtoull(s, &endptr, 10);
+
+	switch (*endptr) {
+	case '\0':
+		return n;
+	case 'K' : case 'k':
+		return n * 1024;
+	case 'M' : case 'm':
+		return n * 1024 * 1024;
+	case 'G' : case 'g':
+		return n * 1024 * 1024 * 1024;
+	default:
+		usage(progname);
+	}
+	return 0;
+}
+
+static enum profile
+parse_profile(const char *progname, const char *s)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(profile_names) / sizeof(*profile_names); i++)
+		if (strcmp(s, profile_names[i]) == 0)
+			return (enum profile)i;
+	usage(progname);
+	return p_fast;
+}
+
+/* Return the current time in seconds */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+sleep_seconds(double s)
+{
+	struct timespec ts;
+
+	if (s <= 0)
+		return;
+	ts.tv_sec = (time_t)s;
+	ts.tv_nsec = (long)((s - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+/*
+ * Apply the specified profile's pacing after a transfer of n bytes
+ * that brought the total to done bytes since the start time.
+ * Return 0 if the transfer should stop.
+ */
+static int
+pace(enum profile profile, unsigned long long done, size_t n,
+	double start)
+{
+	switch (profile) {
+	case p_fast:
+		break;
+	case p_slow:
+		sleep_seconds(start + done / slow_rate - now());
+		break;
+	case p_bursty:
+		if (done / BURST_SIZE != (done - n) / BURST_SIZE)
+			sleep_seconds(BURST_PAUSE_MS / 1000.0);
+		break;
+	case p_stalled:
+		if (done >= EVENT_POINT && done - n < EVENT_POINT)
+			sleep_seconds(STALL_MS / 1000.0);
+		break;
+	case p_eof_early:
+		if (done >= EVENT_POINT)
+			return 0;
+		break;
+	}
+	return 1;
+}
+
+/*
+ * Write up to size bytes of newline-terminated records to fd,
+ * recording the bytes written in *done
+ */
+static void
+produce(int fd, enum profile profile, unsigned long long size,
+	unsigned long long *done)
+{
+	char buff[CHUNK_SIZE];
+	double start = now();
+	size_t i;
+
+	/* Records of 64 bytes, so that -s can scatter them */
+	for (i = 0; i < sizeof(buff); i++)
+		buff[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+
+	while (*done < size) {
+		size_t n = size - *done < sizeof(buff) ? size - *done : sizeof(buff);
+		ssize_t w = write(fd, buff, n);
+
+		if (w < 0) {
+			if (errno == EPIPE)
+				break;
+			err(2, "Error writing to dgsh-tee");
+		}
+		*done += w;
+		if (!pace(profile, *done, w, start))
+			break;
+	}
+}
+
+/* Read data from fd until EOF, recording the bytes read in *count */
+static void
+consume(int fd, enum profile profile, unsigned long long *count)
+{
+	char buff[CHUNK_SIZE];
+	double start = now();
+	ssize_t n;
+
+	while ((n = read(fd, buff, sizeof(buff))) > 0) {
+		*count += n;
+		if (!pace(profile, *count, n, start))
+			break;
+	}
+	if (n < 0)
+		err(2, "Error reading from dgsh-tee");
+}
+
+/* Close all the specified file descriptors, apart from keep */
+static void
+close_except(int *fds, int nfds, int keep)
+{
+	int i;
+
+	for (i = 0; i < nfds; i++)
+		if (fds[i] != keep)
+			(void)close(fds[i]);
+}
+
+/*
+ * Return the number of read and write system calls made by the
+ * specified zombie process, or -1 if this cannot be determined.
+ */
+static long long
+rw_syscalls(pid_t pid)
+{
+	char path[64], line[128];
+	long long n, total = 0;
+	int found = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "syscr: %lld", &n) == 1 ||
+		    sscanf(line, "syscw: %lld", &n) == 1) {
+			total += n;
+			found++;
+		}
+	fclose(f);
+	return found == 2 ? total : -1;
+}
+
+/*
+ * Sum the values following the specified label in the memory
+ * statistics that dgsh-tee -M outputs for each input.
+ */
+static long
+stat_sum(const char *stats, const char *label)
+{
+	const char *p;
+	long sum = 0;
+
+	for (p = stats; (p = strstr(p, label)) != NULL; p += strlen(label))
+		sum += atol(p + strlen(label));
+	return sum;
+}
+
+/* Output the n strings in v as a JSON string, separated by spaces */
+static void
+json_string(char *v[], int n)
+{
+	const char *s;
+	int i;
+
+	putchar('"');
+	for (i = 0; i < n; i++) {
+		if (i)
+			putchar(' ');
+		for (s = v[i]; *s; s++)
+			if (*s == '"' || *s == '\\')
+				printf("\\%c", *s);
+			else
+				putchar(*s);
+	}
+	putchar('"');
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *progname = argv[0];
+	const char *tee_path = getenv("DGSH_TEE") ? getenv("DGSH_TEE") : "dgsh-tee";
+	enum profile producer = p_fast;
+	enum profile consumers[MAX_CONSUMERS];
+	int nconsumers = 0;
+	unsigned long long size = 256 * 1024 * 1024;
+	unsigned long long input_bytes, output_bytes = 0;
+	char *tee_argv[MAX_TEE_ARGS + 2 * MAX_CONSUMERS + 4];
+	char fd_names[MAX_CONSUMERS][32];
+	int fds[2 * MAX_CONSUMERS + 4], nfds = 0;
+	int in_pipe[2], out_pipe[MAX_CONSUMERS][2], err_pipe[2];
+	pid_t tee_pid, producer_pid, consumer_pid[MAX_CONSUMERS];
+	char stats[64 * 1024];
+	size_t stats_len = 0;
+	struct rusage ru;
+	long long syscalls;
+	double start, elapsed;
+	siginfo_t si;
+	ssize_t n;
+	int i, ch, tee_argc = 0, status;
+
+	while ((ch = getopt(argc, argv, "c:n:p:r:t:")) != -1) {
+		switch (ch) {
+		case 'c':
+			if (nconsumers == MAX_CONSUMERS)
+				errx(1, "More than %d consumers specified", MAX_CONSUMERS);
+			consumers[nconsumers++] = parse_profile(progname, optarg);
+			break;
+		case 'n':
+			size = parse_size(progname, optarg);
+			break;
+		case 'p':
+			producer = parse_profile(progname, optarg);
+			break;
+		case 'r':
+			slow_rate = parse_size(progname, optarg);
+			if (slow_rate == 0)
+				usage(progname);
+			break;
+		case 't':
+			tee_path = optarg;
+			break;
+		case '?':
+		default:
+			usage(progname);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc > MAX_TEE_ARGS)
+		errx(1, "More than %d dgsh-tee arguments specified", MAX_TEE_ARGS);
+
+	if (nconsumers == 0) {
+		consumers[nconsumers++] = p_fast;
+		consumers[nconsumers++] = p_fast;
+	}
+
+	transferred = mmap(NULL, sizeof(*transferred) * (MAX_CONSUMERS + 1),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	if (transferred == MAP_FAILED)
+		err(2, "Error allocating shared memory");
+	memset(transferred, 0, sizeof(*transferred) * (MAX_CONSUMERS + 1));
+
+	if (pipe(in_pipe) == -1 || pipe(err_pipe) == -1)
+		err(2, "Error creating pipe");
+	fds[nfds++] = in_pipe[0];
+	fds[nfds++] = in_pipe[1];
+	fds[nfds++] = err_pipe[0];
+	fds[nfds++] = err_pipe[1];
+	for (i = 0; i < nconsumers; i++) {
+		if (pipe(out_pipe[i]) == -1)
+			err(2, "Error creating pipe");
+		fds[nfds++] = out_pipe[i][0];
+		fds[nfds++] = out_pipe[i][1];
+	}
+
+	/*
+	 * A single consumer reads dgsh-tee's standard output, as -p
+	 * requires.  Otherwise consumers are passed as -o arguments
+	 * naming their pipes, and dgsh-tee leaves its standard output
+	 * unused.
+	 * Statistics are always requested, to obtain the paging counts.
+	 */
+	tee_argv[tee_argc++] = "dgsh-tee";
+	tee_argv[tee_argc++] = "-M";
+	for (i = 0; nconsumers > 1 && i < nconsumers; i++) {
+		snprintf(fd_names[i], sizeof(fd_names[i]), "/dev/fd/%d",
+			out_pipe[i][1]);
+		tee_argv[tee_argc++] = "-o";
+		tee_argv[tee_argc++] = fd_names[i];
+	}
+	for (i = 0; i < argc; i++)
+		tee_argv[tee_argc++] = argv[i];
+	tee_argv[tee_argc] = NULL;
+
+	/* Isolate the benchmark from the environment of a dgsh graph */
+	unsetenv("DGSH_IN");
+	unsetenv("DGSH_OUT");
+	signal(SIGPIPE, SIG_IGN);
+
+	start = now();
+	switch (tee_pid = fork()) {
+	case -1:
+		err(2, "Error creating process");
+	case 0:
+		signal(SIGPIPE, SIG_DFL);
+		if (dup2(in_pipe[0], STDIN_FILENO) == -1 ||
+		    (nconsumers == 1 &&
+		     dup2(out_pipe[0][1], STDOUT_FILENO) == -1) ||
+		    dup2(err_pipe[1], STDERR_FILENO) == -1)
+			err(2, "Error redirecting dgsh-tee's I/O");
+		for (i = 0; i < nfds; i++) {
+			int j, keep = 0;
+
+			for (j = 0; nconsumers > 1 && j < nconsumers; j++)
+				if (fds[i] == out_pipe[j][1])
+					keep = 1;
+			if (!keep)
+				(void)close(fds[i]);
+		}
+		execv(tee_path, tee_argv);
+		err(2, "Error executing %s", tee_path);
+	}
+
+	switch (producer_pid = fork()) {
+	case -1:
+		err(2, "Error creating process");
+	case 0:
+		close_except(fds, nfds, in_pipe[1]);
+		produce(in_pipe[1], producer, size, &transferred[PRODUCED]);
+		exit(0);
+	}
+
+	for (i = 0; i < nconsumers; i++)
+		switch (consumer_pid[i] = fork()) {
+		case -1:
+			err(2, "Error creating process");
+		case 0:
+			close_except(fds, nfds, out_pipe[i][0]);
+			consume(out_pipe[i][0], consumers[i], &transferred[i]);
+			exit(0);
+		}
+
+	close_except(fds, nfds, err_pipe[0]);
+	while ((n = read(err_pipe[0], stats + stats_len,
+			sizeof(stats) - 1 - stats_len)) > 0)
+		stats_len += n;
+	stats[stats_len] = '\0';
+	(void)close(err_pipe[0]);
+
+	/* Obtain the syscall counts while dgsh-tee is still a zombie */
+	if (waitid(P_PID, tee_pid, &si, WEXITED | WNOWAIT) == -1)
+		err(2, "Error waiting for dgsh-tee");
+	syscalls = rw_syscalls(tee_pid);
+	if (wait4(tee_pid, &status, 0, &ru) == -1)
+		err(2, "Error waiting for dgsh-tee");
+	if (waitpid(producer_pid, NULL, 0) == -1)
+		err(2, "Error waiting for the producer");
+	for (i = 0; i < nconsumers; i++)
+		if (waitpid(consumer_pid[i], NULL, 0) == -1)
+			err(2, "Error waiting for a consumer");
+	elapsed = now() - start;
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+		fputs(stats, stderr);
+
+	input_bytes = transferred[PRODUCED];
+	for (i = 0; i < nconsumers; i++)
+		output_bytes += transferred[i];
+
+	printf("{\"producer\": \"%s\", \"consumers\": [", profile_names[producer]);
+	for (i = 0; i < nconsumers; i++)
+		printf("%s\"%s\"", i ? ", " : "", profile_names[consumers[i]]);
+	printf("], \"tee_args\": ");
+	json_string(argv, argc);
+	printf(", \"input_bytes\": %llu, \"output_bytes\": %llu, "
+		"\"elapsed\": %.3f, \"throughput_gb_s\": %.3f, "
+		"\"user\": %.3f, \"system\": %.3f, \"max_rss_kb\": %ld, "
+		"\"voluntary_cs\": %ld, \"involuntary_cs\": %ld, ",
+		input_bytes, output_bytes,
+		elapsed, elapsed > 0 ? input_bytes / elapsed / 1e9 : 0,
+		ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+		ru.ru_maxrss, ru.ru_nvcsw, ru.ru_nivcsw);
+	if (syscalls >= 0)
+		printf("\"rw_syscalls\": %lld, \"syscalls_per_mb\": %.2f, ",
+			syscalls, input_bytes ?
+			syscalls / (input_bytes / 1024.0 / 1024.0) : 0);
+	else
+		printf("\"rw_syscalls\": null, \"syscalls_per_mb\": null, ");
+	printf("\"max_buffers\": %ld, \"pages_out\": %ld, \"pages_in\": %ld, "
+		"\"exit_status\": %d}\n",
+		stat_sum(stats, "Maximum allocated:"),
+		stat_sum(stats, "Page out:"),
+		stat_sum(stats, "In:"),
+		WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+	return 0;
+}
@@ -0,0 +1,135 @@
+#!/bin/sh
+#
+# Micro-benchmark the dgsh-tee buffering engine across its modes,
+# producer and consumer behaviours, and buffer and memory sizes,
+# and output the results in JSON format, so that changes to it can be
+# compared across commits
+#
+#  Copyright 2017 Diomidis Spinellis
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+usage()
+{
+	echo "Usage: $0 [-n size] [-o file] [-r rate] [-t dgsh-tee]" 1>&2
+	exit 2
+}
+
+SIZE=256M
+RATE=64M
+OUTPUT=
+
+TOP=$(cd .. ; pwd)
+TEE=${DGSH_TEE:-$TOP/build/libexec/dgsh/dgsh-tee}
+
+while getopts 'n:o:r:t:' o; do
+	case "$o" in
+	n)
+		SIZE="$OPTARG"
+		;;
+	o)
+		OUTPUT="$OPTARG"
+		;;
+	r)
+		RATE="$OPTARG"
+		;;
+	t)
+		TEE="$OPTARG"
+		;;
+	*)
+		usage
+		;;
+	esac
+done
+
+if ! [ -x "$TEE" ] ; then
+	echo "$0: $TEE is not an executable dgsh-tee" 1>&2
+	exit 1
+fi
+
+if ! [ tee-bench -nt tee-bench.c ] ; then
+	${CC:-cc} -O2 -Wall -o tee-bench tee-bench.c || exit 1
+fi
+
+COMMIT=$(git rev-parse HEAD 2>/dev/null || echo unknown)
+OUTPUT=${OUTPUT:-tee-bench-$(echo $COMMIT | cut -c1-12).json}
+
+cat >$OUTPUT <<EOF
+{
+  "commit": "$COMMIT",
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "host": "$(uname -n)",
+  "system": "$(uname -sr)",
+  "cpus": $(getconf _NPROCESSORS_ONLN),
+  "size": "$SIZE",
+  "slow_rate": "$RATE",
+  "results": [
+EOF
+FIRST=1
+
+# Run dgsh-tee with the specified producer, consumers, and options
+# and append the driver's result to the output
+run()
+{
+	local producer="$1" consumers="$2" c args
+	shift 2
+
+	args=
+	for c in $consumers ; do
+		args="$args -c $c"
+	done
+	echo "Running $producer -> dgsh-tee $* -> $consumers" 1>&2
+	if [ $FIRST = 0 ] ; then
+		echo , >>$OUTPUT
+	fi
+	printf '    ' >>$OUTPUT
+	./tee-bench -t $TEE -n $SIZE -r $RATE -p $producer $args -- "$@" |
+	tr -d '\n' >>$OUTPUT
+	FIRST=0
+}
+
+# Modes against representative sink behaviours
+for consumers in 'fast fast' 'fast slow' 'fast bursty' 'fast stalled' \
+    'fast eof-early' ; do
+	run fast "$consumers"
+	run fast "$consumers" -s
+	run fast "$consumers" -I
+	run fast "$consumers" -f -m 8M
+done
+run fast fast -p 1
+run fast slow -p 1
+
+# Source behaviours
+for producer in slow bursty stalled eof-early ; do
+	run $producer 'fast fast'
+	run $producer 'fast fast' -I
+done
+
+# Buffer and memory size sweeps, with a sink that forces buffering
+for b in 4k 64k 1M 4M ; do
+	run fast 'fast fast fast fast' -b $b
+	run fast 'fast fast fast fast' -s -b $b
+	run fast 'fast slow' -b $b
+done
+for m in 4M 16M 64M 256M ; do
+	run fast 'fast slow' -m $m
+	run fast 'fast slow' -f -m $m
+done
+
+cat >>$OUTPUT <<EOF
+
+  ]
+}
+EOF
+echo "Results are in $OUTPUT" 1>&2
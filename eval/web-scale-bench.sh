@@ -0,0 +1,210 @@
+#!/bin/sh
+#
+# Measure how the web log report example scales with the size of its
+# input and the number of cores it may use.
+# The input is a synthetic ClarkNet-format log (see synth-data.sh),
+# grown by log-grow.pl, and the cores are limited through the CPU
+# affinity mask.  No network access is required.
+#
+#  Copyright 2017 Diomidis Spinellis
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+
+usage()
+{
+	echo "Usage: $0 [-c 'cores ...'] [-g max-grow] [-n runs] [-o file] [-s scale]" 1>&2
+	exit 2
+}
+
+RUNS=1
+SCALE=10
+MAXGROW=16
+CORES=
+OUTPUT=
+
+while getopts 'c:g:n:o:s:' o; do
+	case "$o" in
+	c)
+		CORES="$OPTARG"
+		;;
+	g)
+		MAXGROW="$OPTARG"
+		;;
+	n)
+		RUNS="$OPTARG"
+		;;
+	o)
+		OUTPUT="$OPTARG"
+		;;
+	s)
+		SCALE="$OPTARG"
+		;;
+	*)
+		usage
+		;;
+	esac
+done
+
+EVAL=$(pwd)
+TOP=$(cd .. ; pwd)
+DGSH=${DGSH:-$TOP/build/bin/dgsh}
+LIBEXEC=${LIBEXEC:-$TOP/build/libexec/dgsh}
+PATH="$TOP/build/bin:$PATH"
+export DGSHPATH="$LIBEXEC"
+export LC_ALL=C
+
+SYNTH=$EVAL/synth-$SCALE
+sh synth-data.sh $SCALE $SYNTH || exit 1
+
+# Output the CPUs this process may run on, one per line
+allowed_cpus()
+{
+	sed -n 's/^Cpus_allowed_list:[ 	]*//p' /proc/self/status 2>/dev/null |
+	tr , '\n' |
+	awk -F- '{ for (i = $1; i <= ($2 == "" ? $1 : $2); i++) print i }'
+}
+
+ALLOWED=$(allowed_cpus)
+if [ -n "$ALLOWED" ] && command -v taskset >/dev/null ; then
+	NCPU=$(echo "$ALLOWED" | wc -l)
+else
+	echo "CPU affinity is not available; running on all cores" 1>&2
+	ALLOWED=
+	NCPU=$(getconf _NPROCESSORS_ONLN)
+fi
+
+# By default double the cores up to all available ones
+if [ -z "$CORES" ] ; then
+	c=1
+	while [ $c -lt $NCPU ] ; do
+		CORES="$CORES $c"
+		c=$((c * 2))
+	done
+	CORES="$CORES $NCPU"
+fi
+
+COMMIT=$(git rev-parse HEAD 2>/dev/null || echo unknown)
+OUTPUT=${OUTPUT:-web-scale-$(echo $COMMIT | cut -c1-12)-$SCALE.json}
+RESULTS=$EVAL/web-scale.results
+: >$RESULTS
+
+# Run the report on the specified log using the specified number of
+# cores, and output its fastest elapsed time and exit status
+measure()
+{
+	local log="$1" cores="$2" best= run=0 start end status pin=
+
+	if [ -n "$ALLOWED" ] ; then
+		pin="taskset -c $(echo "$ALLOWED" | head -n $cores | paste -sd, -)"
+	fi
+	while [ $run -lt $RUNS ] ; do
+		start=$(date +%s.%N)
+		$pin $DGSH $TOP/example/web-log-report.sh <$log >/dev/null 2>$EVAL/web-scale.err
+		status=$?
+		end=$(date +%s.%N)
+		best=$(echo $start $end $best | awk '{
+			e = $2 - $1
+			print ($3 == "" || e < $3) ? e : $3 }')
+		run=$((run + 1))
+	done
+	echo $best $status
+}
+
+GROW=1
+while [ $GROW -le $MAXGROW ] ; do
+	LOG=$SYNTH/access-$GROW.log
+	if ! [ -r $LOG ] ; then
+		echo "Generating $LOG" 1>&2
+		perl log-grow.pl $GROW $SYNTH/access.log >$LOG || exit 1
+	fi
+	BYTES=$(wc -c <$LOG)
+	for c in $CORES ; do
+		echo "Running web-log-report on $GROW x $SCALE MB with $c cores" 1>&2
+		echo $GROW $c $BYTES $(measure $LOG $c) >>$RESULTS
+	done
+	GROW=$((GROW * 2))
+done
+
+# Results in JSON format
+{
+	cat <<EOF
+{
+  "commit": "$COMMIT",
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "host": "$(uname -n)",
+  "system": "$(uname -sr)",
+  "cpus": $NCPU,
+  "scale": $SCALE,
+  "runs": $RUNS,
+  "results": [
+EOF
+	awk -v first=$(echo $CORES | cut -d' ' -f1) '
+	# Elapsed time on the fewest cores, for computing the speedup
+	$2 == first { base[$1] = $4 }
+	{
+		printf("%s    {\"grow\": %d, \"cores\": %d, \"input_bytes\": %d, " \
+		    "\"elapsed\": %.3f, \"throughput_mb_s\": %.3f, " \
+		    "\"speedup\": %s, \"exit_status\": %d}",
+		    NR > 1 ? ",\n" : "", $1, $2, $3, $4,
+		    $4 > 0 ? $3 / 1024 / 1024 / $4 : 0,
+		    ($1 in base) && $4 > 0 ? sprintf("%.2f", base[$1] / $4) : "null",
+		    $5)
+	}' $RESULTS
+	cat <<EOF
+
+  ]
+}
+EOF
+} >$OUTPUT
+
+# Throughput and speedup tables: a row for each size, a column for each core count
+awk -v cores="$CORES" '
+BEGIN { nc = split(cores, core) }
+{
+	if (!($1 in seen)) {
+		seen[$1] = 1
+		grow[ng++] = $1
+	}
+	elapsed[$1, $2] = $4
+	mb[$1] = $3 / 1024 / 1024
+}
+function header(title,  i) {
+	printf("\n%s\n%-12s", title, "Size (MB)")
+	for (i = 1; i <= nc; i++)
+		printf("%10s", core[i] " cores")
+	printf("\n")
+}
+END {
+	header("Throughput (MB/s)")
+	for (g = 0; g < ng; g++) {
+		printf("%-12.1f", mb[grow[g]])
+		for (i = 1; i <= nc; i++) {
+			e = elapsed[grow[g], core[i]]
+			printf("%10.2f", e > 0 ? mb[grow[g]] / e : 0)
+		}
+		printf("\n")
+	}
+	header("Speedup over " core[1] " core(s)")
+	for (g = 0; g < ng; g++) {
+		printf("%-12.1f", mb[grow[g]])
+		for (i = 1; i <= nc; i++) {
+			e = elapsed[grow[g], core[i]]
+			printf("%10.2f", e > 0 ? elapsed[grow[g], core[1]] / e : 0)
+		}
+		printf("\n")
+	}
+}' $RESULTS
+
+rm -f $RESULTS $EVAL/web-scale.err
+echo "Results are in $OUTPUT" 1>&2
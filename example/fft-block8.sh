@@ -3,6 +3,13 @@
 # SYNOPSIS FFT calculation
 # DESCRIPTION
 # Calculate the iterative FFT for n = 8 in parallel.
+# The input can consist of a sequence of 8-sample vectors, which are
+# distributed across the FFT graph in bit-reversed order and
+# processed as streams.
+# The output is ordered by coefficient rather than by vector: the first
+# coefficient of every input vector, one "real imaginaryi" line per
+# vector in input order, followed in the same way by the second
+# coefficient, and so on up to the eighth.
 # Demonstrates combined use of permute and multipipe blocks.
 #
 #  Copyright 2016 Marios Fragkoulis
@@ -20,8 +27,7 @@
 #  limitations under the License.
 #
 
-dgsh-fft-input $1 |
-perm 1,5,3,7,2,6,4,8 |
+dgsh-fft-input -r $1 |
 {{
 	{{
 		dgsh-w 1 0
@@ -45,13 +51,13 @@ perm 1,5,3,7,2,6,4,8 |
 }} |
 perm 1,5,3,7,2,6,4,8 |
 {{
-	dgsh-w 3 0
+	dgsh-w -t 3 0
 
-	dgsh-w 3 1
+	dgsh-w -t 3 1
 
-	dgsh-w 3 2
+	dgsh-w -t 3 2
 
-	dgsh-w 3 3
+	dgsh-w -t 3 3
 }} |
 perm 1,5,2,6,3,7,4,8 |
 cat
@@ -8,6 +8,8 @@
 # In contrast to GNU parallel, the block generated by dgsh-parallel
 # has N input and output streams, which can be combined by any
 # dgsh-compatible tool, such as dgsh-merge-sum or sort -m.
+# The words are sorted once by dgsh-sort, which divides them into
+# N ranges that are counted in parallel.
 #
 #  Copyright 2014-2016 Diomidis Spinellis
 #
@@ -30,9 +32,11 @@ N=8
 # Collation order for sorting
 export LC_ALL=C
 
-# Scatter input
-dgsh-tee -s |
-# Emulate Java's default StringTokenizer, sort, count
-dgsh-parallel -n $N "tr -s ' \t\n\r\f' '\n' | sort -S 512M | uniq -c" |
+# Emulate Java's default StringTokenizer
+tr -s ' \t\n\r\f' '\n' |
+# Sort, dividing the words into N ranges
+dgsh-sort -m 512M |
+# Count the words of each range
+dgsh-parallel -n $N "uniq -c" |
 # Merge sorted counts by providing N input channels
 dgsh-merge-sum $(for i in $(seq $N) ; do printf '<| ' ; done)
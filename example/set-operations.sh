@@ -29,10 +29,13 @@ fi
 
 cp $PSDIR/results $PSDIR/res
 
-# Sort result files
+# Collation order for sorting
+export LC_ALL=C
+
+# Sort result files, reusing the sorted copies of unchanged ones
 {{
-	sort $PSDIR/f4s
-	sort $PSDIR/f5s
+	dgsh-ref $PSDIR/f4s
+	dgsh-ref $PSDIR/f5s
 }} |
 # Remove noise
 comm |
@@ -27,17 +27,11 @@ export LC_ALL=C
 tee |
 {{
 	# Find errors
-	{{
-		# Obtain list of words in text
-		tr -cs A-Za-z \\n |
-		tr A-Z a-z |
-		sort -u
-
-		# Ensure dictionary is compatibly sorted
-		sort /usr/share/dict/words
-	}} |
-	# List errors as a set difference
-	comm -23
+	# Obtain list of words in text
+	tr -cs A-Za-z \\n |
+	tr A-Z a-z |
+	# List errors by looking them up in the dictionary's cached index
+	dgsh-ref -v /usr/share/dict/words
 
 	# Pass through text
 	cat
@@ -38,32 +38,19 @@ ranked_frequency()
 	sort -rn
 }
 
-# Convert standard input to a ranked frequency list of specified n-grams
-ngram()
-{
-	local N=$1
-
-	perl -ne 'for ($i = 0; $i < length($_) - '$N'; $i++) {
-		print substr($_, $i, '$N'), "\n";
-	}' |
-	ranked_frequency
-}
-
 export -f ranked_frequency
-export -f ngram
 
 tee |
 {{
-	# Split input one word per line
-	tr -cs a-zA-Z \\n |
-	tee |
+	# Split input into words, their digrams, and their trigrams
+	dgsh-ngram -n 2 -n 3 -w |
 	{{
 		# Digram frequency
-		call 'ngram 2 >digram.txt'
+		dgsh-count >digram.txt
 		# Trigram frequency
-		call 'ngram 3 >trigram.txt'
+		dgsh-count >trigram.txt
 		# Word frequency
-		call 'ranked_frequency >words.txt'
+		dgsh-count >words.txt
 	}}
 
 	# Store number of characters to use in awk below
@@ -5,6 +5,8 @@
 # Creates a report for a fixed-size web log file read from the standard input.
 # Demonstrates the combined use of multipipe blocks, writeval and readval
 # to store and retrieve values, and functions in the scatter block.
+# Each log record is split into fields only once, by dgsh-cut, which
+# sends each branch just the fields it processes.
 # Used to measure throughput increase achieved through parallelism.
 #
 #  Copyright 2013 Diomidis Spinellis
@@ -22,14 +24,6 @@
 #  limitations under the License.
 #
 
-# Output the top X elements of the input by the number of their occurrences
-# X is the first argument
-toplist()
-{
-	uniq -c | sort -rn | head -$1
-	echo
-}
-
 # Output the argument as a section header
 header()
 {
@@ -41,7 +35,6 @@ header()
 # Consistent sorting
 export LC_ALL=C
 
-export -f toplist
 export -f header
 
 
@@ -56,14 +49,15 @@ Summary
 EOF
 fi
 
-tee |
+# Fields: bytes, record, host, host and bytes, page, time
+dgsh-cut -f NF -f 0 -f 1 -f 1,NF -f 7 -f 4 |
 {{
 	# Number of accesses
 	echo -n 'Number of accesses: '
 	dgsh-readval -l -s nAccess
 
 	# Number of transferred bytes
-	awk '{s += $NF} END {print s}' |
+	awk '{s += $1} END {print s}' |
 	tee |
 	{{
 		echo -n 'Number of Gbytes transferred: '
@@ -96,7 +90,6 @@ tee |
 	awk '{print $1 / 1024 / 1024}'
 
 	# Host names
-	awk '{print $1}' |
 	tee |
 	{{
 		# Number of accesses
@@ -124,7 +117,8 @@ tee |
 			# Top 10 hosts
 			{{
 				 call 'header "Top 10 Hosts"'
-				 call 'toplist 10'
+				 dgsh-count -k 10
+				 echo
 			}}
 		}}
 
@@ -132,8 +126,8 @@ tee |
 		{{
 			call 'header "Top 20 Level Domain Accesses"'
 			awk -F. '$NF !~ /^[0-9]/ {print $NF}' |
-			sort |
-			call 'toplist 20'
+			dgsh-count -k 20
+			echo
 		}}
 
 		# Domains
@@ -150,7 +144,8 @@ tee |
 			# Top 10 domains
 			{{
 				 call 'header "Top 10 Domains"'
-				 call 'toplist 10'
+				 dgsh-count -k 10
+				 echo
 			}}
 		}}
 	}}
@@ -158,14 +153,13 @@ tee |
 	# Hosts by volume
 	{{
 		call 'header "Top 10 Hosts by Transfer"'
-		awk '    {bytes[$1] += $NF}
+		awk '    {bytes[$1] += $2}
 		END {for (h in bytes) print bytes[h], h}' |
 		sort -rn |
 		head -10
 	}}
 
 	# Sorted page name requests
-	awk '{print $7}' |
 	sort |
 	tee |
 	{{
@@ -174,7 +168,8 @@ tee |
 		{{
 			 call 'header "Top 20 Area Requests"'
 			 awk -F/ '{print $2}' |
-			 call 'toplist 20'
+			 dgsh-count -k 20
+			 echo
 		}}
 
 		# Number of different pages
@@ -185,12 +180,13 @@ tee |
 		# Top 20 requests
 		{{
 			 call 'header "Top 20 Requests"'
-			 call 'toplist 20'
+			 dgsh-count -k 20
+			 echo
 		}}
 	}}
 
 	# Access time: dd/mmm/yyyy:hh:mm:ss
-	awk '{print substr($4, 2)}' |
+	cut -c 2- |
 	tee |
 	{{
 
@@ -227,9 +223,7 @@ tee |
 				 call 'header "Accesses by Day of Week"'
 				 sed 's|/|-|g' |
 				 call '(date -f - +%a 2>/dev/null || gdate -f - +%a)' |
-				 sort |
-				 uniq -c |
-				 sort -rn
+				 dgsh-count
 			}}
 		}}
 